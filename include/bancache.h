@@ -40,46 +40,124 @@ class CoreExport BanCacheHit
 	 */
 	time_t Expiry;
 
-	BanCacheHit(const std::string &type, const std::string &reason, time_t seconds)
-		: Type(type), Reason(reason), Expiry(ServerInstance->Time() + seconds)
+	BanCacheHit() : Expiry(0)
 	{
 	}
 
 	bool IsPositive() const { return (!Reason.empty()); }
 };
 
-/* A container of ban cache items.
- * must be defined after class BanCacheHit.
+/** The address a ban cache entry is for, in binary form and without the port.
  */
-typedef TR1NS::unordered_map<std::string, BanCacheHit*, TR1NS::hash<std::string> > BanCacheHash;
+struct CoreExport BanCacheKey
+{
+	/** Address family, AF_INET or AF_INET6 */
+	unsigned char family;
+	/** Raw address bytes. Unused bytes are zero */
+	unsigned char addr[16];
+
+	BanCacheKey() : family(0) { memset(addr, 0, sizeof(addr)); }
+	BanCacheKey(const irc::sockets::sockaddrs& sa);
+	bool operator==(const BanCacheKey& other) const;
+
+	struct Hash
+	{
+		size_t operator()(const BanCacheKey& key) const;
+	};
+};
 
 /** A manager for ban cache, which allocates and deallocates and checks cached bans.
+ * Entries live in a fixed number of slots which are reused in CLOCK order once they
+ * are all in use, so a flood of connections from new addresses can not grow the cache
+ * without bound. Removing all the entries of a type only bumps a generation counter;
+ * entries older than that are dropped when they are next looked at or evicted.
  */
 class CoreExport BanCacheManager
 {
-	BanCacheHash* BanHash;
-	bool RemoveIfExpired(BanCacheHash::iterator& it);
+	struct Entry
+	{
+		BanCacheKey key;
+		BanCacheHit hit;
+		/** Value of generation when the entry was added */
+		unsigned long added;
+		/** Whether the slot holds an entry */
+		bool used;
+		/** Set on every lookup, cleared as the CLOCK hand passes */
+		bool referenced;
+
+		Entry() : added(0), used(false), referenced(false) { }
+	};
+
+	typedef TR1NS::unordered_map<BanCacheKey, size_t, BanCacheKey::Hash> SlotMap;
+
+	/** Entry storage, grown up to capacity */
+	std::vector<Entry> slots;
+
+	/** Unused slots below slots.size() */
+	std::vector<size_t> freeslots;
+
+	/** Slot of each cached address */
+	SlotMap index;
+
+	/** Maximum number of entries */
+	size_t capacity;
+
+	/** Next slot the CLOCK hand looks at */
+	size_t hand;
+
+	/** Incremented every time entries are invalidated */
+	unsigned long generation;
+
+	/** Generation at which positive entries of each type were last invalidated */
+	std::map<std::string, unsigned long> positive_removed;
+
+	/** Generation at which negative entries were last invalidated */
+	unsigned long negative_removed;
+
+	/** Check whether an entry has expired or been invalidated */
+	bool IsStale(const Entry& entry) const;
+
+	/** Drop the entry in a slot */
+	void Release(size_t slot);
+
+	/** Find a slot for a new entry, evicting one if the cache is full */
+	size_t Allocate();
 
  public:
+	/** Number of lookups which found a valid entry */
+	unsigned long Hits;
+
+	/** Number of lookups which found nothing */
+	unsigned long Misses;
+
+	/** Number of valid entries dropped to make room for new ones */
+	unsigned long Evictions;
 
 	/** Creates and adds a Ban Cache item.
-	 * @param ip The IP the item is for.
+	 * @param addr The address the item is for.
 	 * @param type The type of ban cache item. std::string. .empty() means it's a negative match (user is allowed freely).
 	 * @param reason The reason for the ban. Left .empty() if it's a negative match.
 	 * @param seconds Number of seconds before nuking the bancache entry, the default is a day. This might seem long, but entries will be removed as glines/etc expire.
 	 */
-	BanCacheHit *AddHit(const std::string &ip, const std::string &type, const std::string &reason, time_t seconds = 0);
-	BanCacheHit *GetHit(const std::string &ip);
+	BanCacheHit *AddHit(const irc::sockets::sockaddrs& addr, const std::string &type, const std::string &reason, time_t seconds = 0);
+	BanCacheHit *GetHit(const irc::sockets::sockaddrs& addr);
 
-	/** Removes all entries of a given type, either positive or negative. Returns the number of hits removed.
+	/** Removes all entries of a given type, either positive or negative.
 	 * @param type The type of bancache entries to remove (e.g. 'G')
 	 * @param positive Remove either positive (true) or negative (false) hits.
 	 */
 	void RemoveEntries(const std::string& type, bool positive);
 
-	BanCacheManager()
-	{
-		this->BanHash = new BanCacheHash();
-	}
-	~BanCacheManager();
+	/** Change the maximum number of entries. If the cache holds more than
+	 * that already, it is emptied.
+	 */
+	void SetCapacity(size_t newcapacity);
+
+	/** @return The number of slots in use, including stale entries not yet dropped */
+	size_t GetSize() const { return index.size(); }
+
+	/** @return The maximum number of entries */
+	size_t GetCapacity() const { return capacity; }
+
+	BanCacheManager();
 };
@@ -222,6 +222,15 @@ class CoreExport Channel : public Extensible, public InviteBase
 	 */
 	void ForceJoin(User* user, const std::string* privs = NULL, bool bursting = false, bool created_by_local = false);
 
+	/** Join several users to an existing channel at once, without doing any permission checks.
+	 * This does the same as calling ForceJoin() for each user without privileges, but walks
+	 * the member list once for all of them and tells modules about the joins in one event.
+	 * Users who are already on the channel are skipped.
+	 * @param users The users to join to the channel
+	 * @param bursting True if the joins are the result of a netburst (passed to modules in the OnUserJoinBatch hook)
+	 */
+	void ForceJoinMany(const std::vector<User*>& users, bool bursting = false);
+
 	/** Write to a channel, from a user, using va_args for text
 	 * @param user User whos details to prefix the line with
 	 * @param text A printf-style format string which builds the output line without prefix
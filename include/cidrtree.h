@@ -0,0 +1,267 @@
+/*
+ * InspIRCd -- Internet Relay Chat Daemon
+ *
+ *
+ * This file is part of InspIRCd.  InspIRCd is free software: you can
+ * redistribute it and/or modify it under the terms of the GNU General Public
+ * License as published by the Free Software Foundation, version 2.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#pragma once
+
+#include "socket.h"
+
+namespace irc
+{
+	namespace sockets
+	{
+		/** A compressed (PATRICIA) radix tree mapping CIDR masks to values.
+		 * IPv4 and IPv6 masks are kept in separate trees. Nodes only exist where a
+		 * value is stored or where two prefixes diverge, so a lookup of an address
+		 * visits at most one node per distinct prefix length on its path, no matter
+		 * how many masks are stored.
+		 */
+		template<typename T>
+		class cidr_tree
+		{
+			struct node
+			{
+				cidr_mask prefix;
+				bool used;
+				T value;
+				node* child[2];
+
+				node(const cidr_mask& mask, bool isused)
+					: prefix(mask), used(isused), value()
+				{
+					child[0] = child[1] = NULL;
+				}
+			};
+
+			/** Roots of the IPv4 and IPv6 trees */
+			node* roots[2];
+
+			/** Number of masks holding a value */
+			size_t count;
+
+			/** Get the root slot for an address family, or NULL if unsupported */
+			node** root(unsigned char type)
+			{
+				if (type == AF_INET)
+					return &roots[0];
+				if (type == AF_INET6)
+					return &roots[1];
+				return NULL;
+			}
+
+			/** Get bit number n (from the most significant end) of a mask */
+			static unsigned int bit(const cidr_mask& mask, unsigned int n)
+			{
+				return (mask.bits[n / 8] >> (7 - (n & 7))) & 1;
+			}
+
+			/** Count the leading bits two masks have in common, up to limit */
+			static unsigned int common(const cidr_mask& a, const cidr_mask& b, unsigned int limit)
+			{
+				unsigned int n = 0;
+				while (n + 8 <= limit && a.bits[n / 8] == b.bits[n / 8])
+					n += 8;
+				while (n < limit && bit(a, n) == bit(b, n))
+					n++;
+				return n;
+			}
+
+			/** Shorten a mask to the given length, clearing the bits after it */
+			static cidr_mask truncate(const cidr_mask& mask, unsigned int length)
+			{
+				cidr_mask ret = mask;
+				ret.length = length;
+				for (unsigned int i = length; i < 128; i++)
+					ret.bits[i / 8] &= ~(0x80 >> (i & 7));
+				return ret;
+			}
+
+			static void destroy(node* n)
+			{
+				if (!n)
+					return;
+				destroy(n->child[0]);
+				destroy(n->child[1]);
+				delete n;
+			}
+
+			cidr_tree(const cidr_tree&);
+			cidr_tree& operator=(const cidr_tree&);
+
+		 public:
+			cidr_tree() : count(0)
+			{
+				roots[0] = roots[1] = NULL;
+			}
+
+			~cidr_tree()
+			{
+				clear();
+			}
+
+			/** Remove every mask from the tree */
+			void clear()
+			{
+				destroy(roots[0]);
+				destroy(roots[1]);
+				roots[0] = roots[1] = NULL;
+				count = 0;
+			}
+
+			/** @return The number of masks holding a value */
+			size_t size() const { return count; }
+
+			bool empty() const { return !count; }
+
+			/** Find the value stored for exactly this mask.
+			 * @return The value, or NULL if the mask is not in the tree
+			 */
+			T* find(const cidr_mask& mask)
+			{
+				node** slot = root(mask.type);
+				node* n = slot ? *slot : NULL;
+				while (n && n->prefix.length <= mask.length)
+				{
+					if (common(n->prefix, mask, n->prefix.length) != n->prefix.length)
+						return NULL;
+					if (n->prefix.length == mask.length)
+						return n->used ? &n->value : NULL;
+					n = n->child[bit(mask, n->prefix.length)];
+				}
+				return NULL;
+			}
+
+			/** Find the value stored for a mask, inserting a default constructed
+			 * one if the mask is not in the tree yet. Masks of an unknown address
+			 * family are not supported and must not be passed here.
+			 */
+			T& operator[](const cidr_mask& mask)
+			{
+				node** link = root(mask.type);
+				while (*link)
+				{
+					node* n = *link;
+					unsigned int limit = std::min(n->prefix.length, mask.length);
+					unsigned int same = common(n->prefix, mask, limit);
+					if (same < n->prefix.length)
+					{
+						node* leaf = new node(mask, true);
+						if (same == mask.length)
+						{
+							// The new mask is a prefix of this node
+							leaf->child[bit(n->prefix, same)] = n;
+							*link = leaf;
+						}
+						else
+						{
+							// The two diverge; join them under a new branch node
+							node* branch = new node(truncate(mask, same), false);
+							branch->child[bit(mask, same)] = leaf;
+							branch->child[bit(n->prefix, same)] = n;
+							*link = branch;
+						}
+						count++;
+						return leaf->value;
+					}
+
+					if (n->prefix.length == mask.length)
+					{
+						if (!n->used)
+						{
+							n->used = true;
+							count++;
+						}
+						return n->value;
+					}
+
+					link = &n->child[bit(mask, n->prefix.length)];
+				}
+
+				*link = new node(mask, true);
+				count++;
+				return (*link)->value;
+			}
+
+			/** Remove a mask from the tree.
+			 * @return True if the mask was in the tree
+			 */
+			bool erase(const cidr_mask& mask)
+			{
+				node** path[129];
+				unsigned int depth = 0;
+
+				node** link = root(mask.type);
+				if (!link)
+					return false;
+
+				while (*link)
+				{
+					node* n = *link;
+					if (n->prefix.length > mask.length || common(n->prefix, mask, n->prefix.length) != n->prefix.length)
+						return false;
+					path[depth++] = link;
+					if (n->prefix.length == mask.length)
+						break;
+					link = &n->child[bit(mask, n->prefix.length)];
+				}
+
+				if (!*link || !(*link)->used)
+					return false;
+
+				(*link)->used = false;
+				(*link)->value = T();
+				count--;
+
+				// Splice out nodes which no longer hold a value and no longer branch
+				while (depth)
+				{
+					link = path[--depth];
+					node* n = *link;
+					if (n->used || (n->child[0] && n->child[1]))
+						break;
+					*link = n->child[0] ? n->child[0] : n->child[1];
+					delete n;
+				}
+				return true;
+			}
+
+			/** Find every stored mask which contains the given address.
+			 * @param addr The address to look up
+			 * @param out Receives the values of the matching masks, shortest mask first
+			 */
+			void lookup(const sockaddrs& addr, std::vector<T*>& out)
+			{
+				node** slot = root(addr.sa.sa_family);
+				if (!slot)
+					return;
+
+				const cidr_mask key(addr, 128);
+				node* n = *slot;
+				while (n)
+				{
+					if (common(n->prefix, key, n->prefix.length) != n->prefix.length)
+						break;
+					if (n->used)
+						out.push_back(&n->value);
+					if (n->prefix.length == key.length)
+						break;
+					n = n->child[bit(key, n->prefix.length)];
+				}
+			}
+		};
+	}
+}
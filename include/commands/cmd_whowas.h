@@ -23,20 +23,64 @@
 
 #include "modules.h"
 
-/* Forward ref for typedefs */
-class WhoWasGroup;
-
-/** A group of users related by nickname
+/** Used to hold WHOWAS information
  */
-typedef std::deque<WhoWasGroup*> whowas_set;
+class WhoWasGroup
+{
+	/** Real host, displayed host (only if it differs from the real host), ident and
+	 * fullname (GECOS), each followed by a NUL, so that a record needs one allocation.
+	 */
+	std::string data;
 
-/** Sets of users in the whowas system
- */
-typedef std::map<irc::string,whowas_set*> whowas_users;
+	/** Offsets of the fields in data
+	 */
+	unsigned int dhostpos;
+	unsigned int identpos;
+	unsigned int gecospos;
+
+ public:
+	/** Server name, shared with all other records from the same server
+	 */
+	const std::string* server;
+
+	/** Signon time
+	 */
+	time_t signon;
 
-/** Sets of time and users in whowas list
+	/** Initialize this WhoWasGroup with a user
+	 */
+	WhoWasGroup(User* user, const std::string* servername);
+
+	const char* GetHost() const { return data.c_str(); }
+	const char* GetDisplayedHost() const { return data.c_str() + dhostpos; }
+	const char* GetIdent() const { return data.c_str() + identpos; }
+	const char* GetGecos() const { return data.c_str() + gecospos; }
+
+	/** Get the number of bytes of heap memory used by this record
+	 */
+	size_t GetMemoryUsage() const { return data.capacity(); }
+};
+
+/** All records for a nickname, oldest first
  */
-typedef std::deque<std::pair<time_t,irc::string> > whowas_users_fifo;
+struct WhoWasNick
+{
+	/** The nickname, as it was first seen
+	 */
+	std::string nick;
+
+	/** Case insensitive hash of the nickname
+	 */
+	size_t hash;
+
+	/** Time the nickname was added to WHOWAS
+	 */
+	time_t added;
+
+	/** Records for this nickname, at most GroupSize of them
+	 */
+	std::vector<WhoWasGroup> entries;
+};
 
 /** Handle /WHOWAS. These command handlers can be reloaded by the core,
  * and handle basic RFC1459 commands. Commands within modules work
@@ -46,13 +90,39 @@ typedef std::deque<std::pair<time_t,irc::string> > whowas_users_fifo;
 class CommandWhowas : public Command
 {
   private:
-	/** Primary container, links nicknames tracked by WHOWAS to a list of records
+	/** Every nickname tracked by WHOWAS in the order it was added. This is a ring buffer
+	 * which grows up to MaxGroups entries, after which the oldest nickname is replaced
+	 * by the next new one. Nicknames only leave from the front, so the ring buffer
+	 * always has one entry per tracked nickname.
+	 */
+	std::vector<WhoWasNick> nicks;
+
+	/** Position of the oldest nickname in nicks. This is only nonzero when nicks is full.
+	 */
+	size_t oldest;
+
+	/** Open addressing hash table mapping nicknames to their position in nicks, with
+	 * empty buckets set to NO_NICK. The size is a power of two and it is kept at most
+	 * half full.
+	 */
+	std::vector<unsigned int> index;
+
+	/** Names of the servers records were added for, shared between the records
 	 */
-	whowas_users whowas;
+	std::set<std::string> servers;
 
-	/** List of nicknames in the order they were inserted into the map
+	/** Find the bucket of a nickname in the index.
+	 * @return The bucket holding the nickname, or the empty bucket where it would be inserted.
 	 */
-	whowas_users_fifo whowas_fifo;
+	size_t FindBucket(const std::string& nick, size_t hash) const;
+
+	/** Remove the nickname in the given bucket from the index.
+	 */
+	void EraseBucket(size_t bucket);
+
+	/** Rebuild the index from nicks.
+	 */
+	void RebuildIndex();
 
   public:
 	/** Max number of WhoWas entries per user.
@@ -80,34 +150,4 @@ class CommandWhowas : public Command
 	std::string GetStats();
 	void Prune();
 	void Maintain();
-	~CommandWhowas();
-};
-
-/** Used to hold WHOWAS information
- */
-class WhoWasGroup
-{
- public:
-	/** Real host
-	 */
-	std::string host;
-	/** Displayed host
-	 */
-	std::string dhost;
-	/** Ident
-	 */
-	std::string ident;
-	/** Server name
-	 */
-	std::string server;
-	/** Fullname (GECOS)
-	 */
-	std::string gecos;
-	/** Signon time
-	 */
-	time_t signon;
-
-	/** Initialize this WhoWasFroup with a user
-	 */
-	WhoWasGroup(User* user);
 };
@@ -203,6 +203,27 @@ class CoreExport ServerConfig
 	void CrossCheckOperClassType();
 	void CrossCheckConnectBlocks(ServerConfig* current);
 
+	/** Build the indexes used by FindConnectClasses() from Classes
+	 */
+	void IndexConnectClasses();
+
+	/** Connect classes with a valid CIDR allow or deny mask, by that mask. These are
+	 * also in ClassLiterals, as InspIRCd::MatchCIDR falls back to comparing masks literally.
+	 */
+	irc::sockets::cidr_tree<std::vector<size_t> > ClassRanges;
+
+	/** Connect classes whose allow or deny mask has no wildcards, by the case folded mask
+	 */
+	TR1NS::unordered_map<std::string, std::vector<size_t> > ClassLiterals;
+
+	/** Connect classes whose allow or deny mask has to be string matched against every user
+	 */
+	std::vector<size_t> ClassWildcards;
+
+	/** Named connect classes, these match nobody unless a module forces them
+	 */
+	std::vector<size_t> ClassNamed;
+
  public:
 	class ServerPaths
 	{
@@ -410,6 +431,17 @@ class CoreExport ServerConfig
 	 */
 	int NetBufferSize;
 
+	/** The maximum number of events the socket engine
+	 * handles in one pass of the main loop. Ready sockets
+	 * beyond this are picked up in the next pass.
+	 */
+	unsigned int EventBatch;
+
+	/** The maximum number of addresses kept in the ban cache.
+	 * Once it is full, the least recently used entries are replaced.
+	 */
+	unsigned int BanCacheSize;
+
 	/** The value to be used for listen() backlogs
 	 * as default.
 	 */
@@ -471,6 +503,13 @@ class CoreExport ServerConfig
 	 */
 	ClassVector Classes;
 
+	/** Find the connect classes whose allow or deny mask matches a user.
+	 * @param user The user to look up
+	 * @param out Receives the positions in Classes of the matching classes, in ascending order
+	 * @param named True to also return every named class, for modules to force
+	 */
+	void FindConnectClasses(LocalUser* user, std::vector<size_t>& out, bool named = false);
+
 	/** STATS characters in this list are available
 	 * only to operators.
 	 */
@@ -56,11 +56,13 @@ CoreExport extern InspIRCd* ServerInstance;
 #include "extensible.h"
 #include "numerics.h"
 #include "uid.h"
+#include "server.h"
 #include "users.h"
 #include "channels.h"
 #include "timer.h"
 #include "hashcomp.h"
 #include "logger.h"
+#include "cidrtree.h"
 #include "usermanager.h"
 #include "socket.h"
 #include "ctables.h"
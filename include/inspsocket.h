@@ -106,7 +106,8 @@ class CoreExport StreamSocket : public EventHandler
 	/** The IOHook that handles raw I/O for this socket, or NULL */
 	IOHook* iohook;
 
-	/** Private send queue. Note that individual strings may be shared
+	/** Private send queue. Data is copied into fixed size blocks which are
+	 * taken from and returned to a pool shared by all sockets.
 	 */
 	std::deque<std::string> sendq;
 	/** Length, in bytes, of the sendq */
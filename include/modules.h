@@ -266,6 +266,7 @@ enum Implementation
 	I_OnWhoisLine, I_OnBuildNeighborList, I_OnGarbageCollect, I_OnSetConnectClass,
 	I_OnText, I_OnPassCompare, I_OnRunTestSuite, I_OnNamesListItem, I_OnNumeric, I_OnHookIO,
 	I_OnPreRehash, I_OnModuleRehash, I_OnSendWhoLine, I_OnChangeIdent, I_OnSetUserIP,
+	I_OnUserJoinBatch,
 	I_END
 };
 
@@ -378,6 +379,15 @@ class CoreExport Module : public classbase, public usecountbase
 	 */
 	virtual void OnUserJoin(Membership* memb, bool sync, bool created, CUList& except_list);
 
+	/** Called when several users join a channel at once, e.g. when a remote server
+	 * sends the members of a channel in a netburst. Modules which do not implement this
+	 * have OnUserJoin() called for each of the memberships instead.
+	 * @param memberships The channel memberships being created, all on the same channel
+	 * @param sync This is set to true if the joins are the result of a network sync
+	 * @param except_lists For each membership, a list of users not to send its JOIN to
+	 */
+	virtual void OnUserJoinBatch(const std::vector<Membership*>& memberships, bool sync, std::vector<CUList>& except_lists);
+
 	/** Called after a user joins a channel
 	 * Identical to OnUserJoin, but called immediately afterwards, when any linking module has
 	 * seen the join.
@@ -1044,7 +1054,8 @@ class CoreExport Module : public classbase, public usecountbase
 	 */
 	virtual void OnGarbageCollect();
 
-	/** Called when a user's connect class is being matched
+	/** Called when a user's connect class is being matched. Only named classes and
+	 * classes whose allow or deny mask matches the user are offered.
 	 * @return MOD_RES_ALLOW to force the class to match, MOD_RES_DENY to forbid it, or
 	 * MOD_RES_PASSTHRU to allow normal matching (by host/port).
 	 */
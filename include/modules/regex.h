@@ -41,6 +41,132 @@ public:
 	{
 		return regex_string;
 	}
+
+	/** Retrieves a substring which appears in every string this regex matches.
+	 * Callers matching many regexes against the same text use this to skip
+	 * regexes which cannot possibly match before calling Matches().
+	 * @param literal Set to the required substring if one is known.
+	 * @return True if a required substring was found, false otherwise.
+	 */
+	virtual bool GetRequiredLiteral(std::string& literal)
+	{
+		return false;
+	}
+
+ protected:
+	/** Conservatively extracts a required substring from a POSIX or Perl style
+	 * regex. Only the top level of a pattern without alternation is examined
+	 * and anything which could make a character optional ends the current run.
+	 * @param rx The regex to examine.
+	 * @param literal Set to the longest required run of plain characters.
+	 * @return True if a required substring was found, false otherwise.
+	 */
+	static bool ExtractLiteral(const std::string& rx, std::string& literal)
+	{
+		// Alternation, inline options and grouping in basic syntax can all
+		// change the meaning of the characters around them.
+		if (rx.find_first_of("|\n") != std::string::npos || rx.find("(?") != std::string::npos)
+			return false;
+
+		std::string best;
+		std::string current;
+		int depth = 0;
+		for (std::string::size_type i = 0; i < rx.length(); ++i)
+		{
+			unsigned char chr = rx[i];
+			bool quantifier = false;
+			switch (chr)
+			{
+				case '\\':
+					if (i + 1 < rx.length() && strchr("(){}", rx[i + 1]))
+						return false;
+					// In GNU basic syntax \? makes the atom before it optional.
+					if (i + 1 < rx.length() && rx[i + 1] == '?')
+					{
+						++i;
+						quantifier = true;
+						break;
+					}
+					// Escapes such as \x41 or \101 may be followed by more of the same escape.
+					if (++i < rx.length() && isalnum(static_cast<unsigned char>(rx[i])))
+					{
+						while (i + 1 < rx.length() && isalnum(static_cast<unsigned char>(rx[i + 1])))
+							++i;
+					}
+					break;
+				case '[':
+					// Skip over the bracket expression including a leading ] or ^].
+					i += (i + 1 < rx.length() && rx[i + 1] == '^') ? 2 : 1;
+					if (i < rx.length() && rx[i] == ']')
+						++i;
+					while (i < rx.length() && rx[i] != ']')
+					{
+						// A backslash is an escape in Perl syntax but a plain character in POSIX
+						// syntax, so where the expression ends depends on the engine.
+						if (rx[i] == '\\')
+							return false;
+
+						// Character classes, equivalence classes and collating symbols
+						// such as [:alpha:] contain a ] which does not end the expression.
+						if (rx[i] == '[' && i + 1 < rx.length() && strchr(":=.", rx[i + 1]))
+						{
+							const char terminator[] = { rx[i + 1], ']', 0 };
+							std::string::size_type end = rx.find(terminator, i + 2);
+							if (end == std::string::npos)
+								return false;
+							i = end + 1;
+						}
+						++i;
+					}
+					// An unterminated bracket expression is invalid.
+					if (i >= rx.length())
+						return false;
+					break;
+				case '(':
+					++depth;
+					break;
+				case ')':
+					--depth;
+					break;
+				case '{':
+					while (i < rx.length() && rx[i] != '}')
+						++i;
+					quantifier = true;
+					break;
+				case '*':
+				case '?':
+					quantifier = true;
+					break;
+				case '+':
+				case '.':
+				case '^':
+				case '$':
+					break;
+				default:
+					if (depth == 0 && chr >= 0x20 && chr < 0x7F)
+					{
+						current.push_back(chr);
+						continue;
+					}
+					break;
+			}
+
+			// The atom before an optional quantifier may not appear at all.
+			if (quantifier && !current.empty())
+				current.erase(current.length() - 1);
+			if (current.length() > best.length())
+				best.swap(current);
+			current.clear();
+		}
+
+		if (current.length() > best.length())
+			best.swap(current);
+		if (best.empty())
+			return false;
+
+		literal.swap(best);
+		return true;
+	}
 };
 
 class RegexFactory : public DataProvider
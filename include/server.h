@@ -0,0 +1,68 @@
+/*
+ * InspIRCd -- Internet Relay Chat Daemon
+ *
+ *
+ * This file is part of InspIRCd.  InspIRCd is free software: you can
+ * redistribute it and/or modify it under the terms of the GNU General Public
+ * License as published by the Free Software Foundation, version 2.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#pragma once
+
+/** A server on the network which users are connected to. Every user
+ * points at the Server they are on, so finding the server of a user
+ * never needs a lookup by name. The linking module extends this class
+ * to represent the servers it knows about.
+ */
+class CoreExport Server : public classbase
+{
+	/** First user on this server, the rest are linked through User::nextonserver
+	 */
+	User* firstuser;
+
+ protected:
+	/** The name of this server
+	 */
+	const std::string name;
+
+ public:
+	/** Constructor
+	 * @param srvname The name of the server
+	 */
+	Server(const std::string& srvname) : firstuser(NULL), name(srvname) { }
+
+	/** Get the name of this server
+	 * @return The name of this server, e.g. irc.example.com
+	 */
+	const std::string& GetName() const { return name; }
+
+	/** Get the first user on this server
+	 * @return The first user on this server, or NULL if there are none. The
+	 * others are reached by following User::nextonserver.
+	 */
+	User* GetFirstUser() const { return firstuser; }
+
+	/** Add a user to the users on this server. Called by the User constructor.
+	 * @param user The user to add
+	 */
+	void AddUser(User* user);
+
+	/** Remove a user from the users on this server. Called when the user quits.
+	 * @param user The user to remove
+	 */
+	void RemoveUser(User* user);
+
+	/** Move every user on this server to another server
+	 * @param newserver The server the users are on from now on
+	 */
+	void MoveUsers(Server* newserver);
+};
@@ -239,7 +239,11 @@ class CoreExport SocketEngine
 	EventHandler** ref;
 	/** List of handlers that want a trial read/write
 	 */
-	std::set<int> trials;
+	std::vector<int> trials;
+	/** Scratch list which trials are swapped into while they are dispatched.
+	 * Kept as a member so its storage is reused on every main loop iteration.
+	 */
+	std::vector<int> trials_working;
 
 	int MAX_DESCRIPTORS;
 
@@ -257,6 +261,10 @@ public:
 	unsigned long ReadEvents;
 	unsigned long WriteEvents;
 	unsigned long ErrorEvents;
+	/** Number of system calls made to change the events the kernel reports for a descriptor */
+	unsigned long CtlCalls;
+	/** Number of event mask changes which were handled without such a system call */
+	unsigned long CtlCallsAvoided;
 
 	/** Constructor.
 	 * The constructor transparently initializes
@@ -23,11 +23,12 @@
 
 class Module;
 
-/** Timer class for one-second resolution timers
+/** Timer class for one-second and millisecond resolution timers
  * Timer provides a facility which allows module
  * developers to create one-shot timers. The timer
  * can be made to trigger at any time up to a one-second
- * resolution. To use Timer, inherit a class from
+ * resolution, or to a millisecond resolution using
+ * SetIntervalMS(). To use Timer, inherit a class from
  * Timer, then insert your inherited class into the
  * queue using Server::AddTimer(). The Tick() method of
  * your object (which you have to override) will be called
@@ -35,18 +36,41 @@ class Module;
  */
 class CoreExport Timer
 {
+	friend class TimerManager;
+
 	/** The triggering time
 	 */
 	time_t trigger;
 
+	/** The millisecond within the triggering second at which to trigger
+	 */
+	unsigned int trigger_ms;
+
 	/** Number of seconds between triggers
 	 */
 	unsigned int secs;
 
+	/** Number of milliseconds between triggers
+	 */
+	unsigned long interval_ms;
+
 	/** True if this is a repeating timer
 	 */
 	bool repeat;
 
+	/** Wheel tick this timer is filed under, maintained by TimerManager
+	 */
+	unsigned long expires;
+
+	/** Neighbours in the list this timer is on, maintained by TimerManager
+	 */
+	Timer* prev;
+	Timer* next;
+
+	/** Head of the list this timer is on, NULL if it is not scheduled
+	 */
+	Timer** list;
+
  public:
 	/** Default constructor, initializes the triggering time
 	 * @param secs_from_now The number of seconds from now to trigger the timer
@@ -56,8 +80,13 @@ class CoreExport Timer
 	Timer(unsigned int secs_from_now, time_t now, bool repeating = false)
 	{
 		trigger = now + secs_from_now;
+		trigger_ms = 0;
 		secs = secs_from_now;
+		interval_ms = secs_from_now * 1000UL;
 		repeat = repeating;
+		expires = 0;
+		prev = next = NULL;
+		list = NULL;
 	}
 
 	/** Default destructor, removes the timer from the timer manager
@@ -78,12 +107,18 @@ class CoreExport Timer
 	void SetTrigger(time_t nexttrigger)
 	{
 		trigger = nexttrigger;
+		trigger_ms = 0;
 	}
 
 	/** Sets the interval between two ticks.
 	 */
 	void SetInterval(time_t interval);
 
+	/** Sets the interval between two ticks in milliseconds and
+	 * schedules the next tick that far from now.
+	 */
+	void SetIntervalMS(unsigned long interval);
+
 	/** Called when the timer ticks.
 	 * You should override this method with some useful code to
 	 * handle the tick event.
@@ -105,6 +140,14 @@ class CoreExport Timer
 		return secs;
 	}
 
+	/** Returns the interval (number of milliseconds between ticks)
+	 * of this timer object.
+	 */
+	unsigned long GetIntervalMS() const
+	{
+		return interval_ms;
+	}
+
 	/** Cancels the repeat state of a repeating timer.
 	 * If you call this method, then the next time your
 	 * timer ticks, it will be removed immediately after.
@@ -115,23 +158,82 @@ class CoreExport Timer
 	}
 };
 
-typedef std::multimap<time_t, Timer*> TimerMap;
-
 /** This class manages sets of Timers, and triggers them at their defined times.
  * This will ensure timers are not missed, as well as removing timers that have
  * expired and allowing the addition of new ones.
+ *
+ * Timers are kept in a hierarchical timer wheel with a resolution of one
+ * millisecond, so adding and removing a timer takes constant time no matter
+ * how many timers there are. The first level has a slot for each of the next
+ * 256 milliseconds, each further level has 64 slots each covering a whole
+ * turn of the level below it. When a level completes a turn, the next slot
+ * of the level above is emptied into it.
  */
 class CoreExport TimerManager
 {
-	/** A list of all pending timers
+	static const unsigned int ROOT_BITS = 8;
+	static const unsigned int ROOT_SIZE = 1 << ROOT_BITS;
+	static const unsigned int LEVEL_BITS = 6;
+	static const unsigned int LEVEL_SIZE = 1 << LEVEL_BITS;
+	static const unsigned int LEVELS = 4;
+
+	/** Timers due within the next ROOT_SIZE milliseconds, one slot per millisecond
 	 */
-	TimerMap Timers;
+	Timer* root[ROOT_SIZE];
+
+	/** Timers due further in the future
+	 */
+	Timer* levels[LEVELS][LEVEL_SIZE];
+
+	/** Timers which are being run or moved right now
+	 */
+	Timer* running;
+
+	/** Number of timers in root
+	 */
+	unsigned int rootcount;
+
+	/** The last wheel tick which has been run
+	 */
+	unsigned long current;
+
+	/** The time which the current wheel tick corresponds to
+	 */
+	time_t current_secs;
+	unsigned int current_ms;
+
+	/** Puts a timer on a list */
+	void Link(Timer* t, Timer** list);
+
+	/** Takes a timer off the list it is on */
+	void Unlink(Timer* t);
+
+	/** Files a timer in the slot for its trigger time */
+	void Schedule(Timer* t);
+
+	/** Moves the timers in a slot onto the running list and files or runs them again */
+	void Cascade(Timer** slot);
+
+	/** Runs every timer in a root slot */
+	void RunSlot(Timer** slot, time_t TIME);
+
+	/** Runs one timer which is due and reschedules it if it repeats */
+	void Fire(Timer* t, time_t TIME);
+
+	/** Number of milliseconds until a timer is due, clamped to the range of the wheel */
+	long GetDelay(Timer* t) const;
+
+	/** Runs all due timers and files the rest again after the clock jumped a long way forward or was set back */
+	void Rebuild(time_t TIME);
 
  public:
-	/** Tick all pending Timers
-	 * @param TIME the current system time
+	/** Constructor
+	 */
+	TimerManager();
+
+	/** Tick all pending Timers, up to the time last read by InspIRCd::UpdateTime()
 	 */
-	void TickTimers(time_t TIME);
+	void TickTimers();
 
 	/** Add an Timer
 	 * @param T an Timer derived class to add
@@ -142,4 +244,9 @@ class CoreExport TimerManager
 	 * @param T an Timer derived class to remove
 	 */
 	void DelTimer(Timer* T);
+
+	/** Returns how many milliseconds the socket engine may wait for events
+	 * before a timer could become due, at most one second.
+	 */
+	int GetTimeout() const;
 };
@@ -38,6 +38,7 @@ class Module;
 class OperInfo;
 class ProtocolServer;
 class RemoteUser;
+class Server;
 class ServerConfig;
 class ServerLimits;
 class Thread;
@@ -54,6 +55,10 @@ struct ModResult;
 typedef TR1NS::unordered_map<std::string, User*, irc::insensitive, irc::StrHashComp> user_hash;
 typedef TR1NS::unordered_map<std::string, Channel*, irc::insensitive, irc::StrHashComp> chan_hash;
 
+/** A sorted index of users keyed by their displayed host, see UserManager::hostindex.
+ */
+typedef std::multimap<std::string, User*> user_host_index;
+
 /** A list holding local users, this is the type of UserManager::local_users
  */
 typedef std::list<LocalUser*> LocalUserList;
@@ -58,6 +58,12 @@ class CoreExport UserManager
 	 */
 	std::list<User*> all_opers;
 
+	/** Registered users indexed by their displayed host, lowercased and reversed with
+	 * GetHostIndexKey() so that all users whose host ends with the same suffix, such as
+	 * a domain, are next to each other and can be found with a range lookup.
+	 */
+	user_host_index hostindex;
+
 	/** Number of unregistered users online right now.
 	 * (Unregistered means before USER/NICK/dns)
 	 */
@@ -107,6 +113,22 @@ class CoreExport UserManager
 	 */
 	void QuitUser(User *user, const std::string &quitreason, const char* operreason = "");
 
+	/** Add a user to the host index, or move them if their displayed host has changed.
+	 * @param user The user to index
+	 */
+	void UpdateHostIndex(User* user);
+
+	/** Remove a user from the host index
+	 * @param user The user to remove
+	 */
+	void RemoveFromHostIndex(User* user);
+
+	/** Get the key used in the host index for a host or a host suffix
+	 * @param host The host to get the key for
+	 * @return The host in lowercase, reversed
+	 */
+	static std::string GetHostIndexKey(const std::string& host);
+
 	/** Add a user to the local clone map
 	 * @param user The user to add
 	 */
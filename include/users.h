@@ -306,7 +306,16 @@ class CoreExport User : public Extensible
 
 	/** The server the user is connected to.
 	 */
-	const std::string server;
+	Server* server;
+
+	/** The previous and next users in the list of users on the same server, maintained by Server
+	 */
+	User* prevonserver;
+	User* nextonserver;
+
+	/** Position of this user in UserManager::hostindex, or hostindex.end() if the user is not indexed
+	 */
+	user_host_index::iterator hostindexiter;
 
 	/** The user's away message.
 	 * If this string is empty, the user is not marked as away.
@@ -361,7 +370,7 @@ class CoreExport User : public Extensible
 	/** Constructor
 	 * @throw CoreException if the UID allocated to the user already exists
 	 */
-	User(const std::string &uid, const std::string& srv, int objtype);
+	User(const std::string &uid, Server* srv, int objtype);
 
 	/** Returns the full displayed host of the user
 	 * This member function returns the hostname of the user as seen by other users
@@ -770,6 +779,13 @@ class CoreExport LocalUser : public User, public InviteBase
 	void Write(const std::string& text);
 	void Write(const char*, ...) CUSTOM_PRINTF(2, 3);
 
+	/** Write a block of preformatted lines to this user with a single sendq append.
+	 * @param lines The lines to send. Each line must already be terminated by CR LF and
+	 * be no longer than the maximum line length.
+	 * @param count The number of lines in the block, for statistics.
+	 */
+	void WriteBlock(const std::string& lines, unsigned int count);
+
 	/** Returns the list of channels this user has been invited to but has not yet joined.
 	 * @return A list of channels the user is invited to
 	 */
@@ -822,7 +838,7 @@ class CoreExport LocalUser : public User, public InviteBase
 class CoreExport RemoteUser : public User
 {
  public:
-	RemoteUser(const std::string& uid, const std::string& srv) : User(uid, srv, USERTYPE_REMOTE)
+	RemoteUser(const std::string& uid, Server* srv) : User(uid, srv, USERTYPE_REMOTE)
 	{
 	}
 	virtual void SendText(const std::string& line);
@@ -831,9 +847,17 @@ class CoreExport RemoteUser : public User
 class CoreExport FakeUser : public User
 {
  public:
-	FakeUser(const std::string &uid, const std::string& srv) : User(uid, srv, USERTYPE_SERVER)
+	FakeUser(const std::string &uid, Server* srv) : User(uid, srv, USERTYPE_SERVER)
+	{
+		nick = srv->GetName();
+	}
+
+	/** Create a fake user along with a new Server for them to be on, which the
+	 * caller has to delete after the fake user
+	 */
+	FakeUser(const std::string &uid, const std::string& sname) : User(uid, new Server(sname), USERTYPE_SERVER)
 	{
-		nick = srv;
+		nick = sname;
 	}
 
 	virtual CullResult cull();
@@ -391,6 +391,97 @@ class CoreExport XLineFactory
 	virtual ~XLineFactory() { }
 };
 
+/** XLineIndex files the lines of one of the core line types by their mask, so that
+ * a user only has to be tested against the lines which could possibly match them
+ * instead of against every line of that type. Masks are filed as follows:
+ *  - masks without wildcards go in a hash keyed on the case folded mask,
+ *  - masks of the form *.domain and 1.2.3.* go in hashes keyed on the fixed part,
+ *  - valid CIDR masks go in a radix tree (and in the exact hash, because the
+ *    wildcard fallback of InspIRCd::MatchCIDR compares them literally),
+ *  - anything else goes in a residual list which is always returned.
+ * Lookups only return candidates; the caller must still call XLine::Matches().
+ */
+class CoreExport XLineIndex
+{
+ public:
+	typedef std::vector<XLine*> LineList;
+
+	/** What a line of the indexed type is matched against */
+	enum IndexType
+	{
+		/** The host and IP of a user (G, K and E lines) */
+		INDEX_HOST,
+		/** The IP of a user (Z lines) */
+		INDEX_IP,
+		/** The nickname of a user (Q lines) */
+		INDEX_NICK
+	};
+
+ private:
+	typedef TR1NS::unordered_map<std::string, LineList> MaskMap;
+
+	const IndexType type;
+
+	/** Case map used by the line type, or NULL for the national one */
+	unsigned const char* const casemap;
+
+	MaskMap exact;
+	MaskMap suffixes;
+	MaskMap prefixes;
+	irc::sockets::cidr_tree<LineList> cidrs;
+	LineList residual;
+
+	/** Fold the case of a mask or subject using the map of the line type */
+	std::string Fold(const std::string& str) const;
+
+	/** File a line under its mask, or remove it again */
+	void Update(XLine* line, const std::string& mask, bool add);
+
+	/** Add a line to, or remove it from, the list stored under a key */
+	static void UpdateMap(MaskMap& map, const std::string& key, XLine* line, bool add);
+
+	/** Add candidates for one subject (a host, IP or nick) to a list */
+	void Find(const std::string& subject, LineList& out);
+
+ public:
+	/** Create an index
+	 * @param t What lines in this index are matched against
+	 * @param map The case map the lines match with, or NULL for the national case map
+	 */
+	XLineIndex(IndexType t, unsigned const char* map) : type(t), casemap(map) { }
+
+	/** @return What lines in this index are matched against */
+	IndexType GetType() const { return type; }
+
+	/** Add a line to the index
+	 * @param line The line to add
+	 * @param mask The host, IP or nick mask of the line
+	 */
+	void Add(XLine* line, const std::string& mask) { Update(line, mask, true); }
+
+	/** Remove a line from the index
+	 * @param line The line to remove
+	 * @param mask The mask the line was added with
+	 */
+	void Remove(XLine* line, const std::string& mask) { Update(line, mask, false); }
+
+	/** @return The number of lines which have to be tried against every user */
+	size_t ResidualCount() const { return residual.size(); }
+
+	/** Get the lines which could match a user
+	 * @param user The user to look up
+	 * @param out Receives the candidate lines, without duplicates, in the order of their XLineLookup
+	 */
+	void FindCandidates(User* user, LineList& out);
+
+	/** Get the lines which could match a string passed to XLine::Matches(const std::string&).
+	 * Only valid for INDEX_IP and INDEX_NICK indexes.
+	 * @param str The IP or nickname to look up
+	 * @param out Receives the candidate lines, without duplicates, in the order of their XLineLookup
+	 */
+	void FindCandidates(const std::string& str, LineList& out);
+};
+
 /** XLineManager is a class used to manage glines, klines, elines, zlines and qlines,
  * or any other line created by a module. It also manages XLineFactory classes which
  * can generate a specialized XLine for use by another module.
@@ -413,6 +504,14 @@ class CoreExport XLineManager
 	 */
 	XLineContainer lookup_lines;
 
+	/** Indexes over the lines of the core line types, used to avoid
+	 * testing every line of a type when matching a user.
+	 */
+	std::map<std::string, XLineIndex*> line_indexes;
+
+	/** Get the index for a line type, or NULL if the type is not indexed */
+	XLineIndex* GetIndex(const std::string& type);
+
  public:
 
 	/** Constructor
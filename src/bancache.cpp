@@ -21,81 +21,177 @@
 #include "inspircd.h"
 #include "bancache.h"
 
-BanCacheHit *BanCacheManager::AddHit(const std::string &ip, const std::string &type, const std::string &reason, time_t seconds)
+BanCacheKey::BanCacheKey(const irc::sockets::sockaddrs& sa)
+	: family(sa.sa.sa_family)
 {
-	BanCacheHit*& b = (*BanHash)[ip];
-	if (b != NULL) // can't have two cache entries on the same IP, sorry..
-		return NULL;
+	memset(addr, 0, sizeof(addr));
+	if (family == AF_INET)
+		memcpy(addr, &sa.in4.sin_addr, 4);
+	else if (family == AF_INET6)
+		memcpy(addr, &sa.in6.sin6_addr, 16);
+}
 
-	b = new BanCacheHit(type, reason, (seconds ? seconds : 86400));
-	return b;
+bool BanCacheKey::operator==(const BanCacheKey& other) const
+{
+	return family == other.family && !memcmp(addr, other.addr, sizeof(addr));
 }
 
-BanCacheHit *BanCacheManager::GetHit(const std::string &ip)
+size_t BanCacheKey::Hash::operator()(const BanCacheKey& key) const
 {
-	BanCacheHash::iterator i = this->BanHash->find(ip);
+	// FNV-1a
+	size_t t = 2166136261U;
+	t = (t ^ key.family) * 16777619U;
+	for (unsigned int i = 0; i < sizeof(key.addr); i++)
+		t = (t ^ key.addr[i]) * 16777619U;
+	return t;
+}
 
-	if (i == this->BanHash->end())
-		return NULL; // free and safe
+BanCacheManager::BanCacheManager()
+	: capacity(ServerInstance->Config->BanCacheSize), hand(0), generation(0), negative_removed(0)
+	, Hits(0), Misses(0), Evictions(0)
+{
+}
 
-	if (RemoveIfExpired(i))
-		return NULL; // expired
+bool BanCacheManager::IsStale(const Entry& entry) const
+{
+	if (ServerInstance->Time() >= entry.hit.Expiry)
+		return true;
+
+	if (!entry.hit.IsPositive())
+		return entry.added < negative_removed;
 
-	return i->second; // hit.
+	std::map<std::string, unsigned long>::const_iterator i = positive_removed.find(entry.hit.Type);
+	return (i != positive_removed.end() && entry.added < i->second);
 }
 
-bool BanCacheManager::RemoveIfExpired(BanCacheHash::iterator& it)
+void BanCacheManager::Release(size_t slot)
 {
-	if (ServerInstance->Time() < it->second->Expiry)
-		return false;
-
-	ServerInstance->Logs->Log("BANCACHE", LOG_DEBUG, "Hit on " + it->first + " is out of date, removing!");
-	delete it->second;
-	it = BanHash->erase(it);
-	return true;
+	Entry& entry = slots[slot];
+	index.erase(entry.key);
+	entry.used = false;
+	entry.hit.Type.clear();
+	entry.hit.Reason.clear();
+	freeslots.push_back(slot);
 }
 
-void BanCacheManager::RemoveEntries(const std::string& type, bool positive)
+size_t BanCacheManager::Allocate()
 {
-	if (positive)
-		ServerInstance->Logs->Log("BANCACHE", LOG_DEBUG, "BanCacheManager::RemoveEntries(): Removing positive hits for " + type);
-	else
-		ServerInstance->Logs->Log("BANCACHE", LOG_DEBUG, "BanCacheManager::RemoveEntries(): Removing all negative hits");
+	if (!freeslots.empty())
+	{
+		size_t slot = freeslots.back();
+		freeslots.pop_back();
+		return slot;
+	}
 
-	for (BanCacheHash::iterator i = BanHash->begin(); i != BanHash->end(); )
+	if (slots.size() < capacity)
 	{
-		if (RemoveIfExpired(i))
-			continue; // updates the iterator if expired
+		slots.push_back(Entry());
+		return slots.size() - 1;
+	}
 
-		BanCacheHit* b = i->second;
-		bool remove = false;
+	/* Every slot is in use. Sweep the CLOCK hand, giving recently looked up entries a
+	 * second chance, and take the first stale or unreferenced one. This ends within
+	 * two turns of the clock, as each turn clears the referenced flags it passes.
+	 */
+	for (;;)
+	{
+		size_t slot = hand;
+		hand = (hand + 1) % slots.size();
 
-		if (positive)
-		{
-			// when removing positive hits, remove only if the type matches
-			remove = b->IsPositive() && (b->Type == type);
-		}
-		else
+		Entry& entry = slots[slot];
+		if (entry.referenced && !IsStale(entry))
 		{
-			// when removing negative hits, remove all of them
-			remove = !b->IsPositive();
+			entry.referenced = false;
+			continue;
 		}
 
-		if (remove)
-		{
-			/* we need to remove this one. */
-			ServerInstance->Logs->Log("BANCACHE", LOG_DEBUG, "BanCacheManager::RemoveEntries(): Removing a hit on " + i->first);
-			delete b;
-			i = BanHash->erase(i);
-		}
-		else
-			++i;
+		if (!IsStale(entry))
+			Evictions++;
+		index.erase(entry.key);
+		entry.used = false;
+		return slot;
+	}
+}
+
+BanCacheHit *BanCacheManager::AddHit(const irc::sockets::sockaddrs& addr, const std::string &type, const std::string &reason, time_t seconds)
+{
+	if (capacity != ServerInstance->Config->BanCacheSize)
+		SetCapacity(ServerInstance->Config->BanCacheSize);
+
+	if (!capacity)
+		return NULL;
+
+	BanCacheKey key(addr);
+	SlotMap::iterator i = index.find(key);
+	if (i != index.end())
+	{
+		// can't have two cache entries on the same IP, sorry..
+		if (!IsStale(slots[i->second]))
+			return NULL;
+		Release(i->second);
 	}
+
+	size_t slot = Allocate();
+	Entry& entry = slots[slot];
+	entry.key = key;
+	entry.hit.Type = type;
+	entry.hit.Reason = reason;
+	entry.hit.Expiry = ServerInstance->Time() + (seconds ? seconds : 86400);
+	entry.added = generation;
+	entry.used = true;
+	entry.referenced = false;
+	index[key] = slot;
+	return &entry.hit;
 }
 
-BanCacheManager::~BanCacheManager()
+BanCacheHit *BanCacheManager::GetHit(const irc::sockets::sockaddrs& addr)
 {
-	for (BanCacheHash::iterator n = BanHash->begin(); n != BanHash->end(); ++n)
-		delete n->second;
-	delete BanHash;
+	SlotMap::iterator i = index.find(BanCacheKey(addr));
+
+	if (i == index.end())
+	{
+		Misses++;
+		return NULL; // free and safe
+	}
+
+	Entry& entry = slots[i->second];
+	if (IsStale(entry))
+	{
+		ServerInstance->Logs->Log("BANCACHE", LOG_DEBUG, "Hit on " + addr.addr() + " is out of date, removing!");
+		Release(i->second);
+		Misses++;
+		return NULL; // expired
+	}
+
+	entry.referenced = true;
+	Hits++;
+	return &entry.hit; // hit.
+}
+
+void BanCacheManager::RemoveEntries(const std::string& type, bool positive)
+{
+	if (positive)
+		ServerInstance->Logs->Log("BANCACHE", LOG_DEBUG, "BanCacheManager::RemoveEntries(): Removing positive hits for " + type);
+	else
+		ServerInstance->Logs->Log("BANCACHE", LOG_DEBUG, "BanCacheManager::RemoveEntries(): Removing all negative hits");
+
+	/* Entries added before this point become stale and are dropped as they are found */
+	generation++;
+	if (positive)
+		positive_removed[type] = generation;
+	else
+		negative_removed = generation;
+}
+
+void BanCacheManager::SetCapacity(size_t newcapacity)
+{
+	if (newcapacity < slots.size())
+	{
+		ServerInstance->Logs->Log("BANCACHE", LOG_DEBUG, "BanCacheManager::SetCapacity(): Shrinking to %lu entries, emptying the cache", (unsigned long)newcapacity);
+		slots.clear();
+		freeslots.clear();
+		index.clear();
+		hand = 0;
+	}
+	capacity = newcapacity;
 }
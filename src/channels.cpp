@@ -379,6 +379,110 @@ void Channel::ForceJoin(User* user, const std::string* privs, bool bursting, boo
 	FOREACH_MOD(OnPostJoin, (memb));
 }
 
+void Channel::ForceJoinMany(const std::vector<User*>& users, bool bursting)
+{
+	// Only the local users who were already here are sent the JOINs, the local users
+	// among the new members see everyone in their NAMES reply instead
+	std::vector<User*> locals;
+	for (UserMembCIter i = userlist.begin(); i != userlist.end(); ++i)
+	{
+		if (IS_LOCAL(i->first))
+			locals.push_back(i->first);
+	}
+
+	std::vector<Membership*> memberships;
+	memberships.reserve(users.size());
+	for (std::vector<User*>::const_iterator i = users.begin(); i != users.end(); ++i)
+	{
+		User* user = *i;
+		if (IS_SERVER(user))
+		{
+			ServerInstance->Logs->Log("CHANNELS", LOG_DEBUG, "Attempted to join server user " + user->uuid + " to channel " + this->name);
+			continue;
+		}
+
+		Membership* memb = this->AddUser(user);
+		if (!memb)
+			continue; // Already on the channel
+
+		user->chans.insert(this);
+		memberships.push_back(memb);
+	}
+
+	if (memberships.empty())
+		return;
+
+	// Modules which implement OnUserJoinBatch get all joins at once, the others have OnUserJoin called for each.
+	// The default OnUserJoinBatch detaches itself and does the latter, so take note of who it is called for first.
+	std::vector<CUList> except_lists(memberships.size());
+	const IntModuleList batchhandlers = ServerInstance->Modules->EventHandlers[I_OnUserJoinBatch];
+	FOREACH_MOD(OnUserJoinBatch, (memberships, bursting, except_lists));
+
+	const IntModuleList& joinhandlers = ServerInstance->Modules->EventHandlers[I_OnUserJoin];
+	for (IntModuleList::const_reverse_iterator i = joinhandlers.rbegin(), next; i != joinhandlers.rend(); i = next)
+	{
+		next = i+1;
+		Module* mod = *i;
+		if (std::find(batchhandlers.begin(), batchhandlers.end(), mod) != batchhandlers.end())
+			continue;
+
+		try
+		{
+			for (size_t j = 0; j < memberships.size(); ++j)
+				mod->OnUserJoin(memberships[j], bursting, false, except_lists[j]);
+		}
+		catch (CoreException& modexcept)
+		{
+			ServerInstance->Logs->Log("MODULE", LOG_DEFAULT, "Exception caught: %s", modexcept.GetReason());
+		}
+	}
+
+	for (size_t j = 0; j < memberships.size(); ++j)
+	{
+		Membership* memb = memberships[j];
+		User* user = memb->user;
+		const CUList& except_list = except_lists[j];
+
+		const std::string joinline = ":" + user->GetFullHost() + " JOIN :" + this->name;
+		if ((IS_LOCAL(user)) && (except_list.find(user) == except_list.end()))
+			user->Write(joinline);
+		for (std::vector<User*>::const_iterator k = locals.begin(); k != locals.end(); ++k)
+		{
+			if (except_list.find(*k) == except_list.end())
+				(*k)->Write(joinline);
+		}
+
+		/* Make sure everyone else sees the modes modules gave the user */
+		if ((!locals.empty()) && (!memb->modes.empty()))
+		{
+			std::string ms = memb->modes;
+			for (unsigned int i = 0; i < memb->modes.length(); i++)
+				ms.append(" ").append(user->nick);
+
+			const std::string modeline = ":" + (ServerInstance->Config->CycleHostsFromUser ? user->GetFullHost() : ServerInstance->Config->ServerName)
+				+ " MODE " + this->name + " +" + ms;
+			for (std::vector<User*>::const_iterator k = locals.begin(); k != locals.end(); ++k)
+			{
+				if (except_list.find(*k) == except_list.end())
+					(*k)->Write(modeline);
+			}
+		}
+
+		if (IS_LOCAL(user))
+		{
+			if (this->topicset)
+			{
+				user->WriteNumeric(RPL_TOPIC, "%s :%s", this->name.c_str(), this->topic.c_str());
+				user->WriteNumeric(RPL_TOPICTIME, "%s %s %lu", this->name.c_str(), this->setby.c_str(), (unsigned long)this->topicset);
+			}
+			this->UserList(user);
+		}
+	}
+
+	for (std::vector<Membership*>::const_iterator i = memberships.begin(); i != memberships.end(); ++i)
+		FOREACH_MOD(OnPostJoin, (*i));
+}
+
 bool Channel::IsBanned(User* user)
 {
 	ModResult result;
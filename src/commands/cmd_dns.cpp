@@ -21,6 +21,7 @@
 #include "modules/dns.h"
 #include <iostream>
 #include <fstream>
+#include <queue>
 
 #ifdef _WIN32
 #include <Iphlpapi.h>
@@ -142,9 +143,13 @@ class Packet : public Query
 		record.ttl = (input[pos] << 24) | (input[pos + 1] << 16) | (input[pos + 2] << 8) | input[pos + 3];
 		pos += 4;
 
-		//record.rdlength = input[pos] << 8 | input[pos + 1];
+		unsigned short rdlength = input[pos] << 8 | input[pos + 1];
 		pos += 2;
 
+		if (pos + rdlength > input_size)
+			throw Exception("Unable to unpack resource record");
+		const unsigned short rdata_end = pos + rdlength;
+
 		switch (record.type)
 		{
 			case QUERY_A:
@@ -185,10 +190,28 @@ class Packet : public Query
 				record.rdata = this->UnpackName(input, input_size, pos);
 				break;
 			}
+			case QUERY_SOA:
+			{
+				/* Skip the primary nameserver and the mailbox */
+				this->UnpackName(input, input_size, pos);
+				this->UnpackName(input, input_size, pos);
+
+				/* Skip the serial, refresh, retry and expire fields, the last field is the minimum ttl */
+				if (pos + 20 > input_size)
+					throw Exception("Unable to unpack resource record");
+				pos += 16;
+
+				/* Negative answers may be cached for the lesser of the SOA ttl and its minimum field (RFC 2308) */
+				unsigned int minimum = (input[pos] << 24) | (input[pos + 1] << 16) | (input[pos + 2] << 8) | input[pos + 3];
+				this->negative_ttl = std::min(record.ttl, minimum);
+				break;
+			}
 			default:
 				break;
 		}
 
+		pos = rdata_end;
+
 		if (!record.name.empty() && !record.rdata.empty())
 			ServerInstance->Logs->Log("RESOLVER", LOG_DEBUG, "Resolver: " + record.name + " -> " + record.rdata);
 
@@ -204,8 +227,10 @@ class Packet : public Query
 	unsigned short id;
 	/* Flags on the packet */
 	unsigned short flags;
+	/* How long a negative answer may be cached for, from the SOA in the authority section, or 0 */
+	unsigned int negative_ttl;
 
-	Packet() : id(0), flags(0)
+	Packet() : id(0), flags(0), negative_ttl(0)
 	{
 	}
 
@@ -244,6 +269,20 @@ class Packet : public Query
 
 		for (unsigned i = 0; i < ancount; ++i)
 			this->answers.push_back(this->UnpackResourceRecord(input, len, packet_pos));
+
+		/* The authority section is only used to find the SOA for negative caching,
+		 * so a record we can not parse there should not fail the whole answer.
+		 */
+		try
+		{
+			for (unsigned i = 0; i < nscount; ++i)
+				this->UnpackResourceRecord(input, len, packet_pos);
+		}
+		catch (Exception& ex)
+		{
+			ServerInstance->Logs->Log("RESOLVER", LOG_DEBUG, std::string("Resolver: Ignoring authority section: ") + ex.GetReason());
+			this->negative_ttl = 0;
+		}
 	}
 
 	unsigned short Pack(unsigned char* output, unsigned short output_size)
@@ -394,19 +433,151 @@ class Packet : public Query
 	}
 };
 
-class MyManager : public Manager, public Timer, public EventHandler
+/* Maximum number of nameservers used, this is limited by the size of Pending::tried */
+static const unsigned int MAX_UPSTREAMS = 8;
+/* Seconds to wait for an answer before asking the next nameserver */
+static const time_t RETRANSMIT_INTERVAL = 2;
+/* Number of unanswered queries in a row after which a nameserver is considered down */
+static const unsigned int MAX_FAILURES = 3;
+/* Seconds a nameserver which is down is avoided for */
+static const time_t DOWN_TIME = 30;
+/* Upper limit for the time negative answers are cached for */
+static const unsigned int MAX_NEGATIVE_TTL = 900;
+
+class MyManager;
+
+/** A nameserver we send queries to, with its own UDP socket
+ */
+class Upstream : public EventHandler
 {
-	typedef TR1NS::unordered_map<Question, Query, Question::hash> cache_map;
-	cache_map cache;
+ public:
+	MyManager* const manager;
+	/* Position of this upstream in MyManager::upstreams */
+	const unsigned int index;
+	/* Address of the nameserver */
+	irc::sockets::sockaddrs addr;
+	/* Number of queries in a row this nameserver failed to answer */
+	unsigned int failures;
+	/* If nonzero, the nameserver is considered down until this time */
+	time_t down_until;
+
+	Upstream(MyManager* mgr, unsigned int idx, const irc::sockets::sockaddrs& sa)
+		: manager(mgr), index(idx), addr(sa), failures(0), down_until(0)
+	{
+		int s = socket(addr.sa.sa_family, SOCK_DGRAM, 0);
+		this->SetFd(s);
+
+		/* Have we got a socket? */
+		if (this->GetFd() != -1)
+		{
+			ServerInstance->SE->SetReuse(s);
+			ServerInstance->SE->NonBlocking(s);
 
-	irc::sockets::sockaddrs myserver;
+			irc::sockets::sockaddrs bindto;
+			memset(&bindto, 0, sizeof(bindto));
+			bindto.sa.sa_family = addr.sa.sa_family;
 
-	static bool IsExpired(const Query& record, time_t now = ServerInstance->Time())
+			if (ServerInstance->SE->Bind(this->GetFd(), bindto) < 0)
+			{
+				/* Failed to bind */
+				ServerInstance->Logs->Log("RESOLVER", LOG_SPARSE, "Resolver: Error binding dns socket for %s", addr.str().c_str());
+				ServerInstance->SE->Close(this);
+				this->SetFd(-1);
+			}
+			else if (!ServerInstance->SE->AddFd(this, FD_WANT_POLL_READ | FD_WANT_NO_WRITE))
+			{
+				ServerInstance->Logs->Log("RESOLVER", LOG_SPARSE, "Resolver: Internal error starting DNS socket for %s", addr.str().c_str());
+				ServerInstance->SE->Close(this);
+				this->SetFd(-1);
+			}
+		}
+		else
+		{
+			ServerInstance->Logs->Log("RESOLVER", LOG_SPARSE, "Resolver: Error creating DNS socket for %s", addr.str().c_str());
+		}
+	}
+
+	~Upstream()
 	{
-		const ResourceRecord& req = record.answers[0];
-		return (req.created + static_cast<time_t>(req.ttl) < now);
+		if (this->GetFd() > -1)
+		{
+			ServerInstance->SE->DelFd(this);
+			ServerInstance->SE->Shutdown(this, 2);
+			ServerInstance->SE->Close(this);
+		}
 	}
 
+	void HandleEvent(EventType et, int errornum);
+};
+
+class MyManager : public Manager, public Timer
+{
+	/** A query on the wire. Requests for the same question made while it is
+	 * outstanding wait on it instead of sending another query.
+	 */
+	struct Pending
+	{
+		/* The question as sent, after PTR names have been reversed */
+		Question question;
+		/* Requests waiting for the answer */
+		std::vector<DNS::Request*> waiters;
+		/* The packed query, kept for resending it to another nameserver */
+		std::string packet;
+		/* Id of the query */
+		unsigned short id;
+		/* Upstream the query was last sent to */
+		unsigned int upstream;
+		/* Bitmask of the upstreams the query was sent to */
+		unsigned int tried;
+		/* When the query was last sent */
+		time_t sent;
+		/* True if the query was sent and no answer has been received yet */
+		bool waiting;
+		/* True while the answer is being handed to the waiters */
+		bool dispatching;
+
+		Pending(const Question& q, unsigned short i)
+			: question(q), id(i), upstream(0), tried(0), sent(0), waiting(false), dispatching(false)
+		{
+		}
+	};
+
+	struct CacheEntry
+	{
+		Query query;
+		time_t expires;
+	};
+
+	/** An entry in the expiry heap. Entries are not removed from the heap when their
+	 * cache entry goes away early or is replaced; they are skipped when they reach the
+	 * top and their expiry time no longer matches the one in the cache.
+	 */
+	struct Expiry
+	{
+		time_t expires;
+		Question question;
+
+		Expiry(time_t e, const Question& q) : expires(e), question(q) { }
+	};
+
+	struct ExpiresLater
+	{
+		bool operator()(const Expiry& a, const Expiry& b) const { return a.expires > b.expires; }
+	};
+
+	typedef TR1NS::unordered_map<Question, CacheEntry, Question::hash> cache_map;
+	typedef std::priority_queue<Expiry, std::vector<Expiry>, ExpiresLater> expiry_heap;
+	typedef TR1NS::unordered_map<Question, Pending*, Question::hash> pending_map;
+
+	cache_map cache;
+	expiry_heap expiries;
+	size_t cachesize;
+
+	std::vector<Upstream*> upstreams;
+
+	pending_map pending;
+	Pending* inflight[MAX_REQUEST_ID];
+
 	/** Check the DNS cache to see if request can be handled by a cached result
 	 * @return true if a cached result was found.
 	 */
@@ -418,114 +589,318 @@ class MyManager : public Manager, public Timer, public EventHandler
 		if (it == this->cache.end())
 			return false;
 
-		Query& record = it->second;
-		if (IsExpired(record))
+		CacheEntry& entry = it->second;
+		if (entry.expires < ServerInstance->Time())
 		{
 			this->cache.erase(it);
 			return false;
 		}
 
 		ServerInstance->Logs->Log("RESOLVER", LOG_DEBUG, "Resolver: cache: Using cached result for " + question.name);
+		Query& record = entry.query;
 		record.cached = true;
-		req->OnLookupComplete(&record);
+		if (record.error == ERROR_NONE)
+			req->OnLookupComplete(&record);
+		else
+			req->OnError(&record);
 		return true;
 	}
 
+	/** Remove the cache entry which expires first
+	 */
+	void EvictOne()
+	{
+		while (!this->expiries.empty())
+		{
+			const Expiry& top = this->expiries.top();
+			cache_map::iterator it = this->cache.find(top.question);
+			bool live = (it != this->cache.end() && it->second.expires == top.expires);
+			if (live)
+				this->cache.erase(it);
+			this->expiries.pop();
+			if (live)
+				return;
+		}
+	}
+
 	/** Add a record to the dns cache
+	 * @param question The question the record answers
 	 * @param r The record
+	 * @param ttl How long to keep the record for
+	 */
+	void AddCache(const Question& question, const Query& r, unsigned int ttl)
+	{
+		if (!this->cachesize)
+			return;
+
+		if (r.error == ERROR_NONE)
+		{
+			const ResourceRecord& rr = r.answers[0];
+			ServerInstance->Logs->Log("RESOLVER", LOG_DEBUG, "Resolver: cache: added cache for " + rr.name + " -> " + rr.rdata + " ttl: " + ConvToStr(ttl));
+		}
+		else
+			ServerInstance->Logs->Log("RESOLVER", LOG_DEBUG, "Resolver: cache: added negative cache for " + question.name + " ttl: " + ConvToStr(ttl));
+
+		if (this->cache.find(question) == this->cache.end())
+		{
+			while (this->cache.size() >= this->cachesize && !this->expiries.empty())
+				this->EvictOne();
+		}
+
+		CacheEntry& entry = this->cache[question];
+		entry.query = r;
+		entry.expires = ServerInstance->Time() + ttl;
+		this->expiries.push(Expiry(entry.expires, question));
+
+		/* Replaced and removed entries leave stale items behind in the heap, rebuild it when they pile up */
+		if (this->expiries.size() > this->cache.size() * 2 + 64)
+		{
+			expiry_heap fresh;
+			for (cache_map::const_iterator i = this->cache.begin(); i != this->cache.end(); ++i)
+				fresh.push(Expiry(i->second.expires, i->first));
+			std::swap(this->expiries, fresh);
+		}
+	}
+
+	/** Find the nameserver to send a query to next. Nameservers are preferred in
+	 * the order they were configured in, skipping ones which are down. If every
+	 * nameserver left is down the one which is due to come back first is used.
+	 * @param tried Bitmask of the nameservers the query was already sent to
+	 * @return The nameserver, or NULL if there is none left to try
 	 */
-	void AddCache(Query& r)
+	Upstream* PickUpstream(unsigned int tried)
 	{
-		const ResourceRecord& rr = r.answers[0];
-		ServerInstance->Logs->Log("RESOLVER", LOG_DEBUG, "Resolver: cache: added cache for " + rr.name + " -> " + rr.rdata + " ttl: " + ConvToStr(rr.ttl));
-		this->cache[r.questions[0]] = r;
+		Upstream* fallback = NULL;
+		for (std::vector<Upstream*>::const_iterator i = this->upstreams.begin(); i != this->upstreams.end(); ++i)
+		{
+			Upstream* up = *i;
+			if (up->GetFd() < 0 || (tried & (1U << up->index)))
+				continue;
+
+			if (up->down_until <= ServerInstance->Time())
+				return up;
+
+			if (!fallback || up->down_until < fallback->down_until)
+				fallback = up;
+		}
+		return fallback;
 	}
 
- public:
-	DNS::Request* requests[MAX_REQUEST_ID];
+	void MarkFailed(Upstream* up)
+	{
+		if (++up->failures == MAX_FAILURES)
+			ServerInstance->Logs->Log("RESOLVER", LOG_DEFAULT, "Resolver: Nameserver %s is not answering, avoiding it for %ld seconds", up->addr.addr().c_str(), (long)DOWN_TIME);
+
+		if (up->failures >= MAX_FAILURES)
+			up->down_until = ServerInstance->Time() + DOWN_TIME;
+	}
+
+	void MarkAlive(Upstream* up)
+	{
+		if (up->failures >= MAX_FAILURES)
+			ServerInstance->Logs->Log("RESOLVER", LOG_DEFAULT, "Resolver: Nameserver %s is answering again", up->addr.addr().c_str());
+
+		up->failures = 0;
+		up->down_until = 0;
+	}
+
+	/** Send a query to the next nameserver it has not been sent to yet
+	 * @return True if the query was sent
+	 */
+	bool Send(Pending* p)
+	{
+		for (Upstream* up; (up = this->PickUpstream(p->tried)); )
+		{
+			p->tried |= 1U << up->index;
+
+			ServerInstance->Logs->Log("RESOLVER", LOG_DEBUG, "Resolver: Sending query for " + p->question.name + " to " + up->addr.addr());
+			if (ServerInstance->SE->SendTo(up, p->packet.data(), p->packet.length(), 0, &up->addr.sa, up->addr.sa_size()) == (int)p->packet.length())
+			{
+				p->upstream = up->index;
+				p->sent = ServerInstance->Time();
+				p->waiting = true;
+				return true;
+			}
+
+			this->MarkFailed(up);
+		}
+		return false;
+	}
+
+	void ClearUpstreams()
+	{
+		for (std::vector<Upstream*>::const_iterator i = this->upstreams.begin(); i != this->upstreams.end(); ++i)
+			delete *i;
+		this->upstreams.clear();
+	}
+
+	void RemovePending(Pending* p)
+	{
+		pending_map::iterator it = this->pending.find(p->question);
+		if (it != this->pending.end() && it->second == p)
+			this->pending.erase(it);
+		this->inflight[p->id] = NULL;
+		delete p;
+	}
+
+	/** Fail all requests waiting on a query which no nameserver is left to answer, and delete it
+	 */
+	void FailPending(Pending* p, Error error)
+	{
+		ServerInstance->Logs->Log("RESOLVER", LOG_DEBUG, "Resolver: No nameserver left to ask for " + p->question.name);
+
+		/* New requests for this question must start a new query */
+		pending_map::iterator it = this->pending.find(p->question);
+		if (it != this->pending.end() && it->second == p)
+			this->pending.erase(it);
+
+		while (!p->waiters.empty())
+		{
+			DNS::Request* request = p->waiters.back();
+			p->waiters.pop_back();
+
+			Query rr(*request);
+			rr.error = error;
+			request->OnError(&rr);
+
+			delete request;
+		}
+
+		this->RemovePending(p);
+	}
 
-	MyManager(Module* c) : Manager(c), Timer(3600, ServerInstance->Time(), true)
+ public:
+	MyManager(Module* c) : Manager(c), Timer(1, ServerInstance->Time(), true), cachesize(0)
 	{
 		for (int i = 0; i < MAX_REQUEST_ID; ++i)
-			requests[i] = NULL;
+			inflight[i] = NULL;
 		ServerInstance->Timers->AddTimer(this);
 	}
 
 	~MyManager()
 	{
-		for (int i = 0; i < MAX_REQUEST_ID; ++i)
+		this->CancelRequests(NULL);
+		this->ClearUpstreams();
+	}
+
+	/** Fail and delete requests
+	 * @param mod If not NULL, only fail the requests created by this module
+	 */
+	void CancelRequests(Module* mod)
+	{
+		std::vector<DNS::Request*> cancelled;
+		for (pending_map::const_iterator i = this->pending.begin(); i != this->pending.end(); ++i)
 		{
-			DNS::Request* request = requests[i];
-			if (!request)
-				continue;
+			const std::vector<DNS::Request*>& waiters = i->second->waiters;
+			for (std::vector<DNS::Request*>::const_iterator j = waiters.begin(); j != waiters.end(); ++j)
+			{
+				if (!mod || (*j)->creator == mod)
+					cancelled.push_back(*j);
+			}
+		}
+
+		for (std::vector<DNS::Request*>::const_iterator i = cancelled.begin(); i != cancelled.end(); ++i)
+		{
+			DNS::Request* request = *i;
 
 			Query rr(*request);
-			rr.error = ERROR_UNKNOWN;
+			rr.error = mod ? ERROR_UNLOADED : ERROR_UNKNOWN;
 			request->OnError(&rr);
 
+			/* Request's destructor removes it from the pending query */
 			delete request;
 		}
 	}
 
 	void Process(DNS::Request* req)
 	{
-		ServerInstance->Logs->Log("RESOLVER", LOG_DEBUG, "Resolver: Processing request to lookup " + req->name + " of type " + ConvToStr(req->type) + " to " + this->myserver.addr());
+		ServerInstance->Logs->Log("RESOLVER", LOG_DEBUG, "Resolver: Processing request to lookup " + req->name + " of type " + ConvToStr(req->type));
+
+		Packet p;
+		p.flags = QUERYFLAGS_RD;
+		p.questions.push_back(*req);
+
+		unsigned char buffer[524];
+		unsigned short len = p.Pack(buffer, sizeof(buffer));
+
+		/* Note that calling Pack() above can actually change the contents of p.questions[0].name, if the query is a PTR,
+		 * to contain the value that would be in the DNS cache, which is why this is here.
+		 */
+		const Question& question = p.questions[0];
+		if (req->use_cache && this->CheckCache(req, question))
+		{
+			ServerInstance->Logs->Log("RESOLVER", LOG_DEBUG, "Resolver: Using cached result");
+			delete req;
+			return;
+		}
+
+		/* If the same question is already on the wire, wait for its answer */
+		pending_map::iterator it = this->pending.find(question);
+		if (it != this->pending.end() && it->second->waiting)
+		{
+			ServerInstance->Logs->Log("RESOLVER", LOG_DEBUG, "Resolver: Joining the outstanding query for " + question.name);
+			req->id = it->second->id;
+			it->second->waiters.push_back(req);
+			return;
+		}
 
 		/* Create an id */
+		unsigned short id;
 		unsigned int tries = 0;
 		do
 		{
-			req->id = ServerInstance->GenRandomInt(DNS::MAX_REQUEST_ID);
+			id = ServerInstance->GenRandomInt(DNS::MAX_REQUEST_ID);
 
 			if (++tries == DNS::MAX_REQUEST_ID*5)
 			{
 				// If we couldn't find an empty slot this many times, do a sequential scan as a last
 				// resort. If an empty slot is found that way, go on, otherwise throw an exception
-				req->id = 0;
+				id = 0;
 				for (int i = 1; i < DNS::MAX_REQUEST_ID; i++)
 				{
-					if (!this->requests[i])
+					if (!this->inflight[i])
 					{
-						req->id = i;
+						id = i;
 						break;
 					}
 				}
 
-				if (req->id == 0)
+				if (id == 0)
 					throw Exception("DNS: All ids are in use");
 
 				break;
 			}
 		}
-		while (!req->id || this->requests[req->id]);
+		while (!id || this->inflight[id]);
 
-		this->requests[req->id] = req;
+		buffer[0] = id >> 8;
+		buffer[1] = id & 0xFF;
 
-		Packet p;
-		p.flags = QUERYFLAGS_RD;
-		p.id = req->id;
-		p.questions.push_back(*req);
+		Pending* query = new Pending(question, id);
+		query->packet.assign(reinterpret_cast<const char*>(buffer), len);
+		query->waiters.push_back(req);
+		this->inflight[id] = query;
+		this->pending[question] = query;
+		req->id = id;
 
-		unsigned char buffer[524];
-		unsigned short len = p.Pack(buffer, sizeof(buffer));
-
-		/* Note that calling Pack() above can actually change the contents of p.questions[0].name, if the query is a PTR,
-		 * to contain the value that would be in the DNS cache, which is why this is here.
-		 */
-		if (req->use_cache && this->CheckCache(req, p.questions[0]))
-		{
-			ServerInstance->Logs->Log("RESOLVER", LOG_DEBUG, "Resolver: Using cached result");
-			delete req;
-			return;
-		}
-
-		if (ServerInstance->SE->SendTo(this, buffer, len, 0, &this->myserver.sa, this->myserver.sa_size()) != len)
+		/* If this throws, the caller deletes req which removes the pending query */
+		if (!this->Send(query))
 			throw Exception("DNS: Unable to send query");
 	}
 
 	void RemoveRequest(DNS::Request* req)
 	{
-		this->requests[req->id] = NULL;
+		Pending* p = this->inflight[req->id];
+		if (!p)
+			return;
+
+		std::vector<DNS::Request*>::iterator it = std::find(p->waiters.begin(), p->waiters.end(), req);
+		if (it == p->waiters.end())
+			return;
+
+		p->waiters.erase(it);
+		if (p->waiters.empty() && !p->dispatching)
+			this->RemovePending(p);
 	}
 
 	std::string GetErrorStr(Error e)
@@ -555,7 +930,7 @@ class MyManager : public Manager, public Timer, public EventHandler
 		}
 	}
 
-	void HandleEvent(EventType et, int)
+	void HandleEvent(Upstream* up, EventType et)
 	{
 		if (et == EVENT_ERROR)
 		{
@@ -567,7 +942,7 @@ class MyManager : public Manager, public Timer, public EventHandler
 		irc::sockets::sockaddrs from;
 		socklen_t x = sizeof(from);
 
-		int length = ServerInstance->SE->RecvFrom(this, buffer, sizeof(buffer), 0, &from.sa, &x);
+		int length = ServerInstance->SE->RecvFrom(up, buffer, sizeof(buffer), 0, &from.sa, &x);
 
 		if (length < Packet::HEADER_LENGTH)
 			return;
@@ -584,32 +959,43 @@ class MyManager : public Manager, public Timer, public EventHandler
 			return;
 		}
 
-		if (myserver != from)
+		if (up->addr != from)
 		{
 			std::string server1 = from.str();
-			std::string server2 = myserver.str();
+			std::string server2 = up->addr.str();
 			ServerInstance->Logs->Log("RESOLVER", LOG_DEBUG, "Resolver: Got a result from the wrong server! Bad NAT or DNS forging attempt? '%s' != '%s'",
 				server1.c_str(), server2.c_str());
 			return;
 		}
 
-		DNS::Request* request = this->requests[recv_packet.id];
-		if (request == NULL)
+		Pending* query = this->inflight[recv_packet.id];
+		if (query == NULL || !(query->tried & (1U << up->index)))
 		{
 			ServerInstance->Logs->Log("RESOLVER", LOG_DEBUG, "Resolver: Received an answer for something we didn't request");
 			return;
 		}
 
+		if (!recv_packet.questions.empty())
+		{
+			const Question& q = recv_packet.questions[0];
+			if (q.type != query->question.type || !irc::StrHashComp()(q.name, query->question.name))
+			{
+				ServerInstance->Logs->Log("RESOLVER", LOG_DEBUG, "Resolver: Received an answer for " + q.name + " to a query for " + query->question.name);
+				return;
+			}
+		}
+
+		this->MarkAlive(up);
+
+		Error error = ERROR_NONE;
 		if (recv_packet.flags & QUERYFLAGS_OPCODE)
 		{
 			ServerInstance->Logs->Log("RESOLVER", LOG_DEBUG, "Resolver: Received a nonstandard query");
-			ServerInstance->stats->statsDnsBad++;
-			recv_packet.error = ERROR_NONSTANDARD_QUERY;
-			request->OnError(&recv_packet);
+			error = ERROR_NONSTANDARD_QUERY;
 		}
 		else if (recv_packet.flags & QUERYFLAGS_RCODE)
 		{
-			Error error = ERROR_UNKNOWN;
+			error = ERROR_UNKNOWN;
 
 			switch (recv_packet.flags & QUERYFLAGS_RCODE)
 			{
@@ -637,96 +1023,149 @@ class MyManager : public Manager, public Timer, public EventHandler
 					break;
 			}
 
-			ServerInstance->stats->statsDnsBad++;
-			recv_packet.error = error;
-			request->OnError(&recv_packet);
+			/* Another nameserver might do better */
+			if ((error == ERROR_SERVER_FAILURE || error == ERROR_REFUSED) && this->Send(query))
+				return;
 		}
 		else if (recv_packet.questions.empty() || recv_packet.answers.empty())
 		{
 			ServerInstance->Logs->Log("RESOLVER", LOG_DEBUG, "Resolver: No resource records returned");
-			ServerInstance->stats->statsDnsBad++;
-			recv_packet.error = ERROR_NO_RECORDS;
-			request->OnError(&recv_packet);
+			error = ERROR_NO_RECORDS;
 		}
-		else
+
+		ServerInstance->stats->statsDns++;
+		recv_packet.error = error;
+
+		if (error == ERROR_NONE)
 		{
-			ServerInstance->Logs->Log("RESOLVER", LOG_DEBUG, "Resolver: Lookup complete for " + request->name);
+			ServerInstance->Logs->Log("RESOLVER", LOG_DEBUG, "Resolver: Lookup complete for " + query->question.name);
 			ServerInstance->stats->statsDnsGood++;
-			request->OnLookupComplete(&recv_packet);
-			this->AddCache(recv_packet);
+			this->AddCache(query->question, recv_packet, recv_packet.answers[0].ttl);
+		}
+		else
+		{
+			ServerInstance->stats->statsDnsBad++;
+			if ((error == ERROR_DOMAIN_NOT_FOUND || error == ERROR_NO_RECORDS) && recv_packet.negative_ttl)
+				this->AddCache(query->question, recv_packet, std::min(recv_packet.negative_ttl, MAX_NEGATIVE_TTL));
 		}
 
-		ServerInstance->stats->statsDns++;
+		/* New requests for this question must not join a query which has been answered already */
+		this->pending.erase(query->question);
+		query->dispatching = true;
 
-		/* Request's destructor removes it from the request map */
-		delete request;
+		while (!query->waiters.empty())
+		{
+			DNS::Request* request = query->waiters.back();
+			query->waiters.pop_back();
+
+			if (error == ERROR_NONE)
+				request->OnLookupComplete(&recv_packet);
+			else
+				request->OnError(&recv_packet);
+
+			delete request;
+		}
+
+		this->RemovePending(query);
 	}
 
 	bool Tick(time_t now)
 	{
-		ServerInstance->Logs->Log("RESOLVER", LOG_DEBUG, "Resolver: cache: purging DNS cache");
-
-		for (cache_map::iterator it = this->cache.begin(); it != this->cache.end(); )
+		/* Remove expired entries from the cache */
+		while (!this->expiries.empty() && this->expiries.top().expires < now)
 		{
-			const Query& query = it->second;
-			if (IsExpired(query, now))
-				this->cache.erase(it++);
-			else
-				++it;
+			const Expiry& top = this->expiries.top();
+			cache_map::iterator it = this->cache.find(top.question);
+			if (it != this->cache.end() && it->second.expires == top.expires)
+				this->cache.erase(it);
+			this->expiries.pop();
 		}
-		return true;
-	}
 
-	void Rehash(const std::string& dnsserver)
-	{
-		if (this->GetFd() > -1)
+		/* Ask the next nameserver for queries which went unanswered for too long */
+		std::vector<Pending*> failed;
+		for (pending_map::const_iterator i = this->pending.begin(); i != this->pending.end(); ++i)
 		{
-			ServerInstance->SE->DelFd(this);
-			ServerInstance->SE->Shutdown(this, 2);
-			ServerInstance->SE->Close(this);
-			this->SetFd(-1);
+			Pending* query = i->second;
+			if (!query->waiting || now - query->sent < RETRANSMIT_INTERVAL)
+				continue;
 
-			/* Remove expired entries from the cache */
-			this->Tick(ServerInstance->Time());
+			query->waiting = false;
+			this->MarkFailed(this->upstreams[query->upstream]);
+			if (!this->Send(query))
+			{
+				/* Keep it alive while the callbacks of other failed queries run */
+				query->dispatching = true;
+				failed.push_back(query);
+			}
 		}
 
-		irc::sockets::aptosa(dnsserver, DNS::PORT, myserver);
-
-		/* Initialize mastersocket */
-		int s = socket(myserver.sa.sa_family, SOCK_DGRAM, 0);
-		this->SetFd(s);
+		/* Failing a query runs the callbacks of its requests which may start new queries or delete other requests */
+		for (std::vector<Pending*>::const_iterator i = failed.begin(); i != failed.end(); ++i)
+			this->FailPending(*i, ERROR_TIMEDOUT);
+		return true;
+	}
 
-		/* Have we got a socket? */
-		if (this->GetFd() != -1)
-		{
-			ServerInstance->SE->SetReuse(s);
-			ServerInstance->SE->NonBlocking(s);
+	void SetCacheSize(size_t newsize)
+	{
+		this->cachesize = newsize;
+		while (this->cache.size() > this->cachesize && !this->expiries.empty())
+			this->EvictOne();
+	}
 
-			irc::sockets::sockaddrs bindto;
-			memset(&bindto, 0, sizeof(bindto));
-			bindto.sa.sa_family = myserver.sa.sa_family;
+	void Rehash(const std::vector<std::string>& servers)
+	{
+		this->ClearUpstreams();
 
-			if (ServerInstance->SE->Bind(this->GetFd(), bindto) < 0)
+		for (std::vector<std::string>::const_iterator i = servers.begin(); i != servers.end(); ++i)
+		{
+			if (this->upstreams.size() == MAX_UPSTREAMS)
 			{
-				/* Failed to bind */
-				ServerInstance->Logs->Log("RESOLVER", LOG_SPARSE, "Resolver: Error binding dns socket - hostnames will NOT resolve");
-				ServerInstance->SE->Close(this);
-				this->SetFd(-1);
+				ServerInstance->Logs->Log("RESOLVER", LOG_DEFAULT, "Resolver: Only the first %u nameservers are used", MAX_UPSTREAMS);
+				break;
 			}
-			else if (!ServerInstance->SE->AddFd(this, FD_WANT_POLL_READ | FD_WANT_NO_WRITE))
+
+			irc::sockets::sockaddrs addr;
+			if (!irc::sockets::aptosa(*i, DNS::PORT, addr))
 			{
-				ServerInstance->Logs->Log("RESOLVER", LOG_SPARSE, "Resolver: Internal error starting DNS - hostnames will NOT resolve.");
-				ServerInstance->SE->Close(this);
-				this->SetFd(-1);
+				ServerInstance->Logs->Log("RESOLVER", LOG_DEFAULT, "Resolver: Ignoring nameserver '%s' which is not an IP address", i->c_str());
+				continue;
 			}
+
+			Upstream* up = new Upstream(this, this->upstreams.size(), addr);
+			this->upstreams.push_back(up);
 		}
-		else
+
+		bool working = false;
+		for (std::vector<Upstream*>::const_iterator i = this->upstreams.begin(); i != this->upstreams.end(); ++i)
+			working |= ((*i)->GetFd() > -1);
+		if (!working)
+			ServerInstance->Logs->Log("RESOLVER", LOG_SPARSE, "Resolver: No usable nameservers - hostnames will NOT resolve");
+
+		/* Send the outstanding queries again, the sockets they went out on are gone */
+		std::vector<Pending*> failed;
+		for (pending_map::const_iterator i = this->pending.begin(); i != this->pending.end(); ++i)
 		{
-			ServerInstance->Logs->Log("RESOLVER", LOG_SPARSE, "Resolver: Error creating DNS socket - hostnames will NOT resolve");
+			Pending* query = i->second;
+			query->tried = 0;
+			query->waiting = false;
+			if (!this->Send(query))
+			{
+				/* Keep it alive while the callbacks of other failed queries run */
+				query->dispatching = true;
+				failed.push_back(query);
+			}
 		}
+
+		for (std::vector<Pending*>::const_iterator i = failed.begin(); i != failed.end(); ++i)
+			this->FailPending(*i, ERROR_UNKNOWN);
 	}
 };
 
+void Upstream::HandleEvent(EventType et, int)
+{
+	manager->HandleEvent(this, et);
+}
+
 class ModuleDNS : public Module
 {
 	MyManager manager;
@@ -753,14 +1192,23 @@ class ModuleDNS : public Module
 			if (pFixedInfo)
 			{
 				if (GetNetworkParams(pFixedInfo, &dwBufferSize) == NO_ERROR)
-					DNSServer = pFixedInfo->DnsServerList.IpAddress.String;
+				{
+					for (PIP_ADDR_STRING addr = &pFixedInfo->DnsServerList; addr; addr = addr->Next)
+					{
+						if (!*addr->IpAddress.String)
+							continue;
+						if (!DNSServer.empty())
+							DNSServer.push_back(' ');
+						DNSServer.append(addr->IpAddress.String);
+					}
+				}
 
 				HeapFree(GetProcessHeap(), 0, pFixedInfo);
 			}
 
 			if (!DNSServer.empty())
 			{
-				ServerInstance->Logs->Log("CONFIG", LOG_DEFAULT, "<dns:server> set to '%s' as first active resolver in the system settings.", DNSServer.c_str());
+				ServerInstance->Logs->Log("CONFIG", LOG_DEFAULT, "<dns:server> set to '%s' from the active resolvers in the system settings.", DNSServer.c_str());
 				return;
 			}
 		}
@@ -771,20 +1219,28 @@ class ModuleDNS : public Module
 		ServerInstance->Logs->Log("CONFIG", LOG_DEFAULT, "WARNING: <dns:server> not defined, attempting to find working server in /etc/resolv.conf...");
 
 		std::ifstream resolv("/etc/resolv.conf");
+		std::string token;
 
-		while (resolv >> DNSServer)
+		while (resolv >> token)
 		{
-			if (DNSServer == "nameserver")
+			if (token == "nameserver")
 			{
-				resolv >> DNSServer;
-				if (DNSServer.find_first_not_of("0123456789.") == std::string::npos)
+				resolv >> token;
+				if (token.find_first_not_of("0123456789.") == std::string::npos)
 				{
-					ServerInstance->Logs->Log("CONFIG", LOG_DEFAULT, "<dns:server> set to '%s' as first resolver in /etc/resolv.conf.",DNSServer.c_str());
-					return;
+					if (!DNSServer.empty())
+						DNSServer.push_back(' ');
+					DNSServer.append(token);
 				}
 			}
 		}
 
+		if (!DNSServer.empty())
+		{
+			ServerInstance->Logs->Log("CONFIG", LOG_DEFAULT, "<dns:server> set to '%s' from the resolvers in /etc/resolv.conf.", DNSServer.c_str());
+			return;
+		}
+
 		ServerInstance->Logs->Log("CONFIG", LOG_DEFAULT, "/etc/resolv.conf contains no viable nameserver entries! Defaulting to nameserver '127.0.0.1'!");
 #endif
 		DNSServer = "127.0.0.1";
@@ -797,32 +1253,27 @@ class ModuleDNS : public Module
 
 	void ReadConfig(ConfigStatus& status) CXX11_OVERRIDE
 	{
+		ConfigTag* tag = ServerInstance->Config->ConfValue("dns");
 		std::string oldserver = DNSServer;
-		DNSServer = ServerInstance->Config->ConfValue("dns")->getString("server");
+		DNSServer = tag->getString("server");
 		if (DNSServer.empty())
 			FindDNSServer();
 
+		this->manager.SetCacheSize(tag->getInt("cachesize", 10000, 0, INT_MAX));
+
 		if (oldserver != DNSServer)
-			this->manager.Rehash(DNSServer);
+		{
+			std::vector<std::string> servers;
+			irc::spacesepstream sep(DNSServer);
+			for (std::string server; sep.GetToken(server); )
+				servers.push_back(server);
+			this->manager.Rehash(servers);
+		}
 	}
 
 	void OnUnloadModule(Module* mod)
 	{
-		for (int i = 0; i < MAX_REQUEST_ID; ++i)
-		{
-			DNS::Request* req = this->manager.requests[i];
-			if (!req)
-				continue;
-
-			if (req->creator == mod)
-			{
-				Query rr(*req);
-				rr.error = ERROR_UNLOADED;
-				req->OnError(&rr);
-
-				delete req;
-			}
-		}
+		this->manager.CancelRequests(mod);
 	}
 
 	Version GetVersion()
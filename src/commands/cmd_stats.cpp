@@ -21,6 +21,7 @@
 
 #include "inspircd.h"
 #include "xline.h"
+#include "bancache.h"
 
 #ifdef _WIN32
 #include <psapi.h>
@@ -164,7 +165,7 @@ void CommandStats::DoStats(char statschar, User* user, string_list &results)
 			for (std::list<User*>::const_iterator i = ServerInstance->Users->all_opers.begin(); i != ServerInstance->Users->all_opers.end(); ++i)
 			{
 				User* oper = *i;
-				if (!ServerInstance->ULine(oper->server))
+				if (!ServerInstance->ULine(oper->server->GetName()))
 				{
 					LocalUser* lu = IS_LOCAL(oper);
 					results.push_back(sn+" 249 " + user->nick + " :" + oper->nick + " (" + oper->ident + "@" + oper->dhost + ") Idle: " +
@@ -196,6 +197,8 @@ void CommandStats::DoStats(char statschar, User* user, string_list &results)
 			results.push_back(sn+" 249 "+user->nick+" :Read events:  "+ConvToStr(ServerInstance->SE->ReadEvents));
 			results.push_back(sn+" 249 "+user->nick+" :Write events: "+ConvToStr(ServerInstance->SE->WriteEvents));
 			results.push_back(sn+" 249 "+user->nick+" :Error events: "+ConvToStr(ServerInstance->SE->ErrorEvents));
+			results.push_back(sn+" 249 "+user->nick+" :Ctl calls:    "+ConvToStr(ServerInstance->SE->CtlCalls));
+			results.push_back(sn+" 249 "+user->nick+" :Ctl avoided:  "+ConvToStr(ServerInstance->SE->CtlCallsAvoided));
 		break;
 
 		/* stats m (list number of times each command has been used, plus bytecount) */
@@ -216,6 +219,9 @@ void CommandStats::DoStats(char statschar, User* user, string_list &results)
 			results.push_back(sn+" 249 "+user->nick+" :Users: "+ConvToStr(ServerInstance->Users->clientlist->size()));
 			results.push_back(sn+" 249 "+user->nick+" :Channels: "+ConvToStr(ServerInstance->chanlist->size()));
 			results.push_back(sn+" 249 "+user->nick+" :Commands: "+ConvToStr(ServerInstance->Parser->cmdlist.size()));
+			results.push_back(sn+" 249 "+user->nick+" :Ban cache: "+ConvToStr(ServerInstance->BanCache->GetSize())+"/"+ConvToStr(ServerInstance->BanCache->GetCapacity())+
+				" entries, "+ConvToStr(ServerInstance->BanCache->Hits)+" hits, "+ConvToStr(ServerInstance->BanCache->Misses)+" misses, "+
+				ConvToStr(ServerInstance->BanCache->Evictions)+" evictions");
 
 			float kbitpersec_in, kbitpersec_out, kbitpersec_total;
 			char kbitpersec_in_s[30], kbitpersec_out_s[30], kbitpersec_total_s[30];
@@ -76,6 +76,19 @@ class CommandWho : public Command
 	 */
 	CmdResult Handle(const std::vector<std::string>& parameters, User *user);
 	bool whomatch(User* cuser, User* user, const char* matchtext);
+
+	/** Use the indexes kept by the core to find the users who could match a query on
+	 * nick, displayed host and server, instead of checking every user on the network.
+	 * @param user The user issuing the query
+	 * @param matchtext The mask being searched for
+	 * @param candidates Filled with the users who could match
+	 * @return True if candidates holds every user who could match, false if all users must be checked
+	 */
+	bool GetCandidates(User* user, const std::string& matchtext, std::vector<User*>& candidates);
+
+	/** Check a user against a query which is not for a channel and add them to the results if they match
+	 */
+	void CheckUser(User* user, User* u, const std::vector<std::string>& parms, const std::string& initial, const std::string& matchtext, bool usingwildcards, std::vector<std::string>& whoresults);
 };
 
 bool CommandWho::whomatch(User* cuser, User* user, const char* matchtext)
@@ -168,12 +181,90 @@ bool CommandWho::whomatch(User* cuser, User* user, const char* matchtext)
 
 		/* Don't allow server name matches if HideWhoisServer is enabled, unless the command user has the priv */
 		if (!match && (ServerInstance->Config->HideWhoisServer.empty() || cuser->HasPrivPermission("users/auspex")))
-			match = InspIRCd::Match(user->server, matchtext);
+			match = InspIRCd::Match(user->server->GetName(), matchtext);
 
 		return match;
 	}
 }
 
+bool CommandWho::GetCandidates(User* user, const std::string& matchtext, std::vector<User*>& candidates)
+{
+	/* Only the nick, displayed host and server are indexed */
+	if (opt_mode || opt_metadata || opt_realname || opt_showrealhost || opt_ident || opt_port || opt_away || opt_time)
+		return false;
+
+	/* Everyone on a matching server matches, which no index helps with */
+	if (ServerInstance->Config->HideWhoisServer.empty() || user->HasPrivPermission("users/auspex"))
+	{
+		if (InspIRCd::Match(ServerInstance->Config->ServerName, matchtext))
+			return false;
+
+		ProtocolInterface::ServerList servers;
+		ServerInstance->PI->GetServerList(servers);
+		for (ProtocolInterface::ServerList::const_iterator i = servers.begin(); i != servers.end(); ++i)
+		{
+			if (InspIRCd::Match(i->servername, matchtext))
+				return false;
+		}
+	}
+
+	std::string::size_type lastwild = matchtext.find_last_of("*?");
+
+	/* Nicks can't contain a dot, so a mask with one can only match a host. Otherwise only
+	 * an exact nick can be looked up.
+	 */
+	if (matchtext.find('.') == std::string::npos)
+	{
+		if (lastwild != std::string::npos)
+			return false;
+
+		User* target = ServerInstance->FindNickOnly(matchtext);
+		if (target)
+			candidates.push_back(target);
+	}
+
+	/* Users whose displayed host ends with the text after the last wildcard are next to
+	 * each other in the host index.
+	 */
+	const std::string suffix = (lastwild == std::string::npos) ? matchtext : matchtext.substr(lastwild + 1);
+	if (suffix.empty())
+		return false;
+
+	const user_host_index& hostindex = ServerInstance->Users->hostindex;
+	const std::string key = UserManager::GetHostIndexKey(suffix);
+	user_host_index::const_iterator i = hostindex.lower_bound(key);
+	for (; i != hostindex.end() && i->first.compare(0, key.length(), key) == 0; ++i)
+	{
+		if (lastwild == std::string::npos && i->first.length() != key.length())
+			break;
+		candidates.push_back(i->second);
+	}
+
+	/* The nick lookup may have found someone who is also in the host range */
+	std::sort(candidates.begin(), candidates.end());
+	candidates.erase(std::unique(candidates.begin(), candidates.end()), candidates.end());
+	return true;
+}
+
+void CommandWho::CheckUser(User* user, User* u, const std::vector<std::string>& parms, const std::string& initial, const std::string& matchtext, bool usingwildcards, std::vector<std::string>& whoresults)
+{
+	if (opt_viewopersonly && !u->IsOper())
+		return;
+
+	if (!whomatch(user, u, matchtext.c_str()))
+		return;
+
+	if (!user->SharesChannelWith(u))
+	{
+		/* The opers only listing has always hidden the opers who are not +i here */
+		bool hidden = (opt_viewopersonly ? !u->IsModeSet(invisiblemode) : u->IsModeSet(invisiblemode));
+		if (usingwildcards && hidden && (!user->HasPrivPermission("users/auspex")))
+			return;
+	}
+
+	SendWhoLine(user, parms, initial, NULL, u, whoresults);
+}
+
 bool CommandWho::CanView(Channel* chan, User* user)
 {
 	if (!user || !chan)
@@ -204,7 +295,7 @@ void CommandWho::SendWhoLine(User* user, const std::vector<std::string>& parms,
 	if (!ServerInstance->Config->HideWhoisServer.empty() && !user->HasPrivPermission("servers/auspex"))
 		wholine.append(ServerInstance->Config->HideWhoisServer);
 	else
-		wholine.append(u->server);
+		wholine.append(u->server->GetName());
 
 	wholine.append(" " + u->nick + " ");
 
@@ -259,6 +350,7 @@ CmdResult CommandWho::Handle (const std::vector<std::string>& parameters, User *
 
 	std::vector<std::string> whoresults;
 	std::string initial = "352 " + user->nick + " ";
+	size_t examined = 0;
 
 	/* Change '0' into '*' so the wildcard matcher can grok it */
 	std::string matchtext = ((parameters[0] == "0") ? "*" : parameters[0]);
@@ -348,41 +440,37 @@ CmdResult CommandWho::Handle (const std::vector<std::string>& parameters, User *
 	}
 	else
 	{
-		/* Match against wildcard of nick, server or host */
-		if (opt_viewopersonly)
+		/* Match against wildcard of nick, server or host. Check the smallest set of
+		 * users which must contain every match: the users found in the indexes, the
+		 * opers, the local users or failing that everyone.
+		 */
+		std::vector<User*> candidates;
+		bool indexed = GetCandidates(user, matchtext, candidates);
+
+		if (indexed && (!opt_viewopersonly || candidates.size() < ServerInstance->Users->all_opers.size()))
+		{
+			examined = candidates.size();
+			for (std::vector<User*>::const_iterator i = candidates.begin(); i != candidates.end(); ++i)
+				CheckUser(user, *i, parameters, initial, matchtext, usingwildcards, whoresults);
+		}
+		else if (opt_viewopersonly)
 		{
 			/* Showing only opers */
+			examined = ServerInstance->Users->all_opers.size();
 			for (std::list<User*>::iterator i = ServerInstance->Users->all_opers.begin(); i != ServerInstance->Users->all_opers.end(); i++)
-			{
-				User* oper = *i;
-
-				if (whomatch(user, oper, matchtext.c_str()))
-				{
-					if (!user->SharesChannelWith(oper))
-					{
-						if (usingwildcards && (!oper->IsModeSet(invisiblemode)) && (!user->HasPrivPermission("users/auspex")))
-							continue;
-					}
-
-					SendWhoLine(user, parameters, initial, NULL, oper, whoresults);
-				}
-			}
+				CheckUser(user, *i, parameters, initial, matchtext, usingwildcards, whoresults);
+		}
+		else if (opt_local)
+		{
+			examined = ServerInstance->Users->local_users.size();
+			for (LocalUserList::iterator i = ServerInstance->Users->local_users.begin(); i != ServerInstance->Users->local_users.end(); i++)
+				CheckUser(user, *i, parameters, initial, matchtext, usingwildcards, whoresults);
 		}
 		else
 		{
+			examined = ServerInstance->Users->clientlist->size();
 			for (user_hash::iterator i = ServerInstance->Users->clientlist->begin(); i != ServerInstance->Users->clientlist->end(); i++)
-			{
-				if (whomatch(user, i->second, matchtext.c_str()))
-				{
-					if (!user->SharesChannelWith(i->second))
-					{
-						if (usingwildcards && (i->second->IsModeSet(invisiblemode)) && (!user->HasPrivPermission("users/auspex")))
-							continue;
-					}
-
-					SendWhoLine(user, parameters, initial, NULL, i->second, whoresults);
-				}
-			}
+				CheckUser(user, i->second, parameters, initial, matchtext, usingwildcards, whoresults);
 		}
 	}
 	/* Send the results out */
@@ -391,9 +479,10 @@ CmdResult CommandWho::Handle (const std::vector<std::string>& parameters, User *
 	user->WriteNumeric(RPL_ENDOFWHO, "%s :End of /WHO list.", *parameters[0].c_str() ? parameters[0].c_str() : "*");
 
 	// Penalize the user a bit for large queries
-	// (add one unit of penalty per 200 results)
+	// (add one unit of penalty per 200 results, and per 20000 users checked so
+	// repeated queries which can't use an index are throttled)
 	if (IS_LOCAL(user))
-		IS_LOCAL(user)->CommandFloodPenalty += whoresults.size() * 5;
+		IS_LOCAL(user)->CommandFloodPenalty += whoresults.size() * 5 + examined / 20;
 	return CMD_SUCCESS;
 }
 
@@ -23,8 +23,21 @@
 #include "inspircd.h"
 #include "commands/cmd_whowas.h"
 
+/** Marks an empty bucket in the WHOWAS index */
+static const unsigned int NO_NICK = static_cast<unsigned int>(-1);
+
+/** Spread the bits of a nickname hash so the low bits can be used to pick a bucket */
+static inline size_t MixHash(size_t hash)
+{
+	hash ^= hash >> 16;
+	hash *= 0x45d9f3b;
+	hash ^= hash >> 16;
+	return hash;
+}
+
 CommandWhowas::CommandWhowas( Module* parent)
 	: Command(parent, "WHOWAS", 1)
+	, oldest(0), index(16, NO_NICK)
 	, GroupSize(0), MaxGroups(0), MaxKeep(0)
 {
 	syntax = "<nick>{,<nick>}";
@@ -40,36 +53,27 @@ CmdResult CommandWhowas::Handle (const std::vector<std::string>& parameters, Use
 		return CMD_FAILURE;
 	}
 
-	whowas_users::iterator i = whowas.find(assign(parameters[0]));
+	unsigned int pos = index[FindBucket(parameters[0], irc::insensitive()(parameters[0]))];
 
-	if (i == whowas.end())
+	if (pos == NO_NICK || nicks[pos].entries.empty())
 	{
 		user->WriteNumeric(ERR_WASNOSUCHNICK, "%s :There was no such nickname", parameters[0].c_str());
 	}
 	else
 	{
-		whowas_set* grp = i->second;
-		if (!grp->empty())
+		const std::vector<WhoWasGroup>& grp = nicks[pos].entries;
+		for (std::vector<WhoWasGroup>::const_iterator u = grp.begin(); u != grp.end(); ++u)
 		{
-			for (whowas_set::iterator ux = grp->begin(); ux != grp->end(); ux++)
-			{
-				WhoWasGroup* u = *ux;
+			user->WriteNumeric(RPL_WHOWASUSER, "%s %s %s * :%s", parameters[0].c_str(),
+				u->GetIdent(), u->GetDisplayedHost(), u->GetGecos());
 
-				user->WriteNumeric(RPL_WHOWASUSER, "%s %s %s * :%s", parameters[0].c_str(),
-					u->ident.c_str(),u->dhost.c_str(),u->gecos.c_str());
+			if (user->HasPrivPermission("users/auspex"))
+				user->WriteNumeric(RPL_WHOWASIP, "%s :was connecting from *@%s",
+					parameters[0].c_str(), u->GetHost());
 
-				if (user->HasPrivPermission("users/auspex"))
-					user->WriteNumeric(RPL_WHOWASIP, "%s :was connecting from *@%s",
-						parameters[0].c_str(), u->host.c_str());
-
-				std::string signon = ServerInstance->TimeString(u->signon);
-				bool hide_server = (!ServerInstance->Config->HideWhoisServer.empty() && !user->HasPrivPermission("servers/auspex"));
-				user->WriteNumeric(RPL_WHOISSERVER, "%s %s :%s", parameters[0].c_str(), (hide_server ? ServerInstance->Config->HideWhoisServer.c_str() : u->server.c_str()), signon.c_str());
-			}
-		}
-		else
-		{
-			user->WriteNumeric(ERR_WASNOSUCHNICK, "%s :There was no such nickname", parameters[0].c_str());
+			std::string signon = ServerInstance->TimeString(u->signon);
+			bool hide_server = (!ServerInstance->Config->HideWhoisServer.empty() && !user->HasPrivPermission("servers/auspex"));
+			user->WriteNumeric(RPL_WHOISSERVER, "%s %s :%s", parameters[0].c_str(), (hide_server ? ServerInstance->Config->HideWhoisServer.c_str() : u->server->c_str()), signon.c_str());
 		}
 	}
 
@@ -79,15 +83,60 @@ CmdResult CommandWhowas::Handle (const std::vector<std::string>& parameters, Use
 
 std::string CommandWhowas::GetStats()
 {
-	int whowas_size = 0;
-	int whowas_bytes = 0;
-	for (whowas_users::iterator i = whowas.begin(); i != whowas.end(); ++i)
+	size_t whowas_size = 0;
+	size_t whowas_bytes = nicks.capacity() * sizeof(WhoWasNick) + index.capacity() * sizeof(unsigned int);
+	for (std::vector<WhoWasNick>::const_iterator i = nicks.begin(); i != nicks.end(); ++i)
+	{
+		whowas_size += i->entries.size();
+		whowas_bytes += i->nick.capacity() + i->entries.capacity() * sizeof(WhoWasGroup);
+		for (std::vector<WhoWasGroup>::const_iterator j = i->entries.begin(); j != i->entries.end(); ++j)
+			whowas_bytes += j->GetMemoryUsage();
+	}
+	for (std::set<std::string>::const_iterator i = servers.begin(); i != servers.end(); ++i)
+		whowas_bytes += i->capacity();
+
+	return "Whowas entries: " + ConvToStr(whowas_size) + " for " + ConvToStr(nicks.size()) + " nicks (" + ConvToStr(whowas_bytes) + " bytes)";
+}
+
+size_t CommandWhowas::FindBucket(const std::string& nick, size_t hash) const
+{
+	const size_t mask = index.size() - 1;
+	irc::StrHashComp equals;
+	for (size_t bucket = MixHash(hash) & mask; ; bucket = (bucket + 1) & mask)
 	{
-		whowas_set* n = i->second;
-		whowas_size += n->size();
-		whowas_bytes += (sizeof(whowas_set) + ( sizeof(WhoWasGroup) * n->size() ) );
+		unsigned int pos = index[bucket];
+		if (pos == NO_NICK || (nicks[pos].hash == hash && equals(nicks[pos].nick, nick)))
+			return bucket;
 	}
-	return "Whowas entries: " +ConvToStr(whowas_size)+" ("+ConvToStr(whowas_bytes)+" bytes)";
+}
+
+void CommandWhowas::EraseBucket(size_t bucket)
+{
+	// Shift back any entries which were pushed past the emptied bucket, so that
+	// lookups do not stop early at the hole.
+	const size_t mask = index.size() - 1;
+	size_t hole = bucket;
+	for (size_t next = (bucket + 1) & mask; index[next] != NO_NICK; next = (next + 1) & mask)
+	{
+		size_t home = MixHash(nicks[index[next]].hash) & mask;
+		if (((next - home) & mask) >= ((next - hole) & mask))
+		{
+			index[hole] = index[next];
+			hole = next;
+		}
+	}
+	index[hole] = NO_NICK;
+}
+
+void CommandWhowas::RebuildIndex()
+{
+	size_t size = 16;
+	while (size < nicks.size() * 2)
+		size *= 2;
+
+	index.assign(size, NO_NICK);
+	for (size_t pos = 0; pos < nicks.size(); ++pos)
+		index[FindBucket(nicks[pos].nick, nicks[pos].hash)] = pos;
 }
 
 void CommandWhowas::AddToWhoWas(User* user)
@@ -98,49 +147,52 @@ void CommandWhowas::AddToWhoWas(User* user)
 		return;
 	}
 
-	// Insert nick if it doesn't exist
-	// 'first' will point to the newly inserted element or to the existing element with an equivalent key
-	std::pair<whowas_users::iterator, bool> ret = whowas.insert(std::make_pair(irc::string(user->nick.c_str()), static_cast<whowas_set*>(NULL)));
+	const std::string* server = &*servers.insert(user->server->GetName()).first;
+	const size_t hash = irc::insensitive()(user->nick);
+	size_t bucket = FindBucket(user->nick, hash);
 
-	if (ret.second) // If inserted
+	if (index[bucket] != NO_NICK)
 	{
-		// This nick is new, create a list for it and add the first record to it
-		whowas_set* n = new whowas_set;
-		n->push_back(new WhoWasGroup(user));
-		ret.first->second = n;
+		// We've met this nick before, add a new record to the list
+		std::vector<WhoWasGroup>& entries = nicks[index[bucket]].entries;
+		entries.push_back(WhoWasGroup(user, server));
+
+		// If there are too many records for this nick, remove the oldest (front)
+		if (entries.size() > this->GroupSize)
+			entries.erase(entries.begin());
+		return;
+	}
 
-		// Add this nick to the fifo too
-		whowas_fifo.push_back(std::make_pair(ServerInstance->Time(), ret.first->first));
+	// This nick is new, give it the next slot in the ring, replacing the nick which
+	// was inserted the longest time ago if the ring is full
+	size_t pos;
+	if (nicks.size() < this->MaxGroups)
+	{
+		// Never let the ring buffer allocate room for more than MaxGroups nicks
+		if (nicks.size() == nicks.capacity())
+			nicks.reserve(std::min<size_t>(this->MaxGroups, std::max<size_t>(16, nicks.size() * 2)));
 
-		if (whowas.size() > this->MaxGroups)
-		{
-			// Too many nicks, remove the nick which was inserted the longest time ago from both the map and the fifo
-			whowas_users::iterator it = whowas.find(whowas_fifo.front().second);
-			if (it != whowas.end())
-			{
-				whowas_set* set = it->second;
-				for (whowas_set::iterator i = set->begin(); i != set->end(); ++i)
-					delete *i;
-
-				delete set;
-				whowas.erase(it);
-			}
-			whowas_fifo.pop_front();
-		}
+		pos = nicks.size();
+		nicks.push_back(WhoWasNick());
 	}
 	else
 	{
-		// We've met this nick before, add a new record to the list
-		whowas_set* set = ret.first->second;
-		set->push_back(new WhoWasGroup(user));
-
-		// If there are too many records for this nick, remove the oldest (front)
-		if (set->size() > this->GroupSize)
-		{
-			delete set->front();
-			set->pop_front();
-		}
+		pos = oldest;
+		oldest = (oldest + 1) % nicks.size();
+		EraseBucket(FindBucket(nicks[pos].nick, nicks[pos].hash));
+		bucket = FindBucket(user->nick, hash);
 	}
+
+	WhoWasNick& n = nicks[pos];
+	n.nick = user->nick;
+	n.hash = hash;
+	n.added = ServerInstance->Time();
+	n.entries.clear();
+	n.entries.push_back(WhoWasGroup(user, server));
+	index[bucket] = pos;
+
+	if (nicks.size() * 2 > index.size())
+		RebuildIndex();
 }
 
 /* on rehash, refactor maps according to new conf values */
@@ -148,75 +200,63 @@ void CommandWhowas::Prune()
 {
 	time_t min = ServerInstance->Time() - this->MaxKeep;
 
-	/* first cut the list to new size (maxgroups) and also prune entries that are timed out. */
-	while (!whowas_fifo.empty())
+	/* put the ring back in insertion order, then cut it to the new size (maxgroups)
+	 * and also prune entries that are timed out. */
+	std::rotate(nicks.begin(), nicks.begin() + oldest, nicks.end());
+	oldest = 0;
+
+	size_t drop = 0;
+	while ((drop < nicks.size()) && ((nicks.size() - drop > this->MaxGroups) || (nicks[drop].added < min)))
+		drop++;
+
+	if (drop)
 	{
-		if ((whowas_fifo.size() > this->MaxGroups) || (whowas_fifo.front().first < min))
-		{
-			whowas_users::iterator iter = whowas.find(whowas_fifo.front().second);
-
-			/* hopefully redundant integrity check, but added while debugging r6216 */
-			if (iter == whowas.end())
-			{
-				/* this should never happen, if it does maps are corrupt */
-				ServerInstance->Logs->Log("WHOWAS", LOG_DEFAULT, "BUG: Whowas maps got corrupted! (1)");
-				return;
-			}
-
-			whowas_set* set = iter->second;
-			for (whowas_set::iterator i = set->begin(); i != set->end(); ++i)
-				delete *i;
-
-			delete set;
-			whowas.erase(iter);
-			whowas_fifo.pop_front();
-		}
-		else
-			break;
+		nicks.erase(nicks.begin(), nicks.begin() + drop);
+		std::vector<WhoWasNick>(nicks).swap(nicks);
 	}
 
 	/* Then cut the whowas sets to new size (groupsize) */
-	for (whowas_users::iterator i = whowas.begin(); i != whowas.end(); ++i)
+	for (std::vector<WhoWasNick>::iterator i = nicks.begin(); i != nicks.end(); ++i)
 	{
-		whowas_set* n = i->second;
-		while (n->size() > this->GroupSize)
-		{
-			delete n->front();
-			n->pop_front();
-		}
+		std::vector<WhoWasGroup>& entries = i->entries;
+		if (entries.size() > this->GroupSize)
+			entries.erase(entries.begin(), entries.end() - this->GroupSize);
 	}
+
+	RebuildIndex();
 }
 
 /* call maintain once an hour to remove expired nicks */
 void CommandWhowas::Maintain()
 {
 	time_t min = ServerInstance->Time() - this->MaxKeep;
-	for (whowas_users::iterator i = whowas.begin(); i != whowas.end(); ++i)
+	for (std::vector<WhoWasNick>::iterator i = nicks.begin(); i != nicks.end(); ++i)
 	{
-		whowas_set* set = i->second;
-		while (!set->empty() && set->front()->signon < min)
-		{
-			delete set->front();
-			set->pop_front();
-		}
+		std::vector<WhoWasGroup>& entries = i->entries;
+		std::vector<WhoWasGroup>::iterator expired = entries.begin();
+		while (expired != entries.end() && expired->signon < min)
+			++expired;
+		entries.erase(entries.begin(), expired);
 	}
 }
 
-CommandWhowas::~CommandWhowas()
+WhoWasGroup::WhoWasGroup(User* user, const std::string* servername)
+	: server(servername), signon(user->signon)
 {
-	for (whowas_users::iterator i = whowas.begin(); i != whowas.end(); ++i)
-	{
-		whowas_set* set = i->second;
-		for (whowas_set::iterator j = set->begin(); j != set->end(); ++j)
-			delete *j;
+	data.reserve(user->host.length() + user->dhost.length() + user->ident.length() + user->fullname.length() + 4);
+	data.append(user->host).push_back('\0');
 
-		delete set;
+	dhostpos = 0;
+	if (user->dhost != user->host)
+	{
+		dhostpos = data.length();
+		data.append(user->dhost).push_back('\0');
 	}
-}
 
-WhoWasGroup::WhoWasGroup(User* user) : host(user->host), dhost(user->dhost), ident(user->ident),
-	server(user->server), gecos(user->fullname), signon(user->signon)
-{
+	identpos = data.length();
+	data.append(user->ident).push_back('\0');
+	gecospos = data.length();
+	data.append(user->fullname);
 }
 
 class ModuleWhoWas : public Module
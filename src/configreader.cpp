@@ -36,6 +36,8 @@ ServerConfig::ServerConfig()
 	dns_timeout = 5;
 	MaxTargets = 20;
 	NetBufferSize = 10240;
+	EventBatch = 1024;
+	BanCacheSize = 65536;
 	SoftLimit = ServerInstance->SE->GetMaxFds();
 	MaxConn = SOMAXCONN;
 	MaxChans = 20;
@@ -313,6 +315,99 @@ void ServerConfig::CrossCheckConnectBlocks(ServerConfig* current)
 			Classes[i] = me;
 		}
 	}
+
+	IndexConnectClasses();
+}
+
+/** Fold the case of a connect class mask, or of an IP or host to look up
+ */
+static std::string FoldClassMask(const std::string& mask)
+{
+	std::string ret(mask);
+	for (std::string::iterator i = ret.begin(); i != ret.end(); ++i)
+		*i = national_case_insensitive_map[(unsigned char)*i];
+	return ret;
+}
+
+void ServerConfig::IndexConnectClasses()
+{
+	ClassRanges.clear();
+	ClassLiterals.clear();
+	ClassWildcards.clear();
+	ClassNamed.clear();
+
+	for (size_t i = 0; i < Classes.size(); ++i)
+	{
+		ConnectClass* c = Classes[i];
+		if (c->type == CC_NAMED)
+		{
+			ClassNamed.push_back(i);
+			continue;
+		}
+
+		const std::string& mask = c->host;
+		if (mask.find_first_of("*?") != std::string::npos)
+		{
+			ClassWildcards.push_back(i);
+			continue;
+		}
+
+		std::string::size_type slash = mask.rfind('/');
+		if (slash != std::string::npos)
+		{
+			/* Malformed CIDR masks have odd semantics in InspIRCd::MatchCIDR, so leave those to it */
+			irc::sockets::sockaddrs sa;
+			if (mask.find('@') != std::string::npos || !irc::sockets::aptosa(mask.substr(0, slash), 0, sa))
+			{
+				ClassWildcards.push_back(i);
+				continue;
+			}
+
+			irc::sockets::cidr_mask range(mask);
+			if (range.length <= (range.type == AF_INET ? 32 : 128))
+				ClassRanges[range].push_back(i);
+		}
+
+		ClassLiterals[FoldClassMask(mask)].push_back(i);
+	}
+}
+
+void ServerConfig::FindConnectClasses(LocalUser* user, std::vector<size_t>& out, bool named)
+{
+	if (named)
+		out.insert(out.end(), ClassNamed.begin(), ClassNamed.end());
+
+	const std::string& ip = user->GetIPString();
+	const std::string* subjects[2] = { &ip, &user->host };
+	const size_t count = (user->host == ip) ? 1 : 2;
+
+	for (size_t n = 0; n < count; ++n)
+	{
+		const std::string& subject = *subjects[n];
+
+		TR1NS::unordered_map<std::string, std::vector<size_t> >::const_iterator literal = ClassLiterals.find(FoldClassMask(subject));
+		if (literal != ClassLiterals.end())
+			out.insert(out.end(), literal->second.begin(), literal->second.end());
+
+		irc::sockets::sockaddrs sa;
+		if (!ClassRanges.empty() && irc::sockets::aptosa(subject, 0, sa))
+		{
+			std::vector<std::vector<size_t>*> ranges;
+			ClassRanges.lookup(sa, ranges);
+			for (std::vector<std::vector<size_t>*>::const_iterator i = ranges.begin(); i != ranges.end(); ++i)
+				out.insert(out.end(), (*i)->begin(), (*i)->end());
+		}
+	}
+
+	for (std::vector<size_t>::const_iterator i = ClassWildcards.begin(); i != ClassWildcards.end(); ++i)
+	{
+		const std::string& mask = Classes[*i]->host;
+		if (InspIRCd::MatchCIDR(ip, mask, NULL) || InspIRCd::MatchCIDR(user->host, mask, NULL))
+			out.push_back(*i);
+	}
+
+	std::sort(out.begin(), out.end());
+	out.erase(std::unique(out.begin(), out.end()), out.end());
 }
 
 /** Represents a deprecated configuration tag.
@@ -384,6 +479,8 @@ void ServerConfig::Fill()
 	AdminEmail = ConfValue("admin")->getString("email", "null@example.com");
 	AdminNick = ConfValue("admin")->getString("nick", "admin");
 	NetBufferSize = ConfValue("performance")->getInt("netbuffersize", 10240, 1024, 65534);
+	EventBatch = ConfValue("performance")->getInt("eventbatch", 1024, 16, ServerInstance->SE->GetMaxFds());
+	BanCacheSize = ConfValue("performance")->getInt("bancachesize", 65536, 0, INT_MAX);
 	dns_timeout = ConfValue("dns")->getInt("timeout", 5);
 	DisabledCommands = ConfValue("disabled")->getString("commands", "");
 	DisabledDontExist = ConfValue("disabled")->getBool("fakenonexistant");
@@ -119,9 +119,14 @@ void InspIRCd::Cleanup()
 
 	/* Delete objects dynamically allocated in constructor (destructor would be more appropriate, but we're likely exiting) */
 	/* Must be deleted before modes as it decrements modelines */
+	Server* localserver = NULL;
 	if (FakeClient)
+	{
+		localserver = FakeClient->server;
 		FakeClient->cull();
+	}
 	DeleteZero(this->FakeClient);
+	delete localserver;
 	DeleteZero(this->Users);
 	DeleteZero(this->Modes);
 	DeleteZero(this->XLines);
@@ -661,6 +666,11 @@ void InspIRCd::Run()
 
 		UpdateTime();
 
+		/* Timers have millisecond resolution so they are run on
+		 * every pass, the wheel only turns as far as the clock has.
+		 */
+		Timers->TickTimers();
+
 		/* Run background module timers every few seconds
 		 * (the docs say modules shouldnt rely on accurate
 		 * timing using this event, so we dont have to
@@ -703,7 +713,6 @@ void InspIRCd::Run()
 				FOREACH_MOD(OnGarbageCollect, ());
 			}
 
-			Timers->TickTimers(TIME.tv_sec);
 			Users->DoBackgroundUserStuff();
 
 			if ((TIME.tv_sec % 5) == 0)
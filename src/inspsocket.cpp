@@ -154,9 +154,10 @@ bool StreamSocket::GetNextLine(std::string& line, char delim)
 	std::string::size_type i = recvq.find(delim);
 	if (i == std::string::npos)
 		return false;
-	line = recvq.substr(0, i);
-	// TODO is this the most efficient way to split?
-	recvq = recvq.substr(i + 1);
+	line.assign(recvq, 0, i);
+	// Shift the rest of the recvq down in place. Callers which split many lines
+	// out of a single read should scan the recvq and erase it once instead.
+	recvq.erase(0, i + 1);
 	return true;
 }
 
@@ -220,6 +221,44 @@ void StreamSocket::DoRead()
 /* Don't try to prepare huge blobs of data to send to a blocked socket */
 static const int MYIOV_MAX = IOV_MAX < 128 ? IOV_MAX : 128;
 
+/* Size of the blocks which sendqs are made of */
+static const std::string::size_type SENDQ_BLOCK_SIZE = 4096;
+
+/* Maximum number of unused blocks kept for reuse by any socket */
+static const size_t SENDQ_POOL_MAX = 1024;
+
+/* Blocks released by sockets which emptied their sendq */
+static std::vector<std::string> sendq_pool;
+
+/** Add an empty block to the back of a sendq, reusing a pooled one if there is any */
+static void NewSendQBlock(std::deque<std::string>& sendq)
+{
+	sendq.push_back(std::string());
+	if (sendq_pool.empty())
+	{
+		sendq.back().reserve(SENDQ_BLOCK_SIZE);
+	}
+	else
+	{
+		sendq.back().swap(sendq_pool.back());
+		sendq_pool.pop_back();
+	}
+}
+
+/** Remove the block at the front of a sendq, keeping its storage in the pool */
+static void PopSendQBlock(std::deque<std::string>& sendq)
+{
+	std::string& front = sendq.front();
+	// IOHooks may have replaced the block with a string of a different size
+	if (sendq_pool.size() < SENDQ_POOL_MAX && front.capacity() >= SENDQ_BLOCK_SIZE && front.capacity() < 2 * SENDQ_BLOCK_SIZE)
+	{
+		front.clear();
+		sendq_pool.push_back(std::string());
+		sendq_pool.back().swap(front);
+	}
+	sendq.pop_front();
+}
+
 void StreamSocket::DoWrite()
 {
 	if (sendq.empty())
@@ -237,26 +276,10 @@ void StreamSocket::DoWrite()
 		int rv = -1;
 		try
 		{
+			// WriteData() fills each block before starting the next one, so
+			// the IOHook is already handed as much data per call as fits
 			while (error.empty() && !sendq.empty())
 			{
-				if (sendq.size() > 1 && sendq[0].length() < 1024)
-				{
-					// Avoid multiple repeated SSL encryption invocations
-					// This adds a single copy of the queue, but avoids
-					// much more overhead in terms of system calls invoked
-					// by the IOHook.
-					//
-					// The length limit of 1024 is to prevent merging strings
-					// more than once when writes begin to block.
-					std::string tmp;
-					tmp.reserve(1280);
-					while (!sendq.empty() && tmp.length() < 1024)
-					{
-						tmp.append(sendq.front());
-						sendq.pop_front();
-					}
-					sendq.push_front(tmp);
-				}
 				std::string& front = sendq.front();
 				int itemlen = front.length();
 				if (GetIOHook())
@@ -266,7 +289,7 @@ void StreamSocket::DoWrite()
 					{
 						// consumed the entire string, and is ready for more
 						sendq_len -= itemlen;
-						sendq.pop_front();
+						PopSendQBlock(sendq);
 					}
 					else if (rv == 0)
 					{
@@ -310,7 +333,7 @@ void StreamSocket::DoWrite()
 					else
 					{
 						sendq_len -= itemlen;
-						sendq.pop_front();
+						PopSendQBlock(sendq);
 						if (sendq.empty())
 							ServerInstance->SE->ChangeEventMask(this, FD_WANT_EDGE_WRITE);
 					}
@@ -344,7 +367,7 @@ void StreamSocket::DoWrite()
 			}
 
 			int rv_max = 0;
-			iovec* iovecs = new iovec[bufcount];
+			iovec iovecs[MYIOV_MAX];
 			for(int i=0; i < bufcount; i++)
 			{
 				iovecs[i].iov_base = const_cast<char*>(sendq[i].data());
@@ -352,14 +375,14 @@ void StreamSocket::DoWrite()
 				rv_max += sendq[i].length();
 			}
 			int rv = writev(fd, iovecs, bufcount);
-			delete[] iovecs;
 
 			if (rv == (int)sendq_len)
 			{
 				// it's our lucky day, everything got written out. Fast cleanup.
 				// This won't ever happen if the number of buffers got capped.
 				sendq_len = 0;
-				sendq.clear();
+				while (!sendq.empty())
+					PopSendQBlock(sendq);
 			}
 			else if (rv > 0)
 			{
@@ -377,12 +400,12 @@ void StreamSocket::DoWrite()
 					{
 						// this string got fully written out
 						rv -= front.length();
-						sendq.pop_front();
+						PopSendQBlock(sendq);
 					}
 					else
 					{
 						// stopped in the middle of this string
-						front = front.substr(rv);
+						front.erase(0, rv);
 						rv = 0;
 					}
 				}
@@ -427,8 +450,19 @@ void StreamSocket::WriteData(const std::string &data)
 		return;
 	}
 
-	/* Append the data to the back of the queue ready for writing */
-	sendq.push_back(data);
+	/* Copy the data into the blocks at the back of the queue ready for writing,
+	 * starting a new block only when the last one is full
+	 */
+	std::string::size_type pos = 0;
+	while (pos < data.length())
+	{
+		if (sendq.empty() || sendq.back().length() >= SENDQ_BLOCK_SIZE)
+			NewSendQBlock(sendq);
+		std::string& back = sendq.back();
+		std::string::size_type chunk = std::min(data.length() - pos, SENDQ_BLOCK_SIZE - back.length());
+		back.append(data, pos, chunk);
+		pos += chunk;
+	}
 	sendq_len += data.length();
 
 	ServerInstance->SE->ChangeEventMask(this, FD_ADD_TRIAL_WRITE);
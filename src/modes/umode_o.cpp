@@ -32,7 +32,7 @@ ModeUserOperator::ModeUserOperator() : ModeHandler(NULL, "oper", 'o', PARAM_NONE
 ModeAction ModeUserOperator::OnModeChange(User* source, User* dest, Channel*, std::string&, bool adding)
 {
 	/* Only opers can execute this class at all */
-	if (!ServerInstance->ULine(source->server) && !source->IsOper())
+	if (!ServerInstance->ULine(source->server->GetName()) && !source->IsOper())
 		return MODEACTION_DENY;
 
 	/* Not even opers can GIVE the +o mode, only take it away */
@@ -47,7 +47,7 @@ ModeAction ModeUserOperator::OnModeChange(User* source, User* dest, Channel*, st
 	 */
 	char snomask = IS_LOCAL(dest) ? 'o' : 'O';
 	ServerInstance->SNO->WriteToSnoMask(snomask, "User %s de-opered (by %s)", dest->nick.c_str(),
-		source->nick.empty() ? source->server.c_str() : source->nick.c_str());
+		source->nick.empty() ? source->server->GetName().c_str() : source->nick.c_str());
 	dest->UnOper();
 
 	return MODEACTION_ALLOW;
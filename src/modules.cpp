@@ -89,6 +89,15 @@ void		Module::OnUserQuit(User*, const std::string&, const std::string&) { Detach
 void		Module::OnUserDisconnect(LocalUser*) { DetachEvent(I_OnUserDisconnect); }
 void		Module::OnUserJoin(Membership*, bool, bool, CUList&) { DetachEvent(I_OnUserJoin); }
 void		Module::OnPostJoin(Membership*) { DetachEvent(I_OnPostJoin); }
+
+void Module::OnUserJoinBatch(const std::vector<Membership*>& memberships, bool sync, std::vector<CUList>& except_lists)
+{
+	DetachEvent(I_OnUserJoinBatch);
+
+	// From now on Channel::ForceJoinMany() calls OnUserJoin() for each membership instead, do it here for this batch
+	for (size_t i = 0; i < memberships.size(); ++i)
+		OnUserJoin(memberships[i], sync, false, except_lists[i]);
+}
 void		Module::OnUserPart(Membership*, std::string&, CUList&) { DetachEvent(I_OnUserPart); }
 void		Module::OnPreRehash(User*, const std::string&) { DetachEvent(I_OnPreRehash); }
 void		Module::OnModuleRehash(User*, const std::string&) { DetachEvent(I_OnModuleRehash); }
@@ -55,6 +55,11 @@ class PCRERegex : public Regex
 	{
 		return (pcre_exec(regex, NULL, text.c_str(), text.length(), 0, 0, NULL, 0) >= 0);
 	}
+
+	bool GetRequiredLiteral(std::string& literal) CXX11_OVERRIDE
+	{
+		return ExtractLiteral(regex_string, literal);
+	}
 };
 
 class PCREFactory : public RegexFactory
@@ -58,6 +58,11 @@ class POSIXRegex : public Regex
 	{
 		return (regexec(&regbuf, text.c_str(), 0, NULL, 0) == 0);
 	}
+
+	bool GetRequiredLiteral(std::string& literal) CXX11_OVERRIDE
+	{
+		return ExtractLiteral(regex_string, literal);
+	}
 };
 
 class PosixFactory : public RegexFactory
@@ -47,6 +47,11 @@ class RE2Regex : public Regex
 	{
 		return RE2::FullMatch(text, regexcl);
 	}
+
+	bool GetRequiredLiteral(std::string& literal) CXX11_OVERRIDE
+	{
+		return ExtractLiteral(regex_string, literal);
+	}
 };
 
 class RE2Factory : public RegexFactory
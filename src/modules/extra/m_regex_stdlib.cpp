@@ -42,6 +42,11 @@ class StdRegex : public Regex
 	{
 		return std::regex_search(text, regexcl);
 	}
+
+	bool GetRequiredLiteral(std::string& literal) CXX11_OVERRIDE
+	{
+		return ExtractLiteral(regex_string, literal);
+	}
 };
 
 class StdRegexFactory : public RegexFactory
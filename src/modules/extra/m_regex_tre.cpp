@@ -61,6 +61,11 @@ public:
 	{
 		return (regexec(&regbuf, text.c_str(), 0, NULL, 0) == 0);
 	}
+
+	bool GetRequiredLiteral(std::string& literal) CXX11_OVERRIDE
+	{
+		return ExtractLiteral(regex_string, literal);
+	}
 };
 
 class TREFactory : public RegexFactory
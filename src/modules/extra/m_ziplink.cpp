@@ -0,0 +1,358 @@
+/*
+ * InspIRCd -- Internet Relay Chat Daemon
+ *
+ *
+ * This file is part of InspIRCd.  InspIRCd is free software: you can
+ * redistribute it and/or modify it under the terms of the GNU General Public
+ * License as published by the Free Software Foundation, version 2.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "inspircd.h"
+#include "iohook.h"
+#include <zlib.h>
+#include <ctime>
+
+/* $LinkerFlags: -lz */
+
+/** Preset dictionary given to zlib on both ends of a link. It holds the words
+ * server to server traffic is made of, so even the first lines sent on a link
+ * compress well. Changing it makes the module incompatible with older versions.
+ */
+static const char zipdictionary[] =
+	" ENDBURST :End of /STATS report SQUIT SERVER VERSION METADATA FHOST FNAME"
+	" FIDENT OPERTYPE AWAY SAVE FTOPIC KICK PART JOIN QUIT :Ping timeout"
+	" IJOIN FMODE MODE FJOIN +nt :o, v, NICK UID 0.0.0.0 + :"
+	" PONG PING NOTICE PRIVMSG #";
+
+/** Compression state and statistics of one compressed socket
+ */
+class zip_session
+{
+ public:
+	z_stream deflater;
+	z_stream inflater;
+	bool active;
+
+	/** Compressed data which could not be written to the socket yet
+	 */
+	std::string outbuf;
+
+	/** Address of the other end, for /STATS
+	 */
+	std::string peer;
+
+	unsigned long long plain_out;
+	unsigned long long zip_out;
+	unsigned long long plain_in;
+	unsigned long long zip_in;
+
+	/** Processor time spent compressing and decompressing, in clock ticks
+	 */
+	clock_t cputime;
+
+	zip_session() : active(false) { }
+};
+
+class ZipLinkIOHook : public IOHook
+{
+	zip_session* sessions;
+
+	zip_session* GetSession(StreamSocket* sock)
+	{
+		int fd = sock->GetFd();
+		/* Are there any possibilities of an out of range fd? Hope not, but lets be paranoid */
+		if ((fd < 0) || (fd > ServerInstance->SE->GetMaxFds() - 1))
+			return NULL;
+		return &sessions[fd];
+	}
+
+	void OpenSession(StreamSocket* sock, const std::string& peer)
+	{
+		zip_session* session = GetSession(sock);
+		if (!session)
+			return;
+
+		CloseSession(session);
+		memset(&session->deflater, 0, sizeof(session->deflater));
+		memset(&session->inflater, 0, sizeof(session->inflater));
+		if (deflateInit(&session->deflater, level) != Z_OK)
+			return;
+		if (inflateInit(&session->inflater) != Z_OK)
+		{
+			deflateEnd(&session->deflater);
+			return;
+		}
+		deflateSetDictionary(&session->deflater, reinterpret_cast<const Bytef*>(zipdictionary), sizeof(zipdictionary) - 1);
+
+		session->active = true;
+		session->peer = peer;
+		session->plain_out = session->zip_out = 0;
+		session->plain_in = session->zip_in = 0;
+		session->cputime = 0;
+		ServerInstance->SE->ChangeEventMask(sock, FD_WANT_FAST_READ | FD_WANT_EDGE_WRITE);
+	}
+
+	void CloseSession(zip_session* session)
+	{
+		if (!session->active)
+			return;
+
+		deflateEnd(&session->deflater);
+		inflateEnd(&session->inflater);
+		session->outbuf.clear();
+		session->peer.clear();
+		session->active = false;
+	}
+
+	/** Write as much of the compressed data as the socket accepts
+	 * @return 1 if everything was written, 0 if the socket blocked, -1 on error
+	 */
+	int Flush(StreamSocket* sock, zip_session* session)
+	{
+		if (session->outbuf.empty())
+			return 1;
+
+		int rv = ServerInstance->SE->Send(sock, session->outbuf.data(), session->outbuf.length(), 0);
+		if (rv == 0)
+		{
+			sock->SetError("Connection closed");
+			return -1;
+		}
+		else if (rv < 0)
+		{
+			if (errno == EINTR || SocketEngine::IgnoreError())
+			{
+				ServerInstance->SE->ChangeEventMask(sock, FD_WANT_FAST_WRITE | FD_WRITE_WILL_BLOCK);
+				return 0;
+			}
+			sock->SetError(SocketEngine::LastError());
+			return -1;
+		}
+
+		session->zip_out += rv;
+		session->outbuf.erase(0, rv);
+		if (!session->outbuf.empty())
+		{
+			ServerInstance->SE->ChangeEventMask(sock, FD_WANT_FAST_WRITE | FD_WRITE_WILL_BLOCK);
+			return 0;
+		}
+		return 1;
+	}
+
+ public:
+	int level;
+
+	ZipLinkIOHook(Module* mod)
+		: IOHook(mod, "ziplink"), level(Z_DEFAULT_COMPRESSION)
+	{
+		sessions = new zip_session[ServerInstance->SE->GetMaxFds()];
+	}
+
+	~ZipLinkIOHook()
+	{
+		for (int i = 0; i < ServerInstance->SE->GetMaxFds(); i++)
+			CloseSession(&sessions[i]);
+		delete[] sessions;
+	}
+
+	void OnStreamSocketAccept(StreamSocket* sock, irc::sockets::sockaddrs* client, irc::sockets::sockaddrs* server) CXX11_OVERRIDE
+	{
+		OpenSession(sock, client->str());
+	}
+
+	void OnStreamSocketConnect(StreamSocket* sock) CXX11_OVERRIDE
+	{
+		irc::sockets::sockaddrs peer;
+		socklen_t len = sizeof(peer);
+		if (getpeername(sock->GetFd(), &peer.sa, &len) == 0)
+			OpenSession(sock, peer.str());
+		else
+			OpenSession(sock, "*");
+	}
+
+	void OnStreamSocketClose(StreamSocket* sock) CXX11_OVERRIDE
+	{
+		zip_session* session = GetSession(sock);
+		if (session)
+			CloseSession(session);
+	}
+
+	int OnStreamSocketRead(StreamSocket* sock, std::string& recvq) CXX11_OVERRIDE
+	{
+		zip_session* session = GetSession(sock);
+		if ((!session) || (!session->active))
+			return -1;
+
+		char* buffer = ServerInstance->GetReadBuffer();
+		int bufsiz = ServerInstance->Config->NetBufferSize;
+		int n = ServerInstance->SE->Recv(sock, buffer, bufsiz, 0);
+		if (n == 0)
+		{
+			sock->SetError("Connection closed");
+			return -1;
+		}
+		else if (n < 0)
+		{
+			if (SocketEngine::IgnoreError())
+			{
+				ServerInstance->SE->ChangeEventMask(sock, FD_WANT_FAST_READ | FD_READ_WILL_BLOCK);
+				return 0;
+			}
+			else if (errno == EINTR)
+			{
+				ServerInstance->SE->ChangeEventMask(sock, FD_WANT_FAST_READ | FD_ADD_TRIAL_READ);
+				return 0;
+			}
+			sock->SetError(SocketEngine::LastError());
+			return -1;
+		}
+
+		if (n == bufsiz)
+			ServerInstance->SE->ChangeEventMask(sock, FD_WANT_FAST_READ | FD_ADD_TRIAL_READ);
+		else
+			ServerInstance->SE->ChangeEventMask(sock, FD_WANT_FAST_READ);
+
+		// The read buffer is shared, so the compressed data has to be copied before inflating into it
+		const std::string compressed(buffer, n);
+		const clock_t start = clock();
+		const std::string::size_type oldsize = recvq.size();
+		z_stream& zs = session->inflater;
+		zs.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(compressed.data()));
+		zs.avail_in = compressed.size();
+		do
+		{
+			zs.next_out = reinterpret_cast<Bytef*>(buffer);
+			zs.avail_out = bufsiz;
+			int ret = inflate(&zs, Z_SYNC_FLUSH);
+			if (ret == Z_NEED_DICT)
+			{
+				if (inflateSetDictionary(&zs, reinterpret_cast<const Bytef*>(zipdictionary), sizeof(zipdictionary) - 1) != Z_OK)
+				{
+					sock->SetError("Compression dictionary mismatch");
+					return -1;
+				}
+				ret = inflate(&zs, Z_SYNC_FLUSH);
+			}
+			if ((ret != Z_OK) && (ret != Z_BUF_ERROR))
+			{
+				sock->SetError("Error decompressing data");
+				return -1;
+			}
+			recvq.append(buffer, bufsiz - zs.avail_out);
+		} while (zs.avail_out == 0);
+		session->cputime += clock() - start;
+		session->zip_in += n;
+		session->plain_in += recvq.size() - oldsize;
+		return 1;
+	}
+
+	int OnStreamSocketWrite(StreamSocket* sock, std::string& sendq) CXX11_OVERRIDE
+	{
+		zip_session* session = GetSession(sock);
+		if ((!session) || (!session->active))
+			return -1;
+
+		// Finish writing the previous block first, the sendq holds the rest uncompressed until then
+		int rv = Flush(sock, session);
+		if (rv <= 0)
+			return rv;
+
+		if (sendq.empty())
+		{
+			ServerInstance->SE->ChangeEventMask(sock, FD_WANT_EDGE_WRITE);
+			return 1;
+		}
+
+		const clock_t start = clock();
+		char* buffer = ServerInstance->GetReadBuffer();
+		unsigned int bufsiz = ServerInstance->Config->NetBufferSize;
+		z_stream& zs = session->deflater;
+		zs.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(sendq.data()));
+		zs.avail_in = sendq.size();
+		do
+		{
+			zs.next_out = reinterpret_cast<Bytef*>(buffer);
+			zs.avail_out = bufsiz;
+			if (deflate(&zs, Z_SYNC_FLUSH) == Z_STREAM_ERROR)
+			{
+				sock->SetError("Error compressing data");
+				return -1;
+			}
+			session->outbuf.append(buffer, bufsiz - zs.avail_out);
+		} while (zs.avail_out == 0);
+		session->cputime += clock() - start;
+		session->plain_out += sendq.size();
+
+		// The block is consumed, if the socket blocks now the rest waits in outbuf
+		sendq.clear();
+		rv = Flush(sock, session);
+		if (rv > 0)
+			ServerInstance->SE->ChangeEventMask(sock, FD_WANT_EDGE_WRITE);
+		return rv;
+	}
+
+	void GetStats(User* user, string_list& out)
+	{
+		const std::string prefix = ServerInstance->Config->ServerName + " 249 " + user->nick + " :";
+		for (int i = 0; i < ServerInstance->SE->GetMaxFds(); i++)
+		{
+			const zip_session& session = sessions[i];
+			if (!session.active)
+				continue;
+
+			const double outratio = session.plain_out ? 100.0 * session.zip_out / session.plain_out : 100.0;
+			const double inratio = session.plain_in ? 100.0 * session.zip_in / session.plain_in : 100.0;
+			const double cpums = 1000.0 * session.cputime / CLOCKS_PER_SEC;
+			out.push_back(prefix + InspIRCd::Format("%s sent %llu/%llu bytes (%.1f%%) received %llu/%llu bytes (%.1f%%) cpu %.1f ms",
+				session.peer.c_str(), session.zip_out, session.plain_out, outratio,
+				session.zip_in, session.plain_in, inratio, cpums));
+		}
+	}
+};
+
+class ModuleZipLink : public Module
+{
+	ZipLinkIOHook iohook;
+
+ public:
+	ModuleZipLink() : iohook(this)
+	{
+	}
+
+	void ReadConfig(ConfigStatus& status) CXX11_OVERRIDE
+	{
+		ConfigTag* tag = ServerInstance->Config->ConfValue("ziplink");
+		iohook.level = tag->getInt("level", Z_DEFAULT_COMPRESSION, Z_DEFAULT_COMPRESSION, Z_BEST_COMPRESSION);
+	}
+
+	void OnHookIO(StreamSocket* sock, ListenSocket* lsb) CXX11_OVERRIDE
+	{
+		if (!sock->GetIOHook() && lsb->bind_tag->getString("ssl") == "ziplink")
+			sock->AddIOHook(&iohook);
+	}
+
+	ModResult OnStats(char symbol, User* user, string_list& out) CXX11_OVERRIDE
+	{
+		if (symbol != 'x')
+			return MOD_RES_PASSTHRU;
+
+		iohook.GetStats(user, out);
+		return MOD_RES_DENY;
+	}
+
+	Version GetVersion() CXX11_OVERRIDE
+	{
+		return Version("Provides zlib compressed server to server links", VF_NONE);
+	}
+};
+
+MODULE_INIT(ModuleZipLink)
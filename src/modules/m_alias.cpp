@@ -274,7 +274,7 @@ class ModuleAlias : public Module
 		}
 		if ((u != NULL) && (!a->RequiredNick.empty()) && (a->ULineOnly))
 		{
-			if (!ServerInstance->ULine(u->server))
+			if (!ServerInstance->ULine(u->server->GetName()))
 			{
 				ServerInstance->SNO->WriteToSnoMask('a', "NOTICE -- Service "+a->RequiredNick+" required by alias "+std::string(a->AliasedCommand.c_str())+" is not on a u-lined server, possibly underhanded antics detected!");
 				user->WriteNumeric(ERR_NOSUCHNICK, a->RequiredNick + " :is an imposter! Please inform an IRC operator as soon as possible.");
@@ -254,7 +254,7 @@ public:
 			return ROUTE_LOCALONLY;
 
 		// Route to the server of the target
-		return ROUTE_UNICAST(action.first->server);
+		return ROUTE_UNICAST(action.first->server->GetName());
 	}
 
 	void ListAccept(User* user)
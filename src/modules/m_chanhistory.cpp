@@ -19,18 +19,154 @@
 
 #include "inspircd.h"
 
+/** Source prefixes (":nick!user@host") shared between history entries, so a user
+ * who speaks in many +H channels only has their prefix stored once.
+ */
+class PrefixPool
+{
+	typedef TR1NS::unordered_map<std::string, unsigned int> PrefixMap;
+	PrefixMap prefixes;
+
+ public:
+	typedef PrefixMap::value_type Entry;
+
+	/** Retrieves the shared copy of a prefix, adding it if needed, and takes a reference to it. */
+	Entry* Acquire(const std::string& prefix)
+	{
+		Entry& entry = *prefixes.insert(std::make_pair(prefix, 0)).first;
+		entry.second++;
+		return &entry;
+	}
+
+	/** Drops a reference to a prefix, removing it when nothing refers to it any more. */
+	void Release(Entry* entry)
+	{
+		if (!--entry->second)
+			prefixes.erase(prefixes.find(entry->first));
+	}
+};
+
 struct HistoryItem
 {
 	time_t ts;
-	std::string line;
-	HistoryItem(const std::string& Line) : ts(ServerInstance->Time()), line(Line) {}
+	PrefixPool::Entry* source;
+	std::string text;
+	HistoryItem(PrefixPool::Entry* Source, const std::string& Text) : ts(ServerInstance->Time()), source(Source), text(Text) {}
 };
 
-struct HistoryList
+/** The history of a channel, kept in a ring buffer which holds at most maxlen lines. */
+class HistoryList
 {
-	std::deque<HistoryItem> lines;
+	PrefixPool& pool;
+
+	/** Storage for the ring buffer, which grows as needed up to maxlen entries. */
+	std::vector<HistoryItem> lines;
+
+	/** Index of the oldest line in the buffer. */
+	std::vector<HistoryItem>::size_type start;
+
+	/** The lines in the buffer serialized in the form they are sent to joining users,
+	 * or empty if they have changed since it was last built.
+	 */
+	std::string replay;
+
+	/** The offset in the replay of each line, oldest first. */
+	std::vector<std::string::size_type> offsets;
+
+	const HistoryItem& At(std::vector<HistoryItem>::size_type index) const
+	{
+		return lines[(start + index) % lines.size()];
+	}
+
+ public:
 	unsigned int maxlen, maxtime;
-	HistoryList(unsigned int len, unsigned int time) : maxlen(len), maxtime(time) {}
+
+	HistoryList(PrefixPool& Pool, unsigned int len, unsigned int time) : pool(Pool), start(0), maxlen(len), maxtime(time) {}
+
+	~HistoryList()
+	{
+		for (std::vector<HistoryItem>::iterator i = lines.begin(); i != lines.end(); ++i)
+			pool.Release(i->source);
+	}
+
+	/** Adds a line, overwriting the oldest one if the buffer is full. */
+	void Add(const std::string& prefix, const std::string& text)
+	{
+		PrefixPool::Entry* source = pool.Acquire(prefix);
+		if (lines.size() < maxlen)
+		{
+			if (lines.size() == lines.capacity())
+				lines.reserve(std::min<std::vector<HistoryItem>::size_type>(maxlen, std::max<std::vector<HistoryItem>::size_type>(8, lines.size() * 2)));
+			lines.push_back(HistoryItem(source, text));
+		}
+		else
+		{
+			HistoryItem& oldest = lines[start];
+			pool.Release(oldest.source);
+			oldest = HistoryItem(source, text);
+			start = (start + 1) % lines.size();
+		}
+
+		replay.clear();
+		offsets.clear();
+	}
+
+	/** Changes the maximum number of lines, dropping the oldest lines if there are too many. */
+	void SetMaxLen(unsigned int len)
+	{
+		std::vector<HistoryItem>::size_type drop = (lines.size() > len) ? lines.size() - len : 0;
+		std::vector<HistoryItem> newlines;
+		newlines.reserve(lines.size() - drop);
+		for (std::vector<HistoryItem>::size_type i = 0; i < lines.size(); ++i)
+		{
+			if (i < drop)
+				pool.Release(At(i).source);
+			else
+				newlines.push_back(At(i));
+		}
+
+		lines.swap(newlines);
+		start = 0;
+		maxlen = len;
+		replay.clear();
+		offsets.clear();
+	}
+
+	/** Sends the lines which are newer than mintime to a user.
+	 * @param user The user to send the lines to.
+	 * @param chan The channel the history belongs to.
+	 * @param mintime Lines older than this are not sent.
+	 */
+	void Replay(LocalUser* user, Channel* chan, time_t mintime)
+	{
+		if (replay.empty() && !lines.empty())
+		{
+			const std::string::size_type maxline = ServerInstance->Config->Limits.MaxLine - 2;
+			for (std::vector<HistoryItem>::size_type i = 0; i < lines.size(); ++i)
+			{
+				const HistoryItem& item = At(i);
+				offsets.push_back(replay.length());
+				replay.append(item.source->first).append(" PRIVMSG ").append(chan->name).append(" :").append(item.text);
+				if (replay.length() - offsets.back() > maxline)
+					replay.erase(offsets.back() + maxline);
+				replay.append("\r\n");
+			}
+		}
+
+		// Lines are stored oldest first, so everything after the first line which
+		// is recent enough can be sent as it is.
+		std::vector<HistoryItem>::size_type first = 0;
+		while (first < lines.size() && At(first).ts < mintime)
+			first++;
+
+		if (first == lines.size())
+			return;
+
+		if (first == 0)
+			user->WriteBlock(replay, lines.size());
+		else
+			user->WriteBlock(replay.substr(offsets[first]), lines.size() - first);
+	}
 };
 
 class HistoryMode : public ModeHandler
@@ -50,6 +186,7 @@ class HistoryMode : public ModeHandler
 	}
 
  public:
+	PrefixPool prefixes;
 	SimpleExtItem<HistoryList> ext;
 	unsigned int maxlines;
 	HistoryMode(Module* Creator) : ModeHandler(Creator, "history", 'H', PARAM_SETONLY, MODETYPE_CHANNEL),
@@ -81,16 +218,15 @@ class HistoryMode : public ModeHandler
 			HistoryList* history = ext.get(channel);
 			if (history)
 			{
-				// Shrink the list if the new line number limit is lower than the old one
-				if (len < history->lines.size())
-					history->lines.erase(history->lines.begin(), history->lines.begin() + (history->lines.size() - len));
+				// Resize the list if the line number limit has changed, dropping the oldest lines if it shrank
+				if (len != history->maxlen)
+					history->SetMaxLen(len);
 
-				history->maxlen = len;
 				history->maxtime = time;
 			}
 			else
 			{
-				ext.set(channel, new HistoryList(len, time));
+				ext.set(channel, new HistoryList(prefixes, len, time));
 			}
 		}
 		else
@@ -129,21 +265,17 @@ class ModuleChanHistory : public Module
 			Channel* c = (Channel*)dest;
 			HistoryList* list = m.ext.get(c);
 			if (list)
-			{
-				const std::string line = ":" + user->GetFullHost() + " PRIVMSG " + c->name + " :" + text;
-				list->lines.push_back(HistoryItem(line));
-				if (list->lines.size() > list->maxlen)
-					list->lines.pop_front();
-			}
+				list->Add(":" + user->GetFullHost(), text);
 		}
 	}
 
 	void OnPostJoin(Membership* memb) CXX11_OVERRIDE
 	{
-		if (IS_REMOTE(memb->user))
+		LocalUser* user = IS_LOCAL(memb->user);
+		if (!user)
 			return;
 
-		if (memb->user->IsModeSet(botmode) && !dobots)
+		if (user->IsModeSet(botmode) && !dobots)
 			return;
 
 		HistoryList* list = m.ext.get(memb->chan);
@@ -155,14 +287,10 @@ class ModuleChanHistory : public Module
 
 		if (sendnotice)
 		{
-			memb->user->WriteNotice("Replaying up to " + ConvToStr(list->maxlen) + " lines of pre-join history spanning up to " + ConvToStr(list->maxtime) + " seconds");
+			user->WriteNotice("Replaying up to " + ConvToStr(list->maxlen) + " lines of pre-join history spanning up to " + ConvToStr(list->maxtime) + " seconds");
 		}
 
-		for(std::deque<HistoryItem>::iterator i = list->lines.begin(); i != list->lines.end(); ++i)
-		{
-			if (i->ts >= mintime)
-				memb->user->Write(i->line);
-		}
+		list->Replay(user, memb->chan, mintime);
 	}
 
 	Version GetVersion() CXX11_OVERRIDE
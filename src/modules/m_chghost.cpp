@@ -64,7 +64,7 @@ class CommandChghost : public Command
 
 		if (IS_LOCAL(dest))
 		{
-			if ((dest->ChangeDisplayedHost(parameters[1])) && (!ServerInstance->ULine(user->server)))
+			if ((dest->ChangeDisplayedHost(parameters[1])) && (!ServerInstance->ULine(user->server->GetName())))
 			{
 				// fix by brain - ulines set hosts silently
 				ServerInstance->SNO->WriteGlobalSno('a', user->nick+" used CHGHOST to make the displayed host of "+dest->nick+" become "+dest->dhost);
@@ -78,7 +78,7 @@ class CommandChghost : public Command
 	{
 		User* dest = ServerInstance->FindNick(parameters[0]);
 		if (dest)
-			return ROUTE_OPT_UCAST(dest->server);
+			return ROUTE_OPT_UCAST(dest->server->GetName());
 		return ROUTE_LOCALONLY;
 	}
 };
@@ -61,7 +61,7 @@ class CommandChgident : public Command
 		{
 			dest->ChangeIdent(parameters[1]);
 
-			if (!ServerInstance->ULine(user->server))
+			if (!ServerInstance->ULine(user->server->GetName()))
 				ServerInstance->SNO->WriteGlobalSno('a', "%s used CHGIDENT to change %s's ident to '%s'", user->nick.c_str(), dest->nick.c_str(), dest->ident.c_str());
 		}
 
@@ -72,7 +72,7 @@ class CommandChgident : public Command
 	{
 		User* dest = ServerInstance->FindNick(parameters[0]);
 		if (dest)
-			return ROUTE_OPT_UCAST(dest->server);
+			return ROUTE_OPT_UCAST(dest->server->GetName());
 		return ROUTE_LOCALONLY;
 	}
 };
@@ -68,7 +68,7 @@ class CommandChgname : public Command
 	{
 		User* dest = ServerInstance->FindNick(parameters[0]);
 		if (dest)
-			return ROUTE_OPT_UCAST(dest->server);
+			return ROUTE_OPT_UCAST(dest->server->GetName());
 		return ROUTE_LOCALONLY;
 	}
 };
@@ -34,9 +34,71 @@ enum CloakMode
 	MODE_OPAQUE
 };
 
+enum CloakHash
+{
+	/** 2.0 cloak hash, MD5 of the segment id, key and item */
+	HASH_MD5,
+	/** HMAC of the segment id and item with any hash provider */
+	HASH_HMAC,
+	/** SipHash-2-4 of the segment id and item, needs no hash provider */
+	HASH_SIPHASH
+};
+
 // lowercase-only encoding similar to base64, used for hash output
 static const char base32[] = "0123456789abcdefghijklmnopqrstuv";
 
+static inline uint64_t RotL(uint64_t x, int b)
+{
+	return (x << b) | (x >> (64 - b));
+}
+
+static inline void SipRound(uint64_t& v0, uint64_t& v1, uint64_t& v2, uint64_t& v3)
+{
+	v0 += v1; v1 = RotL(v1, 13); v1 ^= v0; v0 = RotL(v0, 32);
+	v2 += v3; v3 = RotL(v3, 16); v3 ^= v2;
+	v0 += v3; v3 = RotL(v3, 21); v3 ^= v0;
+	v2 += v1; v1 = RotL(v1, 17); v1 ^= v2; v2 = RotL(v2, 32);
+}
+
+/** SipHash-2-4, a fast keyed hash meant for short inputs
+ */
+static uint64_t SipHash24(const uint64_t key[2], const std::string& data)
+{
+	uint64_t v0 = key[0] ^ ((uint64_t)0x736f6d65 << 32 | 0x70736575);
+	uint64_t v1 = key[1] ^ ((uint64_t)0x646f7261 << 32 | 0x6e646f6d);
+	uint64_t v2 = key[0] ^ ((uint64_t)0x6c796765 << 32 | 0x6e657261);
+	uint64_t v3 = key[1] ^ ((uint64_t)0x74656462 << 32 | 0x79746573);
+
+	const size_t len = data.length();
+	const size_t blocks = len - (len % 8);
+	for (size_t i = 0; i < blocks; i += 8)
+	{
+		uint64_t m = 0;
+		for (size_t j = 0; j < 8; ++j)
+			m |= (uint64_t)(unsigned char)data[i + j] << (8 * j);
+
+		v3 ^= m;
+		SipRound(v0, v1, v2, v3);
+		SipRound(v0, v1, v2, v3);
+		v0 ^= m;
+	}
+
+	uint64_t last = (uint64_t)len << 56;
+	for (size_t i = blocks; i < len; ++i)
+		last |= (uint64_t)(unsigned char)data[i] << (8 * (i - blocks));
+
+	v3 ^= last;
+	SipRound(v0, v1, v2, v3);
+	SipRound(v0, v1, v2, v3);
+	v0 ^= last;
+
+	v2 ^= 0xff;
+	for (int i = 0; i < 4; ++i)
+		SipRound(v0, v1, v2, v3);
+
+	return v0 ^ v1 ^ v2 ^ v3;
+}
+
 /** Handles user mode +x
  */
 class CloakUser : public ModeHandler
@@ -135,14 +197,22 @@ class ModuleCloaking : public Module
  public:
 	CloakUser cu;
 	CloakMode mode;
+	CloakHash hashtype;
 	CommandCloak ck;
 	std::string prefix;
 	std::string suffix;
 	std::string key;
+	uint64_t sipkey[2];
 	const char* xtab[4];
 	dynamic_reference<HashProvider> Hash;
 
-	ModuleCloaking() : cu(this), mode(MODE_OPAQUE), ck(this), Hash(this, "hash/md5")
+	/* Recently generated cloaks, most recently used first, keyed on the IP (and host in half mode) */
+	typedef std::list<std::pair<std::string, std::string> > CloakList;
+	CloakList cachelist;
+	TR1NS::unordered_map<std::string, CloakList::iterator> cache;
+	size_t cachesize;
+
+	ModuleCloaking() : cu(this), mode(MODE_OPAQUE), hashtype(HASH_MD5), ck(this), Hash(this, "hash/md5"), cachesize(0)
 	{
 	}
 
@@ -185,14 +255,41 @@ class ModuleCloaking : public Module
 	 */
 	std::string SegmentCloak(const std::string& item, char id, int len)
 	{
-		std::string input;
-		input.reserve(key.length() + 3 + item.length());
-		input.append(1, id);
-		input.append(key);
-		input.append(1, '\0'); // null does not terminate a C++ string
-		input.append(item);
-
-		std::string rv = Hash->sum(input).substr(0,len);
+		std::string rv;
+		switch (hashtype)
+		{
+			case HASH_MD5:
+			{
+				std::string input;
+				input.reserve(key.length() + 3 + item.length());
+				input.append(1, id);
+				input.append(key);
+				input.append(1, '\0'); // null does not terminate a C++ string
+				input.append(item);
+
+				rv = Hash->sum(input).substr(0,len);
+				break;
+			}
+			case HASH_HMAC:
+			{
+				rv = Hash->hmac(key, std::string(1, id) + item).substr(0,len);
+				break;
+			}
+			case HASH_SIPHASH:
+			{
+				// each block of output hashes the item with a different block number after the id
+				std::string input = std::string(1, id) + '\0' + item;
+				for (char block = 0; (int)rv.length() < len; block++)
+				{
+					input[1] = block;
+					uint64_t sum = SipHash24(sipkey, input);
+					for (int i = 0; i < 8 && (int)rv.length() < len; i++)
+						rv.push_back((char)(sum >> (8 * i)));
+				}
+				break;
+			}
+		}
+
 		for(int i=0; i < len; i++)
 		{
 			// this discards 3 bits per byte. We have an
@@ -308,7 +405,7 @@ class ModuleCloaking : public Module
 	Version GetVersion() CXX11_OVERRIDE
 	{
 		std::string testcloak = "broken";
-		if (Hash)
+		if (hashtype == HASH_SIPHASH || Hash)
 		{
 			switch (mode)
 			{
@@ -339,6 +436,26 @@ class ModuleCloaking : public Module
 		key = tag->getString("key");
 		if (key.empty() || key == "secret")
 			throw ModuleException("You have not defined cloak keys for m_cloaking. Define <cloak:key> as a network-wide secret.");
+
+		std::string hashstr = tag->getString("hash", "md5");
+		if (hashstr == "siphash")
+		{
+			hashtype = HASH_SIPHASH;
+
+			// derive the 128 bit SipHash key from the cloak key
+			const uint64_t nokey[2] = { 0, 0 };
+			sipkey[0] = SipHash24(nokey, "\1" + key);
+			sipkey[1] = SipHash24(nokey, "\2" + key);
+		}
+		else
+		{
+			hashtype = (hashstr == "md5") ? HASH_MD5 : HASH_HMAC;
+			Hash.SetProvider("hash/" + hashstr);
+		}
+
+		cachesize = tag->getInt("cachesize", 10000, 0, INT_MAX);
+		cache.clear();
+		cachelist.clear();
 	}
 
 	std::string GenCloak(const irc::sockets::sockaddrs& ip, const std::string& ipstr, const std::string& host)
@@ -362,13 +479,42 @@ class ModuleCloaking : public Module
 		return chost;
 	}
 
+	/** Get the cloak of a user, from the cache if their IP (and in half mode, host) was cloaked recently
+	 */
+	std::string GetCloak(LocalUser* dest)
+	{
+		std::string cachekey = dest->GetIPString();
+		if (mode == MODE_HALF_CLOAK)
+			cachekey.append(1, ' ').append(dest->host);
+
+		TR1NS::unordered_map<std::string, CloakList::iterator>::iterator it = cache.find(cachekey);
+		if (it != cache.end())
+		{
+			cachelist.splice(cachelist.begin(), cachelist, it->second);
+			return it->second->second;
+		}
+
+		std::string chost = GenCloak(dest->client_sa, dest->GetIPString(), dest->host);
+		if (cachesize)
+		{
+			cachelist.push_front(std::make_pair(cachekey, chost));
+			cache[cachekey] = cachelist.begin();
+			while (cache.size() > cachesize)
+			{
+				cache.erase(cachelist.back().first);
+				cachelist.pop_back();
+			}
+		}
+		return chost;
+	}
+
 	void OnUserConnect(LocalUser* dest) CXX11_OVERRIDE
 	{
 		std::string* cloak = cu.ext.get(dest);
 		if (cloak)
 			return;
 
-		cu.ext.set(dest, GenCloak(dest->client_sa, dest->GetIPString(), dest->host));
+		cu.ext.set(dest, GetCloak(dest));
 	}
 };
 
@@ -25,179 +25,280 @@
 #include "xline.h"
 #include "modules/dns.h"
 
+class DNSBLResolver;
+
 /* Class holding data for a single entry */
 class DNSBLConfEntry : public refcountbase
 {
 	public:
 		enum EnumBanaction { I_UNKNOWN, I_KILL, I_ZLINE, I_KLINE, I_GLINE, I_MARK };
 		enum EnumType { A_RECORD, A_BITMASK };
-		std::string name, ident, host, domain, reason;
+		/* A cached lookup result, 0 for IPs which are not listed */
+		struct Verdict { unsigned long result; time_t expires; };
+		std::string name, ident, host, domain, reason, file;
 		EnumBanaction banaction;
 		EnumType type;
 		long duration;
+		long cachetime;
 		int bitmask;
 		unsigned char records[256];
-		unsigned long stats_hits, stats_misses;
-		DNSBLConfEntry(): type(A_BITMASK),duration(86400),bitmask(0),stats_hits(0), stats_misses(0) {}
-};
-
-
-/** Resolver for CGI:IRC hostnames encoded in ident/GECOS
- */
-class DNSBLResolver : public DNS::Request
-{
-	std::string theiruid;
-	LocalStringExt& nameExt;
-	LocalIntExt& countExt;
-	reference<DNSBLConfEntry> ConfEntry;
+		unsigned long stats_hits, stats_misses, stats_cached;
+		/* Ranges listed in the local zone file, mapped to the A record they are listed with, or to 0 if excluded */
+		irc::sockets::cidr_tree<unsigned long> zone;
+		/* Recent lookup results by IP */
+		TR1NS::unordered_map<std::string, Verdict> verdicts;
+		time_t nextpurge;
+		/* Lookups in progress by IP, users connecting from the same IP wait on these */
+		std::map<std::string, DNSBLResolver*> lookups;
+		DNSBLConfEntry(): type(A_BITMASK),duration(86400),cachetime(300),bitmask(0),stats_hits(0), stats_misses(0), stats_cached(0), nextpurge(0) {}
+
+		/** Look an IP up in the local zone
+		 * @return The A record the IP is listed with, or 0 if it is not listed
+		 */
+		unsigned long LookupZone(const irc::sockets::sockaddrs& sa)
+		{
+			std::vector<unsigned long*> matches;
+			zone.lookup(sa, matches);
+			/* The most specific range decides, so exclusions can punch holes in wider listings */
+			return matches.empty() ? 0 : *matches.back();
+		}
 
- public:
+		bool GetVerdict(const std::string& ip, unsigned long& result)
+		{
+			TR1NS::unordered_map<std::string, Verdict>::iterator i = verdicts.find(ip);
+			if (i == verdicts.end())
+				return false;
 
-	DNSBLResolver(DNS::Manager *mgr, Module *me, LocalStringExt& match, LocalIntExt& ctr, const std::string &hostname, LocalUser* u, reference<DNSBLConfEntry> conf)
-		: DNS::Request(mgr, me, hostname, DNS::QUERY_A, true), theiruid(u->uuid), nameExt(match), countExt(ctr), ConfEntry(conf)
-	{
-	}
+			if (i->second.expires <= ServerInstance->Time())
+			{
+				verdicts.erase(i);
+				return false;
+			}
 
-	/* Note: This may be called multiple times for multiple A record results */
-	void OnLookupComplete(const DNS::Query *r) CXX11_OVERRIDE
-	{
-		/* Check the user still exists */
-		LocalUser* them = (LocalUser*)ServerInstance->FindUUID(theiruid);
-		if (!them)
-			return;
+			result = i->second.result;
+			return true;
+		}
 
-		const DNS::ResourceRecord &ans_record = r->answers[0];
+		void SetVerdict(const std::string& ip, unsigned long result, unsigned long ttl)
+		{
+			if (ttl > (unsigned long)cachetime)
+				ttl = cachetime;
+			if (!ttl)
+				return;
 
-		int i = countExt.get(them);
-		if (i)
-			countExt.set(them, i - 1);
+			time_t now = ServerInstance->Time();
+			if (now >= nextpurge)
+			{
+				for (TR1NS::unordered_map<std::string, Verdict>::iterator i = verdicts.begin(); i != verdicts.end(); )
+				{
+					if (i->second.expires <= now)
+						i = verdicts.erase(i);
+					else
+						++i;
+				}
+				nextpurge = now + cachetime;
+			}
 
-		// Now we calculate the bitmask: 256*(256*(256*a+b)+c)+d
+			Verdict& verdict = verdicts[ip];
+			verdict.result = result;
+			verdict.expires = now + ttl;
+		}
+};
 
-		unsigned int bitmask = 0, record = 0;
-		bool match = false;
-		in_addr resultip;
+/** Act on the result of a DNSBL lookup for a user
+ * @param result The A record the user's IP is listed with in network byte order, or 0 if it is not listed
+ */
+static void ApplyResult(LocalUser* them, DNSBLConfEntry* ConfEntry, LocalStringExt& nameExt, unsigned long result)
+{
+	// Now we calculate the bitmask: 256*(256*(256*a+b)+c)+d
 
-		inet_aton(ans_record.rdata.c_str(), &resultip);
+	unsigned int bitmask = 0, record = 0;
+	bool match = false;
 
+	if (result)
+	{
 		switch (ConfEntry->type)
 		{
 			case DNSBLConfEntry::A_BITMASK:
-				bitmask = resultip.s_addr >> 24; /* Last octet (network byte order) */
+				bitmask = result >> 24; /* Last octet (network byte order) */
 				bitmask &= ConfEntry->bitmask;
 				match = (bitmask != 0);
 			break;
 			case DNSBLConfEntry::A_RECORD:
-				record = resultip.s_addr >> 24; /* Last octet */
+				record = result >> 24; /* Last octet */
 				match = (ConfEntry->records[record] == 1);
 			break;
 		}
+	}
 
-		if (match)
+	if (match)
+	{
+		std::string reason = ConfEntry->reason;
+		std::string::size_type x = reason.find("%ip%");
+		while (x != std::string::npos)
 		{
-			std::string reason = ConfEntry->reason;
-			std::string::size_type x = reason.find("%ip%");
-			while (x != std::string::npos)
-			{
-				reason.erase(x, 4);
-				reason.insert(x, them->GetIPString());
-				x = reason.find("%ip%");
-			}
+			reason.erase(x, 4);
+			reason.insert(x, them->GetIPString());
+			x = reason.find("%ip%");
+		}
 
-			ConfEntry->stats_hits++;
+		ConfEntry->stats_hits++;
 
-			switch (ConfEntry->banaction)
+		switch (ConfEntry->banaction)
+		{
+			case DNSBLConfEntry::I_KILL:
 			{
-				case DNSBLConfEntry::I_KILL:
+				ServerInstance->Users->QuitUser(them, "Killed (" + reason + ")");
+				break;
+			}
+			case DNSBLConfEntry::I_MARK:
+			{
+				if (!ConfEntry->ident.empty())
 				{
-					ServerInstance->Users->QuitUser(them, "Killed (" + reason + ")");
-					break;
+					them->WriteNumeric(304, ":Your ident has been set to " + ConfEntry->ident + " because you matched " + reason);
+					them->ChangeIdent(ConfEntry->ident);
 				}
-				case DNSBLConfEntry::I_MARK:
-				{
-					if (!ConfEntry->ident.empty())
-					{
-						them->WriteNumeric(304, ":Your ident has been set to " + ConfEntry->ident + " because you matched " + reason);
-						them->ChangeIdent(ConfEntry->ident);
-					}
 
-					if (!ConfEntry->host.empty())
-					{
-						them->WriteNumeric(304, ":Your host has been set to " + ConfEntry->host + " because you matched " + reason);
-						them->ChangeDisplayedHost(ConfEntry->host);
-					}
-
-					nameExt.set(them, ConfEntry->name);
-					break;
+				if (!ConfEntry->host.empty())
+				{
+					them->WriteNumeric(304, ":Your host has been set to " + ConfEntry->host + " because you matched " + reason);
+					them->ChangeDisplayedHost(ConfEntry->host);
 				}
-				case DNSBLConfEntry::I_KLINE:
+
+				nameExt.set(them, ConfEntry->name);
+				break;
+			}
+			case DNSBLConfEntry::I_KLINE:
+			{
+				KLine* kl = new KLine(ServerInstance->Time(), ConfEntry->duration, ServerInstance->Config->ServerName.c_str(), reason.c_str(),
+						"*", them->GetIPString());
+				if (ServerInstance->XLines->AddLine(kl,NULL))
 				{
-					KLine* kl = new KLine(ServerInstance->Time(), ConfEntry->duration, ServerInstance->Config->ServerName.c_str(), reason.c_str(),
-							"*", them->GetIPString());
-					if (ServerInstance->XLines->AddLine(kl,NULL))
-					{
-						std::string timestr = ServerInstance->TimeString(kl->expiry);
-						ServerInstance->SNO->WriteGlobalSno('x',"K:line added due to DNSBL match on *@%s to expire on %s: %s",
-							them->GetIPString().c_str(), timestr.c_str(), reason.c_str());
-						ServerInstance->XLines->ApplyLines();
-					}
-					else
-						delete kl;
-					break;
+					std::string timestr = ServerInstance->TimeString(kl->expiry);
+					ServerInstance->SNO->WriteGlobalSno('x',"K:line added due to DNSBL match on *@%s to expire on %s: %s",
+						them->GetIPString().c_str(), timestr.c_str(), reason.c_str());
+					ServerInstance->XLines->ApplyLines();
 				}
-				case DNSBLConfEntry::I_GLINE:
+				else
+					delete kl;
+				break;
+			}
+			case DNSBLConfEntry::I_GLINE:
+			{
+				GLine* gl = new GLine(ServerInstance->Time(), ConfEntry->duration, ServerInstance->Config->ServerName.c_str(), reason.c_str(),
+						"*", them->GetIPString());
+				if (ServerInstance->XLines->AddLine(gl,NULL))
 				{
-					GLine* gl = new GLine(ServerInstance->Time(), ConfEntry->duration, ServerInstance->Config->ServerName.c_str(), reason.c_str(),
-							"*", them->GetIPString());
-					if (ServerInstance->XLines->AddLine(gl,NULL))
-					{
-						std::string timestr = ServerInstance->TimeString(gl->expiry);
-						ServerInstance->SNO->WriteGlobalSno('x',"G:line added due to DNSBL match on *@%s to expire on %s: %s",
-							them->GetIPString().c_str(), timestr.c_str(), reason.c_str());
-						ServerInstance->XLines->ApplyLines();
-					}
-					else
-						delete gl;
-					break;
+					std::string timestr = ServerInstance->TimeString(gl->expiry);
+					ServerInstance->SNO->WriteGlobalSno('x',"G:line added due to DNSBL match on *@%s to expire on %s: %s",
+						them->GetIPString().c_str(), timestr.c_str(), reason.c_str());
+					ServerInstance->XLines->ApplyLines();
 				}
-				case DNSBLConfEntry::I_ZLINE:
+				else
+					delete gl;
+				break;
+			}
+			case DNSBLConfEntry::I_ZLINE:
+			{
+				ZLine* zl = new ZLine(ServerInstance->Time(), ConfEntry->duration, ServerInstance->Config->ServerName.c_str(), reason.c_str(),
+						them->GetIPString());
+				if (ServerInstance->XLines->AddLine(zl,NULL))
 				{
-					ZLine* zl = new ZLine(ServerInstance->Time(), ConfEntry->duration, ServerInstance->Config->ServerName.c_str(), reason.c_str(),
-							them->GetIPString());
-					if (ServerInstance->XLines->AddLine(zl,NULL))
-					{
-						std::string timestr = ServerInstance->TimeString(zl->expiry);
-						ServerInstance->SNO->WriteGlobalSno('x',"Z:line added due to DNSBL match on *@%s to expire on %s: %s",
-							them->GetIPString().c_str(), timestr.c_str(), reason.c_str());
-						ServerInstance->XLines->ApplyLines();
-					}
-					else
-						delete zl;
-					break;
+					std::string timestr = ServerInstance->TimeString(zl->expiry);
+					ServerInstance->SNO->WriteGlobalSno('x',"Z:line added due to DNSBL match on *@%s to expire on %s: %s",
+						them->GetIPString().c_str(), timestr.c_str(), reason.c_str());
+					ServerInstance->XLines->ApplyLines();
 				}
-				case DNSBLConfEntry::I_UNKNOWN:
-				default:
-					break;
+				else
+					delete zl;
+				break;
 			}
+			case DNSBLConfEntry::I_UNKNOWN:
+			default:
+				break;
+		}
+
+		ServerInstance->SNO->WriteGlobalSno('a', "Connecting user %s%s detected as being on a DNS blacklist (%s) with result %d", them->nick.empty() ? "<unknown>" : "", them->GetFullRealHost().c_str(), (ConfEntry->domain.empty() ? ConfEntry->file.c_str() : ConfEntry->domain.c_str()), (ConfEntry->type==DNSBLConfEntry::A_BITMASK) ? bitmask : record);
+	}
+	else
+		ConfEntry->stats_misses++;
+}
+
+/** Resolver for DNSBL lookups of an IP, shared by all users connecting from that IP while it runs
+ */
+class DNSBLResolver : public DNS::Request
+{
+	const std::string theirip;
+	LocalStringExt& nameExt;
+	LocalIntExt& countExt;
+	reference<DNSBLConfEntry> ConfEntry;
+
+	/** Hand the result to the users waiting for it. Calling this again does nothing,
+	 * every waiter is released once.
+	 * @param known False if the lookup failed and there is no result to act on
+	 */
+	void Finish(unsigned long result, bool known)
+	{
+		/* New users from this IP should not wait on a lookup which has finished */
+		std::map<std::string, DNSBLResolver*>::iterator lookup = ConfEntry->lookups.find(theirip);
+		if (lookup != ConfEntry->lookups.end() && lookup->second == this)
+			ConfEntry->lookups.erase(lookup);
+
+		std::vector<std::string> finished;
+		finished.swap(waiters);
+		for (std::vector<std::string>::const_iterator i = finished.begin(); i != finished.end(); ++i)
+		{
+			/* Check the user still exists */
+			LocalUser* them = (LocalUser*)ServerInstance->FindUUID(*i);
+			if (!them)
+				continue;
+
+			int count = countExt.get(them);
+			if (count)
+				countExt.set(them, count - 1);
 
-			ServerInstance->SNO->WriteGlobalSno('a', "Connecting user %s%s detected as being on a DNS blacklist (%s) with result %d", them->nick.empty() ? "<unknown>" : "", them->GetFullRealHost().c_str(), ConfEntry->domain.c_str(), (ConfEntry->type==DNSBLConfEntry::A_BITMASK) ? bitmask : record);
+			if (known)
+				ApplyResult(them, ConfEntry, nameExt, result);
 		}
-		else
-			ConfEntry->stats_misses++;
 	}
 
-	void OnError(const DNS::Query *q) CXX11_OVERRIDE
+ public:
+	/* UUIDs of the users waiting for the result */
+	std::vector<std::string> waiters;
+
+	DNSBLResolver(DNS::Manager *mgr, Module *me, LocalStringExt& match, LocalIntExt& ctr, const std::string &hostname, const std::string& ip, reference<DNSBLConfEntry> conf)
+		: DNS::Request(mgr, me, hostname, DNS::QUERY_A, true), theirip(ip), nameExt(match), countExt(ctr), ConfEntry(conf)
 	{
-		LocalUser* them = (LocalUser*)ServerInstance->FindUUID(theiruid);
-		if (!them)
-			return;
+	}
+
+	~DNSBLResolver()
+	{
+		std::map<std::string, DNSBLResolver*>::iterator i = ConfEntry->lookups.find(theirip);
+		if (i != ConfEntry->lookups.end() && i->second == this)
+			ConfEntry->lookups.erase(i);
+	}
 
-		int i = countExt.get(them);
-		if (i)
-			countExt.set(them, i - 1);
+	/* Called once per lookup with all A records of the answer, only the first one is used */
+	void OnLookupComplete(const DNS::Query *r) CXX11_OVERRIDE
+	{
+		const DNS::ResourceRecord &ans_record = r->answers[0];
+
+		in_addr resultip;
+		inet_aton(ans_record.rdata.c_str(), &resultip);
 
+		ConfEntry->SetVerdict(theirip, resultip.s_addr, ans_record.ttl);
+		Finish(resultip.s_addr, true);
+	}
+
+	void OnError(const DNS::Query *q) CXX11_OVERRIDE
+	{
 		if (q->error == DNS::ERROR_NO_RECORDS || q->error == DNS::ERROR_DOMAIN_NOT_FOUND)
-			ConfEntry->stats_misses++;
+		{
+			ConfEntry->SetVerdict(theirip, 0, ConfEntry->cachetime);
+			Finish(0, true);
+		}
+		else
+			Finish(0, false);
 	}
 };
 
@@ -226,6 +327,118 @@ class ModuleDNSBL : public Module
 
 		return DNSBLConfEntry::I_UNKNOWN;
 	}
+
+	/** Parse the A record of a zone file entry, either an IP or the last octet of 127.0.0.x
+	 */
+	static bool ParseZoneResult(const std::string& value, unsigned long& result)
+	{
+		if (value.empty())
+			return true;
+
+		irc::sockets::sockaddrs sa;
+		if (value.find_first_not_of("0123456789") == std::string::npos)
+		{
+			unsigned int octet = ConvToInt(value);
+			if (octet > 255)
+				return false;
+			result = htonl(0x7F000000 | octet);
+		}
+		else if (irc::sockets::aptosa(value, 0, sa) && sa.sa.sa_family == AF_INET)
+			result = sa.in4.sin_addr.s_addr;
+		else
+			return false;
+		return true;
+	}
+
+	/** Parse the address of a zone file entry. Besides a plain IP or CIDR range this
+	 * can be an abbreviated range, where 10.1 means 10.1.0.0/16.
+	 */
+	static bool ParseZoneAddress(const std::string& address, irc::sockets::cidr_mask& mask)
+	{
+		std::string ip = address;
+		int length = 32;
+
+		std::string::size_type slash = ip.find('/');
+		if (slash != std::string::npos)
+		{
+			length = ConvToInt(ip.substr(slash + 1));
+			ip.erase(slash);
+		}
+		else
+		{
+			size_t dots = std::count(ip.begin(), ip.end(), '.');
+			for (length = (dots + 1) * 8; dots < 3; dots++)
+				ip.append(".0");
+		}
+
+		irc::sockets::sockaddrs sa;
+		if (length < 0 || length > 32 || !irc::sockets::aptosa(ip, 0, sa) || sa.sa.sa_family != AF_INET)
+			return false;
+
+		mask = irc::sockets::cidr_mask(sa, length);
+		return true;
+	}
+
+	/** Load an rbldnsd ip4set style zone file so the entry can be checked without DNS lookups
+	 */
+	static void ReadZone(DNSBLConfEntry* e, const std::string& location)
+	{
+		FileReader reader(e->file);
+		const std::vector<std::string>& lines = reader.GetVector();
+
+		/* Entries without an A record of their own are listed with 127.0.0.2, or with the one set by a ':' line */
+		unsigned long defresult = htonl(0x7F000002);
+		unsigned long invalid = 0;
+
+		for (std::vector<std::string>::const_iterator i = lines.begin(); i != lines.end(); ++i)
+		{
+			irc::spacesepstream tokens(*i);
+			std::string entry;
+			if (!tokens.GetToken(entry) || entry[0] == '#' || entry[0] == ';' || entry[0] == '$')
+				continue;
+
+			std::string value;
+			std::string::size_type colon = entry.find(':');
+			if (colon != std::string::npos)
+			{
+				value = entry.substr(colon + 1);
+				value.erase(std::min(value.find(':'), value.length()));
+				entry.erase(colon);
+			}
+			else if (tokens.GetToken(value) && value[0] == ':')
+			{
+				value.erase(0, 1);
+				value.erase(std::min(value.find(':'), value.length()));
+			}
+			else
+				value.clear();
+
+			if (entry.empty())
+			{
+				if (!ParseZoneResult(value, defresult))
+					invalid++;
+				continue;
+			}
+
+			bool exclude = (entry[0] == '!');
+			if (exclude)
+				entry.erase(0, 1);
+
+			unsigned long result = defresult;
+			irc::sockets::cidr_mask mask;
+			if (!ParseZoneAddress(entry, mask) || !ParseZoneResult(value, result))
+			{
+				invalid++;
+				continue;
+			}
+
+			e->zone[mask] = exclude ? 0 : result;
+		}
+
+		if (invalid)
+			ServerInstance->SNO->WriteGlobalSno('a', "DNSBL(%s): skipped %lu invalid lines in %s", location.c_str(), invalid, e->file.c_str());
+	}
+
  public:
 	ModuleDNSBL() : DNS(this, "DNS"), nameExt("dnsbl_match", this), countExt("dnsbl_pending", this) { }
 
@@ -251,6 +464,8 @@ class ModuleDNSBL : public Module
 			e->host = tag->getString("host");
 			e->reason = tag->getString("reason");
 			e->domain = tag->getString("domain");
+			e->file = tag->getString("file");
+			e->cachetime = tag->getDuration("cachetime", 300, 0);
 
 			if (tag->getString("type") == "bitmask")
 			{
@@ -283,7 +498,7 @@ class ModuleDNSBL : public Module
 				std::string location = tag->getTagLocation();
 				ServerInstance->SNO->WriteGlobalSno('a', "DNSBL(%s): Invalid name", location.c_str());
 			}
-			else if (e->domain.empty())
+			else if (e->domain.empty() && e->file.empty())
 			{
 				std::string location = tag->getTagLocation();
 				ServerInstance->SNO->WriteGlobalSno('a', "DNSBL(%s): Invalid domain", location.c_str());
@@ -302,6 +517,20 @@ class ModuleDNSBL : public Module
 					e->reason = "Your IP has been blacklisted.";
 				}
 
+				if (!e->file.empty())
+				{
+					try
+					{
+						ReadZone(e, tag->getTagLocation());
+					}
+					catch (CoreException& ex)
+					{
+						std::string location = tag->getTagLocation();
+						ServerInstance->SNO->WriteGlobalSno('a', "DNSBL(%s): %s", location.c_str(), ex.GetReason());
+						continue;
+					}
+				}
+
 				/* add it, all is ok */
 				DNSBLConfEntries.push_back(e);
 			}
@@ -328,25 +557,52 @@ class ModuleDNSBL : public Module
 		a = (unsigned int) user->client_sa.in4.sin_addr.s_addr & 0xFF;
 
 		const std::string reversedip = ConvToStr(d) + "." + ConvToStr(c) + "." + ConvToStr(b) + "." + ConvToStr(a);
-
-		countExt.set(user, DNSBLConfEntries.size());
+		const std::string& ip = user->GetIPString();
 
 		// For each DNSBL, we will run through this lookup
 		for (unsigned i = 0; i < DNSBLConfEntries.size(); ++i)
 		{
-			// Fill hostname with a dnsbl style host (d.c.b.a.domain.tld)
-			std::string hostname = reversedip + "." + DNSBLConfEntries[i]->domain;
+			DNSBLConfEntry* e = DNSBLConfEntries[i];
+			unsigned long result;
 
-			/* now we'd need to fire off lookups for `hostname'. */
-			DNSBLResolver *r = new DNSBLResolver(*this->DNS, this, nameExt, countExt, hostname, user, DNSBLConfEntries[i]);
-			try
+			if (!e->file.empty())
 			{
-				this->DNS->Process(r);
+				ApplyResult(user, e, nameExt, e->LookupZone(user->client_sa));
 			}
-			catch (DNS::Exception &ex)
+			else if (e->GetVerdict(ip, result))
 			{
-				delete r;
-				ServerInstance->Logs->Log(MODNAME, LOG_DEBUG, std::string(ex.GetReason()));
+				e->stats_cached++;
+				ApplyResult(user, e, nameExt, result);
+			}
+			else
+			{
+				countExt.set(user, countExt.get(user) + 1);
+
+				/* Another user from this IP is being looked up already, wait for that */
+				std::map<std::string, DNSBLResolver*>::const_iterator lookup = e->lookups.find(ip);
+				if (lookup != e->lookups.end())
+				{
+					lookup->second->waiters.push_back(user->uuid);
+					continue;
+				}
+
+				// Fill hostname with a dnsbl style host (d.c.b.a.domain.tld)
+				std::string hostname = reversedip + "." + e->domain;
+
+				/* now we'd need to fire off lookups for `hostname'. */
+				DNSBLResolver *r = new DNSBLResolver(*this->DNS, this, nameExt, countExt, hostname, ip, DNSBLConfEntries[i]);
+				r->waiters.push_back(user->uuid);
+				e->lookups[ip] = r;
+				try
+				{
+					this->DNS->Process(r);
+				}
+				catch (DNS::Exception &ex)
+				{
+					delete r;
+					countExt.set(user, countExt.get(user) - 1);
+					ServerInstance->Logs->Log(MODNAME, LOG_DEBUG, std::string(ex.GetReason()));
+				}
 			}
 
 			if (user->quitting)
@@ -378,12 +634,13 @@ class ModuleDNSBL : public Module
 		if (symbol != 'd')
 			return MOD_RES_PASSTHRU;
 
-		unsigned long total_hits = 0, total_misses = 0;
+		unsigned long total_hits = 0, total_misses = 0, total_cached = 0;
 
 		for (std::vector<reference<DNSBLConfEntry> >::const_iterator i = DNSBLConfEntries.begin(); i != DNSBLConfEntries.end(); ++i)
 		{
 			total_hits += (*i)->stats_hits;
 			total_misses += (*i)->stats_misses;
+			total_cached += (*i)->stats_cached;
 
 			results.push_back(ServerInstance->Config->ServerName + " 304 " + user->nick + " :DNSBLSTATS DNSbl \"" + (*i)->name + "\" had " +
 					ConvToStr((*i)->stats_hits) + " hits and " + ConvToStr((*i)->stats_misses) + " misses");
@@ -391,6 +648,7 @@ class ModuleDNSBL : public Module
 
 		results.push_back(ServerInstance->Config->ServerName + " 304 " + user->nick + " :DNSBLSTATS Total hits: " + ConvToStr(total_hits));
 		results.push_back(ServerInstance->Config->ServerName + " 304 " + user->nick + " :DNSBLSTATS Total misses: " + ConvToStr(total_misses));
+		results.push_back(ServerInstance->Config->ServerName + " 304 " + user->nick + " :DNSBLSTATS Total answered from cache: " + ConvToStr(total_cached));
 
 		return MOD_RES_PASSTHRU;
 	}
@@ -157,16 +157,151 @@ class ImplFilter : public FilterResult
  public:
 	Regex* regex;
 
+	/** A substring which must appear in any text this filter matches, or empty if unknown. */
+	std::string literal;
+
 	ImplFilter(ModuleFilter* mymodule, const std::string &rea, FilterAction act, long glinetime, const std::string &pat, const std::string &flgs);
 };
 
 
+/** Finds every filter whose required substring appears in a piece of text with a
+ * single pass over the text. The substrings of all filters are compiled into an
+ * Aho-Corasick automaton which is rebuilt whenever the list of filters changes.
+ */
+class LiteralMatcher
+{
+	/** Maps each byte of input to a column of the transition table. Bytes which do not
+	 * appear in any of the substrings all share column 0.
+	 */
+	unsigned char columns[256];
+
+	/** The number of columns in each row of the transition table. */
+	unsigned int width;
+
+	/** The transition table, one row of width entries per state. */
+	std::vector<unsigned int> transitions;
+
+	/** The indices of the filters whose substring ends at each state. */
+	std::vector<std::vector<unsigned int> > outputs;
+
+ public:
+	LiteralMatcher()
+		: width(1)
+	{
+		memset(columns, 0, sizeof(columns));
+	}
+
+	/** Rebuilds the automaton from the substrings of a list of filters.
+	 * @param filters The filters to build the automaton from.
+	 */
+	void Build(const std::vector<ImplFilter>& filters)
+	{
+		memset(columns, 0, sizeof(columns));
+		width = 1;
+		for (std::vector<ImplFilter>::const_iterator i = filters.begin(); i != filters.end(); ++i)
+		{
+			for (std::string::const_iterator c = i->literal.begin(); c != i->literal.end(); ++c)
+			{
+				unsigned char chr = national_case_insensitive_map[static_cast<unsigned char>(*c)];
+				if (!columns[chr])
+					columns[chr] = width++;
+			}
+		}
+
+		// Build the trie with 0 in unused transitions; state 0 is the root.
+		transitions.assign(width, 0);
+		outputs.assign(1, std::vector<unsigned int>());
+		for (unsigned int index = 0; index < filters.size(); ++index)
+		{
+			const std::string& literal = filters[index].literal;
+			if (literal.empty())
+				continue;
+
+			unsigned int state = 0;
+			for (std::string::const_iterator c = literal.begin(); c != literal.end(); ++c)
+			{
+				unsigned int column = columns[national_case_insensitive_map[static_cast<unsigned char>(*c)]];
+				if (!transitions[state * width + column])
+				{
+					transitions[state * width + column] = outputs.size();
+					transitions.resize(transitions.size() + width, 0);
+					outputs.push_back(std::vector<unsigned int>());
+				}
+				state = transitions[state * width + column];
+			}
+			outputs[state].push_back(index);
+		}
+
+		// Turn the trie into a DFA by filling in the missing transitions from the
+		// failure link of each state, visiting states in breadth first order.
+		std::vector<unsigned int> failure(outputs.size(), 0);
+		std::vector<unsigned int> queue;
+		for (unsigned int column = 0; column < width; ++column)
+		{
+			if (transitions[column])
+				queue.push_back(transitions[column]);
+		}
+
+		for (std::vector<unsigned int>::size_type pos = 0; pos < queue.size(); ++pos)
+		{
+			unsigned int state = queue[pos];
+			const std::vector<unsigned int>& inherited = outputs[failure[state]];
+			outputs[state].insert(outputs[state].end(), inherited.begin(), inherited.end());
+
+			for (unsigned int column = 0; column < width; ++column)
+			{
+				unsigned int& next = transitions[state * width + column];
+				unsigned int fallback = transitions[failure[state] * width + column];
+				if (next)
+				{
+					failure[next] = fallback;
+					queue.push_back(next);
+				}
+				else
+				{
+					next = fallback;
+				}
+			}
+		}
+	}
+
+	/** Marks every filter whose substring appears in the given text.
+	 * @param text The text to search.
+	 * @param marks The vector to mark the matching filters in.
+	 * @param mark The value to store for the filters which were found.
+	 */
+	void Search(const std::string& text, std::vector<unsigned long>& marks, unsigned long mark) const
+	{
+		unsigned int state = 0;
+		for (std::string::const_iterator c = text.begin(); c != text.end(); ++c)
+		{
+			state = transitions[state * width + columns[national_case_insensitive_map[static_cast<unsigned char>(*c)]]];
+			const std::vector<unsigned int>& found = outputs[state];
+			for (std::vector<unsigned int>::const_iterator i = found.begin(); i != found.end(); ++i)
+				marks[*i] = mark;
+		}
+	}
+};
+
 class ModuleFilter : public Module
 {
 	bool initing;
 	RegexFactory* factory;
 	void FreeFilters();
 
+	/** Finds the filters which could match a piece of text. */
+	LiteralMatcher matcher;
+
+	/** Whether the filter list has changed since the matcher was last built. */
+	bool matcher_dirty;
+
+	/** For each filter, the search in which its substring was last found in the text and in the colour stripped text. */
+	std::vector<unsigned long> text_marks;
+	std::vector<unsigned long> stripped_marks;
+
+	/** Incremented for every search so that the marks do not need to be cleared. */
+	unsigned long search_id;
+
  public:
 	CommandFilter filtcommand;
 	dynamic_reference<RegexFactory> RegexEngine;
@@ -293,7 +428,7 @@ bool ModuleFilter::AppliesToMe(User* user, FilterResult* filter, int iflags)
 }
 
 ModuleFilter::ModuleFilter()
-	: initing(true), filtcommand(this), RegexEngine(this, "regex")
+	: initing(true), matcher_dirty(true), search_id(0), filtcommand(this), RegexEngine(this, "regex")
 {
 }
 
@@ -309,12 +444,13 @@ void ModuleFilter::FreeFilters()
 		delete i->regex;
 
 	filters.clear();
+	matcher_dirty = true;
 }
 
 ModResult ModuleFilter::OnUserPreMessage(User* user, void* dest, int target_type, std::string& text, char status, CUList& exempt_list, MessageType msgtype)
 {
 	/* Leave ulines alone */
-	if ((ServerInstance->ULine(user->server)) || (!IS_LOCAL(user)))
+	if ((ServerInstance->ULine(user->server->GetName())) || (!IS_LOCAL(user)))
 		return MOD_RES_PASSTHRU;
 
 	flags = (msgtype == MSG_PRIVMSG) ? FLAG_PRIVMSG : FLAG_NOTICE;
@@ -562,6 +698,7 @@ ImplFilter::ImplFilter(ModuleFilter* mymodule, const std::string &rea, FilterAct
 	if (!mymodule->RegexEngine)
 		throw ModuleException("Regex module implementing '"+mymodule->RegexEngine.GetProvider()+"' is not loaded!");
 	regex = mymodule->RegexEngine->Create(pat);
+	regex->GetRequiredLiteral(literal);
 }
 
 FilterResult* ModuleFilter::FilterMatch(User* user, const std::string &text, int flgs)
@@ -569,6 +706,21 @@ FilterResult* ModuleFilter::FilterMatch(User* user, const std::string &text, int
 	static std::string stripped_text;
 	stripped_text.clear();
 
+	if (matcher_dirty)
+	{
+		matcher.Build(filters);
+		text_marks.assign(filters.size(), 0);
+		stripped_marks.assign(filters.size(), 0);
+		search_id = 0;
+		matcher_dirty = false;
+	}
+
+	/* Find the filters whose required substring is in the text in one pass rather than
+	 * running every regex. Filters without a known substring are always checked.
+	 */
+	const unsigned long mark = ++search_id;
+	matcher.Search(text, text_marks, mark);
+
 	for (std::vector<ImplFilter>::iterator index = filters.begin(); index != filters.end(); index++)
 	{
 		FilterResult* filter = dynamic_cast<FilterResult*>(&(*index));
@@ -581,6 +733,14 @@ FilterResult* ModuleFilter::FilterMatch(User* user, const std::string &text, int
 		{
 			stripped_text = text;
 			InspIRCd::StripColor(stripped_text);
+			matcher.Search(stripped_text, stripped_marks, mark);
+		}
+
+		if (!index->literal.empty())
+		{
+			const std::vector<unsigned long>& marks = filter->flag_strip_color ? stripped_marks : text_marks;
+			if (marks[index - filters.begin()] != mark)
+				continue;
 		}
 
 		if (index->regex->Matches(filter->flag_strip_color ? stripped_text : text))
@@ -597,6 +757,7 @@ bool ModuleFilter::DeleteFilter(const std::string &freeform)
 		{
 			delete i->regex;
 			filters.erase(i);
+			matcher_dirty = true;
 			return true;
 		}
 	}
@@ -616,6 +777,7 @@ std::pair<bool, std::string> ModuleFilter::AddFilter(const std::string &freeform
 	try
 	{
 		filters.push_back(ImplFilter(this, reason, type, duration, freeform, flgs));
+		matcher_dirty = true;
 	}
 	catch (ModuleException &e)
 	{
@@ -679,6 +841,7 @@ void ModuleFilter::ReadFilters()
 		try
 		{
 			filters.push_back(ImplFilter(this, reason, fa, gline_time, pattern, flgs));
+			matcher_dirty = true;
 			ServerInstance->Logs->Log(MODNAME, LOG_DEFAULT, "Regular expression %s loaded.", pattern.c_str());
 		}
 		catch (ModuleException &e)
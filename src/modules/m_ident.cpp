@@ -77,6 +77,12 @@
  *  O   In the event that the ident socket throws a ModuleException,
  *      nothing is done. This is counted as total and complete
  *      failure to create a connection.
+ *
+ *  O   Lookups start as soon as the connection is accepted, in
+ *      OnUserInit, so they run while the client sends NICK and USER.
+ *      Hosts whose lookups time out can be remembered for a while
+ *      (<ident:failcache>) so their next connections skip the lookup
+ *      instead of waiting for the timeout again.
  * --------------------------------------------------------------
  */
 
@@ -86,11 +92,14 @@ class IdentRequestSocket : public EventHandler
 	LocalUser *user;			/* User we are attached to */
 	std::string result;		/* Holds the ident string if done */
 	time_t age;
+	long age_ns;
+	unsigned long elapsed;		/* Milliseconds the lookup took, once done */
 	bool done;			/* True if lookup is finished */
 
-	IdentRequestSocket(LocalUser* u) : user(u)
+	IdentRequestSocket(LocalUser* u) : user(u), elapsed(0)
 	{
 		age = ServerInstance->Time();
+		age_ns = ServerInstance->Time_ns();
 
 		SetFd(socket(user->server_sa.sa.sa_family, SOCK_STREAM, 0));
 
@@ -160,7 +169,13 @@ class IdentRequestSocket : public EventHandler
 		 * might as well give up if this happens!
 		 */
 		if (ServerInstance->SE->Send(this, req, req_size, 0) < req_size)
-			done = true;
+			Finish();
+	}
+
+	void Finish()
+	{
+		done = true;
+		elapsed = (ServerInstance->Time() - age) * 1000 + (ServerInstance->Time_ns() - age_ns) / 1000000;
 	}
 
 	void HandleEvent(EventType et, int errornum = 0)
@@ -182,7 +197,7 @@ class IdentRequestSocket : public EventHandler
 				 * huge storm of EVENT_ERROR events!
 				 */
 				Close();
-				done = true;
+				Finish();
 			break;
 		}
 	}
@@ -218,7 +233,7 @@ class IdentRequestSocket : public EventHandler
 		 * and flag as done since the ident lookup has finished
 		 */
 		Close();
-		done = true;
+		Finish();
 
 		/* Cant possibly be a valid response shorter than 3 chars,
 		 * because the shortest possible response would look like: '1,1'
@@ -267,12 +282,87 @@ class IdentRequestSocket : public EventHandler
 	}
 };
 
+/* Upper bounds in milliseconds of the ident latency histogram buckets, the last bucket holds anything slower */
+static const unsigned long LatencyBounds[] = { 50, 100, 250, 500, 1000, 2500, 5000 };
+static const size_t LatencyBuckets = sizeof(LatencyBounds) / sizeof(LatencyBounds[0]) + 1;
+
+/* Ident lookup latencies of the users in one connect class */
+struct IdentLatency
+{
+	unsigned long buckets[LatencyBuckets];
+	unsigned long timeouts;
+	unsigned long skipped;
+
+	IdentLatency() : timeouts(0), skipped(0)
+	{
+		memset(buckets, 0, sizeof(buckets));
+	}
+
+	void Add(unsigned long ms)
+	{
+		size_t i = 0;
+		while (i < LatencyBuckets - 1 && ms >= LatencyBounds[i])
+			i++;
+		buckets[i]++;
+	}
+};
+
 class ModuleIdent : public Module
 {
 	int RequestTimeout;
+	time_t FailCacheTime;
 	SimpleExtItem<IdentRequestSocket> ext;
+	LocalIntExt skipped;
+
+	/* IPs whose last ident lookup timed out, mapped to when to look them up again */
+	TR1NS::unordered_map<std::string, time_t> unresponsive;
+	time_t nextpurge;
+
+	/* Ident lookup latencies by connect class name */
+	std::map<std::string, IdentLatency> latency;
+
+	IdentLatency& GetLatency(LocalUser* user)
+	{
+		return latency[user->MyClass ? user->MyClass->GetName() : "<none>"];
+	}
+
+	bool IsUnresponsive(const std::string& ip)
+	{
+		TR1NS::unordered_map<std::string, time_t>::iterator i = unresponsive.find(ip);
+		if (i == unresponsive.end())
+			return false;
+
+		if (i->second <= ServerInstance->Time())
+		{
+			unresponsive.erase(i);
+			return false;
+		}
+		return true;
+	}
+
+	void SetUnresponsive(const std::string& ip)
+	{
+		if (!FailCacheTime)
+			return;
+
+		time_t now = ServerInstance->Time();
+		if (now >= nextpurge)
+		{
+			for (TR1NS::unordered_map<std::string, time_t>::iterator i = unresponsive.begin(); i != unresponsive.end(); )
+			{
+				if (i->second <= now)
+					i = unresponsive.erase(i);
+				else
+					++i;
+			}
+			nextpurge = now + FailCacheTime;
+		}
+
+		unresponsive[ip] = now + FailCacheTime;
+	}
+
  public:
-	ModuleIdent() : ext("ident_socket", this)
+	ModuleIdent() : ext("ident_socket", this), skipped("ident_skipped", this), nextpurge(0)
 	{
 	}
 
@@ -283,9 +373,13 @@ class ModuleIdent : public Module
 
 	void ReadConfig(ConfigStatus& status) CXX11_OVERRIDE
 	{
-		RequestTimeout = ServerInstance->Config->ConfValue("ident")->getInt("timeout", 5);
+		ConfigTag* tag = ServerInstance->Config->ConfValue("ident");
+		RequestTimeout = tag->getInt("timeout", 5);
 		if (!RequestTimeout)
 			RequestTimeout = 5;
+		FailCacheTime = tag->getDuration("failcache", 0);
+		if (!FailCacheTime)
+			unresponsive.clear();
 	}
 
 	void OnUserInit(LocalUser *user) CXX11_OVERRIDE
@@ -294,6 +388,13 @@ class ModuleIdent : public Module
 		if (!tag->getBool("useident", true))
 			return;
 
+		if (IsUnresponsive(user->GetIPString()))
+		{
+			user->WriteNotice("*** Skipping ident lookup, your host did not answer one recently.");
+			skipped.set(user, 1);
+			return;
+		}
+
 		user->WriteNotice("*** Looking up your ident...");
 
 		try
@@ -316,18 +417,33 @@ class ModuleIdent : public Module
 		/* Does user have an ident socket attached at all? */
 		IdentRequestSocket *isock = ext.get(user);
 		if (!isock)
+		{
+			if (skipped.get(user))
+			{
+				GetLatency(user).skipped++;
+				user->ident.insert(0, 1, '~');
+				user->InvalidateCache();
+				skipped.set(user, 0);
+			}
 			return MOD_RES_PASSTHRU;
+		}
 
 		time_t compare = isock->age;
 		compare += RequestTimeout;
 
 		/* Check for timeout of the socket */
-		if (ServerInstance->Time() >= compare)
+		if (isock->HasResult())
+		{
+			GetLatency(user).Add(isock->elapsed);
+		}
+		else if (ServerInstance->Time() >= compare)
 		{
 			/* Ident timeout */
 			user->WriteNotice("*** Ident request timed out.");
+			GetLatency(user).timeouts++;
+			SetUnresponsive(user->GetIPString());
 		}
-		else if (!isock->HasResult())
+		else
 		{
 			// time still good, no result yet... hold the registration
 			return MOD_RES_DENY;
@@ -358,6 +474,24 @@ class ModuleIdent : public Module
 		return MOD_RES_PASSTHRU;
 	}
 
+	ModResult OnStats(char symbol, User* user, string_list &results) CXX11_OVERRIDE
+	{
+		if (symbol != 'I')
+			return MOD_RES_PASSTHRU;
+
+		for (std::map<std::string, IdentLatency>::const_iterator i = latency.begin(); i != latency.end(); ++i)
+		{
+			const IdentLatency& stats = i->second;
+			std::string line = ServerInstance->Config->ServerName + " 304 " + user->nick + " :IDENTSTATS class " + i->first + ":";
+			for (size_t j = 0; j < LatencyBuckets - 1; ++j)
+				line.append(" <" + ConvToStr(LatencyBounds[j]) + "ms=" + ConvToStr(stats.buckets[j]));
+			line.append(" slower=" + ConvToStr(stats.buckets[LatencyBuckets - 1]) + " timedout=" + ConvToStr(stats.timeouts) + " skipped=" + ConvToStr(stats.skipped));
+			results.push_back(line);
+		}
+
+		return MOD_RES_PASSTHRU;
+	}
+
 	void OnCleanup(int target_type, void *item) CXX11_OVERRIDE
 	{
 		/* Module unloading, tidy up users */
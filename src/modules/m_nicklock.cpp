@@ -80,7 +80,7 @@ class CommandNicklock : public Command
 	{
 		User* dest = ServerInstance->FindNick(parameters[0]);
 		if (dest)
-			return ROUTE_OPT_UCAST(dest->server);
+			return ROUTE_OPT_UCAST(dest->server->GetName());
 		return ROUTE_LOCALONLY;
 	}
 };
@@ -132,7 +132,7 @@ class CommandNickunlock : public Command
 	{
 		User* dest = ServerInstance->FindNick(parameters[0]);
 		if (dest)
-			return ROUTE_OPT_UCAST(dest->server);
+			return ROUTE_OPT_UCAST(dest->server->GetName());
 		return ROUTE_LOCALONLY;
 	}
 };
@@ -32,6 +32,32 @@ public:
 	{
 		return InspIRCd::Match(text, this->regex_string);
 	}
+
+	bool GetRequiredLiteral(std::string& literal) CXX11_OVERRIDE
+	{
+		// Every run of characters between wildcards has to appear in the text.
+		std::string::size_type best = 0;
+		std::string::size_type bestlen = 0;
+		std::string::size_type start = 0;
+		while (start < regex_string.length())
+		{
+			std::string::size_type end = regex_string.find_first_of("*?", start);
+			if (end == std::string::npos)
+				end = regex_string.length();
+			if (end - start > bestlen)
+			{
+				best = start;
+				bestlen = end - start;
+			}
+			start = end + 1;
+		}
+
+		if (!bestlen)
+			return false;
+
+		literal.assign(regex_string, best, bestlen);
+		return true;
+	}
 };
 
 class GlobFactory : public RegexFactory
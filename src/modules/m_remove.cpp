@@ -81,7 +81,7 @@ class RemoveBase : public Command
 		int ulevel = channel->GetPrefixValue(user);
 		int tlevel = channel->GetPrefixValue(target);
 
-		if (ServerInstance->ULine(target->server))
+		if (ServerInstance->ULine(target->server->GetName()))
 		{
 			user->WriteNumeric(482, "%s :Only a u-line may remove a u-line from a channel.", channame.c_str());
 			return CMD_FAILURE;
@@ -156,7 +156,7 @@ class CommandRemove : public RemoveBase
 	{
 		User* dest = ServerInstance->FindNick(parameters[0]);
 		if (dest)
-			return ROUTE_OPT_UCAST(dest->server);
+			return ROUTE_OPT_UCAST(dest->server->GetName());
 		return ROUTE_LOCALONLY;
 	}
 };
@@ -182,7 +182,7 @@ class CommandFpart : public RemoveBase
 	{
 		User* dest = ServerInstance->FindNick(parameters[1]);
 		if (dest)
-			return ROUTE_OPT_UCAST(dest->server);
+			return ROUTE_OPT_UCAST(dest->server->GetName());
 		return ROUTE_LOCALONLY;
 	}
 };
@@ -38,7 +38,7 @@ class CommandSajoin : public Command
 		User* dest = ServerInstance->FindNick(parameters[0]);
 		if ((dest) && (dest->registered == REG_ALL))
 		{
-			if (ServerInstance->ULine(dest->server))
+			if (ServerInstance->ULine(dest->server->GetName()))
 			{
 				user->WriteNumeric(ERR_NOPRIVILEGES, ":Cannot use an SA command on a u-lined client");
 				return CMD_FAILURE;
@@ -94,7 +94,7 @@ class CommandSajoin : public Command
 	{
 		User* dest = ServerInstance->FindNick(parameters[0]);
 		if (dest)
-			return ROUTE_OPT_UCAST(dest->server);
+			return ROUTE_OPT_UCAST(dest->server->GetName());
 		return ROUTE_LOCALONLY;
 	}
 };
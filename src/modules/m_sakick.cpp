@@ -48,7 +48,7 @@ class CommandSakick : public Command
 				reason = dest->nick.c_str();
 			}
 
-			if (ServerInstance->ULine(dest->server))
+			if (ServerInstance->ULine(dest->server->GetName()))
 			{
 				user->WriteNumeric(ERR_NOPRIVILEGES, ":Cannot use an SA command on a u-lined client");
 				return CMD_FAILURE;
@@ -91,7 +91,7 @@ class CommandSakick : public Command
 	{
 		User* dest = ServerInstance->FindNick(parameters[1]);
 		if (dest)
-			return ROUTE_OPT_UCAST(dest->server);
+			return ROUTE_OPT_UCAST(dest->server->GetName());
 		return ROUTE_LOCALONLY;
 	}
 };
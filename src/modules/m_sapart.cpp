@@ -43,7 +43,7 @@ class CommandSapart : public Command
 			if (parameters.size() > 2)
 				reason = parameters[2];
 
-			if (ServerInstance->ULine(dest->server))
+			if (ServerInstance->ULine(dest->server->GetName()))
 			{
 				user->WriteNumeric(ERR_NOPRIVILEGES, ":Cannot use an SA command on a u-lined client");
 				return CMD_FAILURE;
@@ -92,7 +92,7 @@ class CommandSapart : public Command
 	{
 		User* dest = ServerInstance->FindNick(parameters[0]);
 		if (dest)
-			return ROUTE_OPT_UCAST(dest->server);
+			return ROUTE_OPT_UCAST(dest->server->GetName());
 		return ROUTE_LOCALONLY;
 	}
 };
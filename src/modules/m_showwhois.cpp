@@ -110,7 +110,7 @@ class ModuleShowwhois : public Module
 		else
 		{
 			std::vector<std::string> params;
-			params.push_back(dest->server);
+			params.push_back(dest->server->GetName());
 			params.push_back("WHOISNOTICE");
 			params.push_back(dest->uuid);
 			params.push_back(source->uuid);
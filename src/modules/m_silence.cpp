@@ -76,7 +76,7 @@ class CommandSVSSilence : public Command
 		 * style command so services can modify lots of entries at once.
 		 * leaving it backwards compatible for now as it's late. -- w
 		 */
-		if (!ServerInstance->ULine(user->server))
+		if (!ServerInstance->ULine(user->server->GetName()))
 			return CMD_FAILURE;
 
 		User *u = ServerInstance->FindNick(parameters[0]);
@@ -95,7 +95,7 @@ class CommandSVSSilence : public Command
 	{
 		User* target = ServerInstance->FindNick(parameters[0]);
 		if (target)
-			return ROUTE_OPT_UCAST(target->server);
+			return ROUTE_OPT_UCAST(target->server->GetName());
 		return ROUTE_LOCALONLY;
 	}
 };
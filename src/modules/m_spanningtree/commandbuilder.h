@@ -135,6 +135,6 @@ class CmdBuilder
 
 	bool Unicast(User* target) const
 	{
-		return Unicast(target->server);
+		return Utils->DoOneToOne(*this, target->server);
 	}
 };
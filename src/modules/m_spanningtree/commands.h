@@ -129,7 +129,7 @@ class CommandFJoin : public ServerCommand
 	 */
 	static void RemoveStatus(Channel* c);
 	static void ApplyModeStack(User* srcuser, Channel* c, irc::modestacker& stack);
-	bool ProcessModeUUIDPair(const std::string& item, TreeSocket* src_socket, Channel* chan, irc::modestacker* modestack);
+	bool ProcessModeUUIDPair(const std::string& item, TreeSocket* src_socket, Channel* chan, irc::modestacker* modestack, std::vector<User*>& joining);
  public:
 	CommandFJoin(Module* Creator) : ServerCommand(Creator, "FJOIN", 3) { }
 	CmdResult Handle(User* user, std::vector<std::string>& params);
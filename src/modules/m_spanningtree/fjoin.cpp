@@ -73,7 +73,7 @@ CmdResult CommandFJoin::Handle(User* srcuser, std::vector<std::string>& params)
 	if (!TS)
 	{
 		ServerInstance->Logs->Log(MODNAME, LOG_DEFAULT, "*** BUG? *** TS of 0 sent to FJOIN. Are some services authors smoking craq, or is it 1970 again?. Dropped.");
-		ServerInstance->SNO->WriteToSnoMask('d', "WARNING: The server %s is sending FJOIN with a TS of zero. Total craq. Command was dropped.", srcuser->server.c_str());
+		ServerInstance->SNO->WriteToSnoMask('d', "WARNING: The server %s is sending FJOIN with a TS of zero. Total craq. Command was dropped.", srcuser->server->GetName().c_str());
 		return CMD_INVALID;
 	}
 
@@ -157,17 +157,20 @@ CmdResult CommandFJoin::Handle(User* srcuser, std::vector<std::string>& params)
 	}
 
 	irc::modestacker modestack(true);
-	TreeSocket* src_socket = Utils->FindServer(srcuser->server)->GetSocket();
+	TreeServer* src_server = TreeServer::Get(srcuser);
+	TreeSocket* src_socket = src_server->GetSocket();
 
-	/* Now, process every 'modes,uuid' pair */
+	/* Now, process every 'modes,uuid' pair, then join all the users at once */
 	irc::tokenstream users(*params.rbegin());
 	std::string item;
 	irc::modestacker* modestackptr = (apply_other_sides_modes ? &modestack : NULL);
+	std::vector<User*> joining;
 	while (users.GetToken(item))
 	{
-		if (!ProcessModeUUIDPair(item, src_socket, chan, modestackptr))
+		if (!ProcessModeUUIDPair(item, src_socket, chan, modestackptr, joining))
 			return CMD_INVALID;
 	}
+	chan->ForceJoinMany(joining, src_server->GetRoute()->bursting);
 
 	/* Flush mode stacker if we lost the FJOIN or had equal TS */
 	if (apply_other_sides_modes)
@@ -176,7 +179,7 @@ CmdResult CommandFJoin::Handle(User* srcuser, std::vector<std::string>& params)
 	return CMD_SUCCESS;
 }
 
-bool CommandFJoin::ProcessModeUUIDPair(const std::string& item, TreeSocket* src_socket, Channel* chan, irc::modestacker* modestack)
+bool CommandFJoin::ProcessModeUUIDPair(const std::string& item, TreeSocket* src_socket, Channel* chan, irc::modestacker* modestack, std::vector<User*>& joining)
 {
 	std::string::size_type comma = item.find(',');
 
@@ -190,7 +193,7 @@ bool CommandFJoin::ProcessModeUUIDPair(const std::string& item, TreeSocket* src_
 	}
 
 	/* Check that the user's 'direction' is correct */
-	TreeServer* route_back_again = Utils->BestRouteTo(who->server);
+	TreeServer* route_back_again = TreeServer::Get(who)->GetRoute();
 	if ((!route_back_again) || (route_back_again->GetSocket() != src_socket))
 	{
 		return true;
@@ -214,7 +217,7 @@ bool CommandFJoin::ProcessModeUUIDPair(const std::string& item, TreeSocket* src_
 		}
 	}
 
-	chan->ForceJoin(who, NULL, route_back_again->bursting);
+	joining.push_back(who);
 	return true;
 }
 
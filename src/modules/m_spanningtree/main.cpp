@@ -58,6 +58,13 @@ void ModuleSpanningTree::init()
 
 	Utils = new SpanningTreeUtilities(this);
 	Utils->TreeRoot = new TreeServer;
+	ServerInstance->Modules->AddService(Utils->memberroutes);
+	ServerInstance->Modules->AddService(Utils->channelroutes);
+
+	// Our TreeServer replaces the Server object of the core while we are loaded
+	Server* localserver = ServerInstance->FakeClient->server;
+	SetLocalUsersServer(Utils->TreeRoot);
+	delete localserver;
 	commands = new SpanningTreeCommands(this);
 
 	delete ServerInstance->PI;
@@ -68,6 +75,13 @@ void ModuleSpanningTree::init()
 	Utils->TreeRoot->UserCount = ServerInstance->Users->local_users.size();
 }
 
+void ModuleSpanningTree::SetLocalUsersServer(Server* newserver)
+{
+	// Users who are quitting are not on the list of the old server and keep pointing at it
+	ServerInstance->FakeClient->server->MoveUsers(newserver);
+	ServerInstance->FakeClient->server = newserver;
+}
+
 void ModuleSpanningTree::ShowLinks(TreeServer* Current, User* user, int hops)
 {
 	std::string Parent = Utils->TreeRoot->GetName();
@@ -485,7 +499,10 @@ void ModuleSpanningTree::OnUserJoin(Membership* memb, bool sync, bool created_by
 {
 	// Only do this for local users
 	if (!IS_LOCAL(memb->user))
+	{
+		Utils->AddChannelRoute(memb);
 		return;
+	}
 
 	if (created_by_local)
 	{
@@ -509,6 +526,18 @@ void ModuleSpanningTree::OnUserJoin(Membership* memb, bool sync, bool created_by
 	}
 }
 
+void ModuleSpanningTree::OnUserJoinBatch(const std::vector<Membership*>& memberships, bool sync, std::vector<CUList>& except_lists)
+{
+	for (size_t i = 0; i < memberships.size(); ++i)
+	{
+		Membership* memb = memberships[i];
+		if (IS_LOCAL(memb->user))
+			OnUserJoin(memb, sync, false, except_lists[i]);
+		else
+			Utils->AddChannelRoute(memb);
+	}
+}
+
 void ModuleSpanningTree::OnChangeHost(User* user, const std::string &newhost)
 {
 	if (user->registered != REG_ALL || !IS_LOCAL(user))
@@ -535,6 +564,8 @@ void ModuleSpanningTree::OnChangeIdent(User* user, const std::string &ident)
 
 void ModuleSpanningTree::OnUserPart(Membership* memb, std::string &partmessage, CUList& excepts)
 {
+	Utils->DelChannelRoute(memb);
+
 	if (IS_LOCAL(memb->user))
 	{
 		CmdBuilder params(memb->user, "PART");
@@ -554,13 +585,19 @@ void ModuleSpanningTree::OnUserQuit(User* user, const std::string &reason, const
 
 		CmdBuilder(user, "QUIT").push_last(reason).Broadcast();
 	}
-
-	// Regardless, We need to modify the user Counts..
-	TreeServer* SourceServer = Utils->FindServer(user->server);
-	if (SourceServer)
+	else
 	{
-		SourceServer->UserCount--;
+		// The memberships go away without a part when the user is culled
+		for (UCListIter i = user->chans.begin(); i != user->chans.end(); ++i)
+		{
+			Membership* memb = (*i)->GetUser(user);
+			if (memb)
+				Utils->DelChannelRoute(memb);
+		}
 	}
+
+	// Regardless, We need to modify the user Counts..
+	TreeServer::Get(user)->UserCount--;
 }
 
 void ModuleSpanningTree::OnUserPostNick(User* user, const std::string &oldnick)
@@ -589,6 +626,8 @@ void ModuleSpanningTree::OnUserPostNick(User* user, const std::string &oldnick)
 
 void ModuleSpanningTree::OnUserKick(User* source, Membership* memb, const std::string &reason, CUList& excepts)
 {
+	Utils->DelChannelRoute(memb);
+
 	if ((!IS_LOCAL(source) || source != ServerInstance->FakeClient))
 		return;
 
@@ -599,6 +638,24 @@ void ModuleSpanningTree::OnUserKick(User* source, Membership* memb, const std::s
 	params.Broadcast();
 }
 
+void ModuleSpanningTree::OnMode(User* user, User* usertarget, Channel* chantarget, const std::vector<std::string>& modes, const std::vector<TranslateType>& translate)
+{
+	if (!chantarget)
+		return;
+
+	// Prefix mode changes move remote members between rank counts
+	for (unsigned int i = 1; i < modes.size(); i++)
+	{
+		if (translate[i] != TR_NICK)
+			continue;
+
+		User* target = ServerInstance->FindNick(modes[i]);
+		Membership* memb = target ? chantarget->GetUser(target) : NULL;
+		if (memb)
+			Utils->UpdateChannelRoute(memb);
+	}
+}
+
 void ModuleSpanningTree::OnPreRehash(User* user, const std::string &parameter)
 {
 	if (loopCall)
@@ -611,7 +668,7 @@ void ModuleSpanningTree::OnPreRehash(User* user, const std::string &parameter)
 	{
 		CmdBuilder params((user ? user->uuid : ServerInstance->Config->GetSID()), "REHASH");
 		params.push_back(parameter);
-		params.Forward(user ? Utils->BestRouteTo(user->server) : NULL);
+		params.Forward(user ? TreeServer::Get(user)->GetRoute() : NULL);
 	}
 }
 
@@ -730,6 +787,9 @@ ModuleSpanningTree::~ModuleSpanningTree()
 	delete ServerInstance->PI;
 	ServerInstance->PI = new ProtocolInterface;
 
+	if (Utils && Utils->TreeRoot)
+		SetLocalUsersServer(new Server(ServerInstance->Config->ServerName));
+
 	/* This will also free the listeners */
 	delete Utils;
 
@@ -130,6 +130,10 @@ class ModuleSpanningTree : public Module
 	 */
 	static std::string TimeToStr(time_t secs);
 
+	/** Move the local users and the server user to another Server object
+	 */
+	static void SetLocalUsersServer(Server* newserver);
+
 	/**
 	 ** *** MODULE EVENTS ***
 	 **/
@@ -143,6 +147,7 @@ class ModuleSpanningTree : public Module
 	void OnUserMessage(User* user, void* dest, int target_type, const std::string& text, char status, const CUList& exempt_list, MessageType msgtype) CXX11_OVERRIDE;
 	void OnBackgroundTimer(time_t curtime) CXX11_OVERRIDE;
 	void OnUserJoin(Membership* memb, bool sync, bool created, CUList& excepts) CXX11_OVERRIDE;
+	void OnUserJoinBatch(const std::vector<Membership*>& memberships, bool sync, std::vector<CUList>& except_lists) CXX11_OVERRIDE;
 	void OnChangeHost(User* user, const std::string &newhost) CXX11_OVERRIDE;
 	void OnChangeName(User* user, const std::string &gecos) CXX11_OVERRIDE;
 	void OnChangeIdent(User* user, const std::string &ident) CXX11_OVERRIDE;
@@ -150,6 +155,7 @@ class ModuleSpanningTree : public Module
 	void OnUserQuit(User* user, const std::string &reason, const std::string &oper_message) CXX11_OVERRIDE;
 	void OnUserPostNick(User* user, const std::string &oldnick) CXX11_OVERRIDE;
 	void OnUserKick(User* source, Membership* memb, const std::string &reason, CUList& excepts) CXX11_OVERRIDE;
+	void OnMode(User* user, User* usertarget, Channel* chantarget, const std::vector<std::string>& modes, const std::vector<TranslateType>& translate) CXX11_OVERRIDE;
 	void OnPreRehash(User* user, const std::string &parameter) CXX11_OVERRIDE;
 	void ReadConfig(ConfigStatus& status) CXX11_OVERRIDE;
 	void OnOper(User* user, const std::string &opertype) CXX11_OVERRIDE;
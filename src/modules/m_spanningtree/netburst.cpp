@@ -96,6 +96,54 @@ struct TreeSocket::BurstState
 	BurstState(TreeSocket* sock) : server(sock) { }
 };
 
+/** Sends the users and channels of a netburst a part at a time. The uuids of
+ * the users and the names of the channels are saved when the burst starts,
+ * users and channels which are gone by the time their turn comes are skipped.
+ * Anything created after the burst started is sent by the usual propagation
+ * of the change, as the server tree is already sent by then.
+ */
+class TreeSocket::BurstTimer : public Timer
+{
+ public:
+	/** Report the progress of the burst to opers this often, in seconds
+	 */
+	static const time_t ReportInterval = 5;
+
+	TreeSocket* const sock;
+	BurstState bs;
+	std::vector<std::string> users;
+	std::vector<std::string> chans;
+	size_t userpos;
+	size_t chanpos;
+	time_t nextreport;
+
+	BurstTimer(TreeSocket* s)
+		: Timer(0, ServerInstance->Time(), true), sock(s), bs(s), userpos(0), chanpos(0)
+		, nextreport(ServerInstance->Time() + ReportInterval)
+	{
+		const user_hash& clients = *ServerInstance->Users->clientlist;
+		users.reserve(clients.size());
+		for (user_hash::const_iterator i = clients.begin(); i != clients.end(); ++i)
+		{
+			if (i->second->registered == REG_ALL)
+				users.push_back(i->second->uuid);
+		}
+
+		chans.reserve(ServerInstance->chanlist->size());
+		for (chan_hash::const_iterator i = ServerInstance->chanlist->begin(); i != ServerInstance->chanlist->end(); ++i)
+			chans.push_back(i->second->name);
+	}
+
+	bool Tick(time_t)
+	{
+		if (!sock->ContinueBurst())
+			return true;
+
+		sock->burst = NULL;
+		return false;
+	}
+};
+
 /** This function is called when we want to send a netburst to a local
  * server. There is a set order we must do this, because for example
  * users require their servers to exist, and channels require their
@@ -114,17 +162,66 @@ void TreeSocket::DoBurst(TreeServer* s)
 	/* Send server tree */
 	this->SendServers(Utils->TreeRoot, s);
 
-	BurstState bs(this);
-	/* Send users and their oper status */
-	this->SendUsers(bs);
+	/* Send as much of the users and channels as we can now, the rest is sent by the timer */
+	burst = new BurstTimer(this);
+	if (ContinueBurst())
+	{
+		delete burst;
+		burst = NULL;
+		return;
+	}
+
+	ServerInstance->SNO->WriteToSnoMask('l', "Sending the burst to \2%s\2 in parts (%lu users, %lu channels).",
+		s->GetName().c_str(), (unsigned long)burst->users.size(), (unsigned long)burst->chans.size());
+	burst->SetIntervalMS(1);
+}
+
+bool TreeSocket::ContinueBurst()
+{
+	BurstTimer* const b = burst;
+	// Wait for the sendq to drain before sending more, the link is culled soon if it is closed
+	if ((getSendQSize() >= Utils->BurstSendQ) || (GetFd() < 0))
+		return false;
+
+	const size_t limit = getSendQSize() + Utils->BurstChunk;
+	while (getSendQSize() < limit)
+	{
+		if (b->userpos < b->users.size())
+		{
+			User* user = ServerInstance->FindUUID(b->users[b->userpos++]);
+			if ((user) && (!user->quitting))
+				SendUser(user, b->bs);
+		}
+		else if (b->chanpos < b->chans.size())
+		{
+			Channel* chan = ServerInstance->FindChan(b->chans[b->chanpos++]);
+			if (chan)
+				SyncChannel(chan, b->bs);
+		}
+		else
+		{
+			this->SendXLines();
+			FOREACH_MOD(OnSyncNetwork, (b->bs.server));
+			this->WriteLine(":" + ServerInstance->Config->GetSID() + " ENDBURST");
+			ServerInstance->SNO->WriteToSnoMask('l',"Finished bursting to \2"+ MyRoot->GetName()+"\2.");
+			return true;
+		}
+	}
 
-	for (chan_hash::const_iterator i = ServerInstance->chanlist->begin(); i != ServerInstance->chanlist->end(); ++i)
-		SyncChannel(i->second, bs);
+	if (ServerInstance->Time() >= b->nextreport)
+	{
+		b->nextreport = ServerInstance->Time() + BurstTimer::ReportInterval;
+		ServerInstance->SNO->WriteToSnoMask('l', "Bursting to \2%s\2: sent %lu of %lu users and %lu of %lu channels.",
+			MyRoot->GetName().c_str(), (unsigned long)b->userpos, (unsigned long)b->users.size(),
+			(unsigned long)b->chanpos, (unsigned long)b->chans.size());
+	}
+	return false;
+}
 
-	this->SendXLines();
-	FOREACH_MOD(OnSyncNetwork, (bs.server));
-	this->WriteLine(":" + ServerInstance->Config->GetSID() + " ENDBURST");
-	ServerInstance->SNO->WriteToSnoMask('l',"Finished bursting to \2"+ s->GetName()+"\2.");
+void TreeSocket::StopBurst()
+{
+	delete burst;
+	burst = NULL;
 }
 
 /** Recursively send the server tree.
@@ -266,34 +363,25 @@ void TreeSocket::SyncChannel(Channel* chan)
 	SyncChannel(chan, bs);
 }
 
-/** send all users and their oper state/modes */
-void TreeSocket::SendUsers(BurstState& bs)
+/** send a user and their oper state/modes */
+void TreeSocket::SendUser(User* user, BurstState& bs)
 {
-	ProtocolInterface::Server& piserver = bs.server;
-	for (user_hash::iterator u = ServerInstance->Users->clientlist->begin(); u != ServerInstance->Users->clientlist->end(); u++)
-	{
-		User* user = u->second;
-		if (user->registered != REG_ALL)
-			continue;
-
-		this->WriteLine(CommandUID::Builder(user));
+	this->WriteLine(CommandUID::Builder(user));
 
-		if (user->IsOper())
-			this->WriteLine(CommandOpertype::Builder(user));
+	if (user->IsOper())
+		this->WriteLine(CommandOpertype::Builder(user));
 
-		if (user->IsAway())
-			this->WriteLine(CommandAway::Builder(user));
-
-		const Extensible::ExtensibleStore& exts = user->GetExtList();
-		for (Extensible::ExtensibleStore::const_iterator i = exts.begin(); i != exts.end(); ++i)
-		{
-			ExtensionItem* item = i->first;
-			std::string value = item->serialize(FORMAT_NETWORK, u->second, i->second);
-			if (!value.empty())
-				this->WriteLine(CommandMetadata::Builder(user, item->name, value));
-		}
+	if (user->IsAway())
+		this->WriteLine(CommandAway::Builder(user));
 
-		FOREACH_MOD(OnSyncUser, (user, piserver));
+	const Extensible::ExtensibleStore& exts = user->GetExtList();
+	for (Extensible::ExtensibleStore::const_iterator i = exts.begin(); i != exts.end(); ++i)
+	{
+		ExtensionItem* item = i->first;
+		std::string value = item->serialize(FORMAT_NETWORK, user, i->second);
+		if (!value.empty())
+			this->WriteLine(CommandMetadata::Builder(user, item->name, value));
 	}
-}
 
+	FOREACH_MOD(OnSyncUser, (user, bs.server));
+}
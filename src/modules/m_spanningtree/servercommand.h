@@ -20,6 +20,7 @@
 #pragma once
 
 #include "utils.h"
+#include "treeserver.h"
 
 class TreeServer;
 
@@ -67,7 +68,7 @@ class ServerOnlyServerCommand : public ServerCommand
 	{
 		if (!IS_SERVER(user))
 			return CMD_INVALID;
-		TreeServer* server = Utils->FindServer(user->server);
+		TreeServer* server = TreeServer::Get(user);
 		return static_cast<T*>(this)->HandleServer(server, parameters);
 	}
 };
@@ -44,6 +44,6 @@ RouteDescriptor CommandSVSJoin::GetRouting(User* user, const std::vector<std::st
 {
 	User* u = ServerInstance->FindUUID(parameters[0]);
 	if (u)
-		return ROUTE_OPT_UCAST(u->server);
+		return ROUTE_OPT_UCAST(u->server->GetName());
 	return ROUTE_LOCALONLY;
 }
@@ -52,6 +52,6 @@ RouteDescriptor CommandSVSNick::GetRouting(User* user, const std::vector<std::st
 {
 	User* u = ServerInstance->FindNick(parameters[0]);
 	if (u)
-		return ROUTE_OPT_UCAST(u->server);
+		return ROUTE_OPT_UCAST(u->server->GetName());
 	return ROUTE_LOCALONLY;
 }
@@ -33,7 +33,7 @@
  * no socket associated with it. Its version string is our own local version.
  */
 TreeServer::TreeServer()
-	: Parent(NULL), Route(NULL), ServerName(ServerInstance->Config->ServerName), ServerDesc(ServerInstance->Config->ServerDesc)
+	: Server(ServerInstance->Config->ServerName), Parent(NULL), Route(NULL), ServerDesc(ServerInstance->Config->ServerDesc)
 	, VersionString(ServerInstance->GetVersionString()), Socket(NULL), sid(ServerInstance->Config->GetSID()), ServerUser(ServerInstance->FakeClient)
 	, age(ServerInstance->Time()), Warned(false), bursting(false), UserCount(0), OperCount(0), rtt(0), StartBurst(0), Hidden(false)
 {
@@ -45,7 +45,7 @@ TreeServer::TreeServer()
  * its ping counters so that it will be pinged one minute from now.
  */
 TreeServer::TreeServer(const std::string& Name, const std::string& Desc, const std::string& id, TreeServer* Above, TreeSocket* Sock, bool Hide)
-	: Parent(Above), ServerName(Name), ServerDesc(Desc), Socket(Sock), sid(id), ServerUser(new FakeUser(id, Name))
+	: Server(Name), Parent(Above), ServerDesc(Desc), Socket(Sock), sid(id), ServerUser(new FakeUser(id, this))
 	, age(ServerInstance->Time()), Warned(false), bursting(true), UserCount(0), OperCount(0), rtt(0), Hidden(Hide)
 {
 	SetNextPingTime(ServerInstance->Time() + Utils->PingFreq);
@@ -133,21 +133,16 @@ void TreeServer::FinishBurst()
 	long ts = ServerInstance->Time() * 1000 + (ServerInstance->Time_ns() / 1000000);
 	unsigned long bursttime = ts - this->StartBurst;
 	ServerInstance->SNO->WriteToSnoMask(Parent == Utils->TreeRoot ? 'l' : 'L', "Received end of netburst from \2%s\2 (burst time: %lu %s)",
-		ServerName.c_str(), (bursttime > 10000 ? bursttime / 1000 : bursttime), (bursttime > 10000 ? "secs" : "msecs"));
-	AddServerEvent(Utils->Creator, ServerName);
+		name.c_str(), (bursttime > 10000 ? bursttime / 1000 : bursttime), (bursttime > 10000 ? "secs" : "msecs"));
+	AddServerEvent(Utils->Creator, name);
 }
 
 int TreeServer::QuitUsers(const std::string &reason)
 {
 	const char* reason_s = reason.c_str();
 	std::vector<User*> time_to_die;
-	for (user_hash::iterator n = ServerInstance->Users->clientlist->begin(); n != ServerInstance->Users->clientlist->end(); n++)
-	{
-		if (n->second->server == ServerName)
-		{
-			time_to_die.push_back(n->second);
-		}
-	}
+	for (User* user = GetFirstUser(); user; user = user->nextonserver)
+		time_to_die.push_back(user);
 	for (std::vector<User*>::iterator n = time_to_die.begin(); n != time_to_die.end(); n++)
 	{
 		User* a = (User*)*n;
@@ -171,7 +166,7 @@ int TreeServer::QuitUsers(const std::string &reason)
  */
 void TreeServer::AddHashEntry()
 {
-	Utils->serverlist[ServerName] = this;
+	Utils->serverlist[name] = this;
 	Utils->sidlist[sid] = this;
 }
 
@@ -278,5 +273,5 @@ TreeServer::~TreeServer()
 		delete ServerUser;
 
 	Utils->sidlist.erase(sid);
-	Utils->serverlist.erase(ServerName);
+	Utils->serverlist.erase(name);
 }
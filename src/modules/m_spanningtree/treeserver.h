@@ -37,12 +37,11 @@
  * TreeServer items, deleting and inserting them as they
  * are created and destroyed.
  */
-class TreeServer : public classbase
+class TreeServer : public Server
 {
 	TreeServer* Parent;			/* Parent entry */
 	TreeServer* Route;			/* Route entry */
 	std::vector<TreeServer*> Children;	/* List of child objects */
-	std::string ServerName;			/* Server's name */
 	std::string ServerDesc;			/* Server's description */
 	std::string VersionString;		/* Version string or empty string */
 	TreeSocket* Socket;			/* Socket used to communicate with this server */
@@ -80,6 +79,10 @@ class TreeServer : public classbase
 
 	int QuitUsers(const std::string &reason);
 
+	/** Get the TreeServer of the server a user is on
+	 */
+	static TreeServer* Get(User* user) { return static_cast<TreeServer*>(user->server); }
+
 	/** Get route.
 	 * The 'route' is defined as the locally-
 	 * connected server which can be used to reach this server.
@@ -94,10 +97,6 @@ class TreeServer : public classbase
 	 */
 	bool IsLocal() const { return (this->Route == this); }
 
-	/** Get server name
-	 */
-	const std::string& GetName() const { return ServerName; }
-
 	/** Get server description (GECOS)
 	 */
 	const std::string& GetDesc();
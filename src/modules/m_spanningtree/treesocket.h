@@ -90,10 +90,12 @@ struct CapabData
 class TreeSocket : public BufferedSocket
 {
 	class BurstState;
+	class BurstTimer;
 
 	std::string linkID;			/* Description for this link */
 	ServerState LinkState;			/* Link state */
 	CapabData* capab;			/* Link setup data (held until burst is sent) */
+	BurstTimer* burst;			/* Users and channels still to be sent in our burst */
 	TreeServer* MyRoot;			/* The server we are talking to */
 	time_t NextPing;			/* Time when we are due to ping this server */
 	bool LastPingWasGood;			/* Responded to last ping we sent? */
@@ -111,8 +113,18 @@ class TreeSocket : public BufferedSocket
 	/** Send all known information about a channel */
 	void SyncChannel(Channel* chan, BurstState& bs);
 
-	/** Send all users and their oper state, away state and metadata */
-	void SendUsers(BurstState& bs);
+	/** Send a user and their oper state, away state and metadata */
+	void SendUser(User* user, BurstState& bs);
+
+	/** Send the next part of our burst to the server. Stops when the sendq
+	 * has grown by the configured amount or is above the configured limit.
+	 * @return True if the burst is complete, false if there is more to send
+	 */
+	bool ContinueBurst();
+
+	/** Stop sending our burst, called when the link is closed before it is complete
+	 */
+	void StopBurst();
 
  public:
 	const time_t age;
@@ -236,6 +248,8 @@ class TreeSocket : public BufferedSocket
 	 * server. There is a set order we must do this, because for example
 	 * users require their servers to exist, and channels require their
 	 * users to exist. You get the idea.
+	 * Users and channels are sent a part at a time on later main loop
+	 * iterations if there are too many to send at once.
 	 */
 	void DoBurst(TreeServer* s);
 
@@ -37,7 +37,7 @@
  * to it.
  */
 TreeSocket::TreeSocket(Link* link, Autoconnect* myac, const std::string& ipaddr)
-	: linkID(assign(link->Name)), LinkState(CONNECTING), MyRoot(NULL), proto_version(0), ConnectionFailureShown(false)
+	: linkID(assign(link->Name)), LinkState(CONNECTING), burst(NULL), MyRoot(NULL), proto_version(0), ConnectionFailureShown(false)
 	, age(ServerInstance->Time())
 {
 	capab = new CapabData;
@@ -65,7 +65,7 @@ TreeSocket::TreeSocket(Link* link, Autoconnect* myac, const std::string& ipaddr)
  */
 TreeSocket::TreeSocket(int newfd, ListenSocket* via, irc::sockets::sockaddrs* client, irc::sockets::sockaddrs* server)
 	: BufferedSocket(newfd)
-	, linkID("inbound from " + client->addr()), LinkState(WAIT_AUTH_1), MyRoot(NULL), proto_version(0)
+	, linkID("inbound from " + client->addr()), LinkState(WAIT_AUTH_1), burst(NULL), MyRoot(NULL), proto_version(0)
 	, ConnectionFailureShown(false), age(ServerInstance->Time())
 {
 	capab = new CapabData;
@@ -96,6 +96,7 @@ void TreeSocket::CleanNegotiationInfo()
 CullResult TreeSocket::cull()
 {
 	Utils->timeoutlist.erase(this);
+	StopBurst();
 	if (capab && capab->ac)
 		Utils->Creator->ConnectServer(capab->ac, false);
 	return this->BufferedSocket::cull();
@@ -234,11 +235,20 @@ void TreeSocket::OnDataReady()
 {
 	Utils->Creator->loopCall = true;
 	std::string line;
-	while (GetNextLine(line))
+	std::string::size_type qpos = 0;
+	while (true)
 	{
+		// Walk through the recvq and erase what was consumed in one go after
+		// the loop, a burst can carry thousands of lines in a single read
+		std::string::size_type eol = recvq.find('\n', qpos);
+		if (eol == std::string::npos)
+			break;
+		line.assign(recvq, qpos, eol - qpos);
+		qpos = eol + 1;
+
 		std::string::size_type rline = line.find('\r');
 		if (rline != std::string::npos)
-			line = line.substr(0,rline);
+			line.erase(rline);
 		if (line.find('\0') != std::string::npos)
 		{
 			SendError("Read null character from socket");
@@ -248,6 +258,7 @@ void TreeSocket::OnDataReady()
 		if (!getError().empty())
 			break;
 	}
+	recvq.erase(0, qpos);
 	if (LinkState != CONNECTED && recvq.length() > 4096)
 		SendError("RecvQ overrun (line too long)");
 	Utils->Creator->loopCall = false;
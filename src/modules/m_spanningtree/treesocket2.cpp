@@ -229,7 +229,6 @@ void TreeSocket::ProcessLine(std::string &line)
 void TreeSocket::ProcessConnectedLine(std::string& prefix, std::string& command, parameterlist& params)
 {
 	User* who = ServerInstance->FindUUID(prefix);
-	std::string direction;
 
 	if (!who)
 	{
@@ -270,7 +269,6 @@ void TreeSocket::ProcessConnectedLine(std::string& prefix, std::string& command,
 	}
 
 	// Make sure prefix is still good
-	direction = who->server;
 	prefix = who->uuid;
 
 	/*
@@ -289,7 +287,7 @@ void TreeSocket::ProcessConnectedLine(std::string& prefix, std::string& command,
 	 * a valid SID or a valid UUID, so that invalid UUID or SID never makes it
 	 * to the higher level functions. -- B
 	 */
-	TreeServer* route_back_again = Utils->BestRouteTo(direction);
+	TreeServer* route_back_again = TreeServer::Get(who)->GetRoute();
 	if ((!route_back_again) || (route_back_again->GetSocket() != this))
 	{
 		if (route_back_again)
@@ -71,7 +71,7 @@ CmdResult CommandUID::HandleServer(TreeServer* remoteserver, std::vector<std::st
 	User* _new = NULL;
 	try
 	{
-		_new = new RemoteUser(params[0], remoteserver->GetName());
+		_new = new RemoteUser(params[0], remoteserver);
 	}
 	catch (...)
 	{
@@ -85,6 +85,7 @@ CmdResult CommandUID::HandleServer(TreeServer* remoteserver, std::vector<std::st
 	_new->ident = params[5];
 	_new->fullname = params[params.size() - 1];
 	_new->registered = REG_ALL;
+	ServerInstance->Users->UpdateHostIndex(_new);
 	_new->signon = signon;
 	_new->age = age_t;
 
@@ -132,11 +133,11 @@ CmdResult CommandUID::HandleServer(TreeServer* remoteserver, std::vector<std::st
 
 	bool dosend = true;
 
-	if ((Utils->quiet_bursts && remoteserver->bursting) || ServerInstance->SilentULine(_new->server))
+	if ((Utils->quiet_bursts && remoteserver->bursting) || ServerInstance->SilentULine(_new->server->GetName()))
 		dosend = false;
 
 	if (dosend)
-		ServerInstance->SNO->WriteToSnoMask('C',"Client connecting at %s: %s (%s) [%s]", _new->server.c_str(), _new->GetFullRealHost().c_str(), _new->GetIPString().c_str(), _new->fullname.c_str());
+		ServerInstance->SNO->WriteToSnoMask('C',"Client connecting at %s: %s (%s) [%s]", _new->server->GetName().c_str(), _new->GetFullRealHost().c_str(), _new->GetIPString().c_str(), _new->fullname.c_str());
 
 	FOREACH_MOD(OnPostConnect, (_new));
 
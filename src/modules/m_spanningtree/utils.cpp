@@ -93,9 +93,7 @@ TreeServer* SpanningTreeUtilities::BestRouteTo(const std::string &ServerName)
 		User *u = ServerInstance->FindNick(ServerName);
 		if (u)
 		{
-			Found = FindServer(u->server);
-			if (Found)
-				return Found->GetRoute();
+			return TreeServer::Get(u)->GetRoute();
 		}
 
 		return NULL;
@@ -129,6 +127,7 @@ TreeServer* SpanningTreeUtilities::FindServerID(const std::string &id)
 
 SpanningTreeUtilities::SpanningTreeUtilities(ModuleSpanningTree* C)
 	: Creator(C), TreeRoot(NULL)
+	, memberroutes("memberroute", C), channelroutes("channelroutes", C)
 {
 	ServerInstance->Timers->AddTimer(&RefreshTimer);
 }
@@ -160,6 +159,10 @@ SpanningTreeUtilities::~SpanningTreeUtilities()
 /* returns a list of DIRECT servernames for a specific channel */
 void SpanningTreeUtilities::GetListOfServersForChannel(Channel* c, TreeSocketSet& list, char status, const CUList& exempt_list)
 {
+	ChannelRoutes* routes = channelroutes.get(c);
+	if (!routes)
+		return;
+
 	unsigned int minrank = 0;
 	if (status)
 	{
@@ -168,24 +171,117 @@ void SpanningTreeUtilities::GetListOfServersForChannel(Channel* c, TreeSocketSet
 			minrank = mh->GetPrefixRank();
 	}
 
-	const UserMembList *ulist = c->GetUsers();
-
-	for (UserMembCIter i = ulist->begin(); i != ulist->end(); i++)
+	/* Take the exempt members off the count of their route; there are usually
+	 * only a few of them, compared to the members of the channel
+	 */
+	std::map<TreeServer*, unsigned int> exempt;
+	for (CUList::const_iterator i = exempt_list.begin(); i != exempt_list.end(); ++i)
 	{
-		if (IS_LOCAL(i->first))
+		if (IS_LOCAL(*i))
 			continue;
 
-		if (minrank && i->second->getRank() < minrank)
+		Membership* memb = c->GetUser(*i);
+		MemberRoute* mr = memb ? memberroutes.get(memb) : NULL;
+		if ((mr) && (mr->rank >= minrank))
+			exempt[mr->route]++;
+	}
+
+	for (ChannelRoutes::RouteList::const_iterator i = routes->routes.begin(); i != routes->routes.end(); ++i)
+	{
+		unsigned int count = 0;
+		for (std::map<unsigned int, unsigned int>::const_iterator j = i->ranks.lower_bound(minrank); j != i->ranks.end(); ++j)
+			count += j->second;
+
+		std::map<TreeServer*, unsigned int>::const_iterator e = exempt.find(i->route);
+		if (e != exempt.end())
+			count -= e->second;
+
+		if (count)
+			list.insert(i->route->GetSocket());
+	}
+}
+
+void ChannelRoutes::Add(TreeServer* route, unsigned int rank)
+{
+	RouteList::iterator i = routes.begin();
+	while ((i != routes.end()) && (i->route != route))
+		++i;
+
+	if (i == routes.end())
+		i = routes.insert(routes.end(), Route(route));
+
+	i->ranks[rank]++;
+}
+
+void ChannelRoutes::Remove(TreeServer* route, unsigned int rank)
+{
+	for (RouteList::iterator i = routes.begin(); i != routes.end(); ++i)
+	{
+		if (i->route != route)
 			continue;
 
-		if (exempt_list.find(i->first) == exempt_list.end())
+		std::map<unsigned int, unsigned int>::iterator j = i->ranks.find(rank);
+		if (j != i->ranks.end() && !--j->second)
 		{
-			TreeServer* best = this->BestRouteTo(i->first->server);
-			if (best)
-				list.insert(best->GetSocket());
+			i->ranks.erase(j);
+			if (i->ranks.empty())
+				routes.erase(i);
 		}
+		return;
+	}
+}
+
+void SpanningTreeUtilities::AddChannelRoute(Membership* memb)
+{
+	if (IS_LOCAL(memb->user) || memberroutes.get(memb))
+		return;
+
+	TreeServer* route = TreeServer::Get(memb->user)->GetRoute();
+	if (!route)
+		return;
+
+	ChannelRoutes* routes = channelroutes.get(memb->chan);
+	if (!routes)
+	{
+		routes = new ChannelRoutes;
+		channelroutes.set(memb->chan, routes);
 	}
-	return;
+
+	unsigned int rank = memb->getRank();
+	routes->Add(route, rank);
+	memberroutes.set(memb, new MemberRoute(route, rank));
+}
+
+void SpanningTreeUtilities::DelChannelRoute(Membership* memb)
+{
+	MemberRoute* mr = memberroutes.get(memb);
+	if (!mr)
+		return;
+
+	ChannelRoutes* routes = channelroutes.get(memb->chan);
+	if (routes)
+	{
+		routes->Remove(mr->route, mr->rank);
+		if (routes->routes.empty())
+			channelroutes.unset(memb->chan);
+	}
+	memberroutes.unset(memb);
+}
+
+void SpanningTreeUtilities::UpdateChannelRoute(Membership* memb)
+{
+	MemberRoute* mr = memberroutes.get(memb);
+	ChannelRoutes* routes = channelroutes.get(memb->chan);
+	if ((!mr) || (!routes))
+		return;
+
+	unsigned int rank = memb->getRank();
+	if (rank == mr->rank)
+		return;
+
+	routes->Remove(mr->route, mr->rank);
+	routes->Add(mr->route, rank);
+	mr->rank = rank;
 }
 
 void SpanningTreeUtilities::DoOneToAllButSender(const CmdBuilder& params, TreeServer* omitroute)
@@ -214,6 +310,16 @@ bool SpanningTreeUtilities::DoOneToOne(const CmdBuilder& params, const std::stri
 	return true;
 }
 
+bool SpanningTreeUtilities::DoOneToOne(const CmdBuilder& params, Server* target)
+{
+	TreeServer* Route = static_cast<TreeServer*>(target)->GetRoute();
+	if (!Route)
+		return false;
+
+	Route->GetSocket()->WriteLine(params);
+	return true;
+}
+
 void SpanningTreeUtilities::RefreshIPCache()
 {
 	ValidIPs.clear();
@@ -258,7 +364,10 @@ void SpanningTreeUtilities::ReadConfiguration()
 	AnnounceTSChange = options->getBool("announcets");
 	AllowOptCommon = options->getBool("allowmismatch");
 	ChallengeResponse = !security->getBool("disablehmac");
-	quiet_bursts = ServerInstance->Config->ConfValue("performance")->getBool("quietbursts");
+	ConfigTag* performance = ServerInstance->Config->ConfValue("performance");
+	quiet_bursts = performance->getBool("quietbursts");
+	BurstChunk = performance->getInt("netburstchunk", 65536, 512);
+	BurstSendQ = performance->getInt("netburstsendq", 1048576, 4096);
 	PingWarnTime = options->getInt("pingwarning");
 	PingFreq = options->getInt("serverpingfreq");
 
@@ -41,6 +41,51 @@ extern SpanningTreeUtilities* Utils;
  */
 typedef TR1NS::unordered_map<std::string, TreeServer*, irc::insensitive, irc::StrHashComp> server_hash;
 
+/** The route to a remote member of a channel and the prefix rank they were counted with
+ */
+struct MemberRoute
+{
+	TreeServer* route;
+	unsigned int rank;
+
+	MemberRoute(TreeServer* Route, unsigned int Rank) : route(Route), rank(Rank) {}
+};
+
+/** Counts the remote members of a channel behind each of our direct links,
+ * so channel messages can be routed without finding the server of every member
+ */
+class ChannelRoutes
+{
+ public:
+	struct Route
+	{
+		/** The direct link the members are behind
+		 */
+		TreeServer* route;
+
+		/** Number of members behind the link by prefix rank
+		 */
+		std::map<unsigned int, unsigned int> ranks;
+
+		Route(TreeServer* Server) : route(Server) {}
+	};
+
+	typedef std::vector<Route> RouteList;
+
+	/** Routes which have at least one member behind them; there is one
+	 * entry for each direct link at most so this is kept as a vector
+	 */
+	RouteList routes;
+
+	/** Count a member behind a route with the given rank
+	 */
+	void Add(TreeServer* route, unsigned int rank);
+
+	/** Stop counting a member behind a route with the given rank
+	 */
+	void Remove(TreeServer* route, unsigned int rank);
+};
+
 /** Contains helper functions and variables for this module,
  * and keeps them out of the global namespace
  */
@@ -74,6 +119,14 @@ class SpanningTreeUtilities : public classbase
 	 */
 	bool quiet_bursts;
 
+	/** Number of bytes of a netburst to send to a server per main loop iteration
+	 */
+	unsigned long BurstChunk;
+
+	/** Do not send more of a netburst to a server while its sendq is at least this large
+	 */
+	unsigned long BurstSendQ;
+
 	/* Number of seconds that a server can go without ping
 	 * before opers are warned of high latency.
 	 */
@@ -96,6 +149,12 @@ class SpanningTreeUtilities : public classbase
 	/** Holds the data from the <link> tags in the conf
 	 */
 	std::vector<reference<Link> > LinkBlocks;
+	/** Route and rank of each remote channel member
+	 */
+	SimpleExtItem<MemberRoute> memberroutes;
+	/** Remote member counts of each channel by route
+	 */
+	SimpleExtItem<ChannelRoutes> channelroutes;
 	/** Holds the data from the <autoconnect> tags in the conf
 	 */
 	std::vector<reference<Autoconnect> > AutoconnectBlocks;
@@ -130,6 +189,10 @@ class SpanningTreeUtilities : public classbase
 	 */
 	bool DoOneToOne(const CmdBuilder& params, const std::string& target);
 
+	/** Send a message from this server to the server a user is on
+	 */
+	bool DoOneToOne(const CmdBuilder& params, Server* target);
+
 	/** Send a message from this server to all but one other, local or remote
 	 */
 	void DoOneToAllButSender(const CmdBuilder& params, TreeServer* omit);
@@ -150,6 +213,18 @@ class SpanningTreeUtilities : public classbase
 	 */
 	void GetListOfServersForChannel(Channel* c, TreeSocketSet& list, char status, const CUList& exempt_list);
 
+	/** Start counting a remote member of a channel in the route counts of the channel
+	 */
+	void AddChannelRoute(Membership* memb);
+
+	/** Stop counting a remote member of a channel, called when they leave it
+	 */
+	void DelChannelRoute(Membership* memb);
+
+	/** Recount a remote member of a channel after their prefix modes may have changed
+	 */
+	void UpdateChannelRoute(Membership* memb);
+
 	/** Find a server by name
 	 */
 	TreeServer* FindServer(const std::string &ServerName);
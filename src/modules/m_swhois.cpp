@@ -51,11 +51,11 @@ class CommandSwhois : public Command
 		if (text)
 		{
 			// We already had it set...
-			if (!ServerInstance->ULine(user->server))
+			if (!ServerInstance->ULine(user->server->GetName()))
 				// Ulines set SWHOISes silently
 				ServerInstance->SNO->WriteGlobalSno('a', "%s used SWHOIS to set %s's extra whois from '%s' to '%s'", user->nick.c_str(), dest->nick.c_str(), text->c_str(), parameters[1].c_str());
 		}
-		else if (!ServerInstance->ULine(user->server))
+		else if (!ServerInstance->ULine(user->server->GetName()))
 		{
 			// Ulines set SWHOISes silently
 			ServerInstance->SNO->WriteGlobalSno('a', "%s used SWHOIS to set %s's extra whois to '%s'", user->nick.c_str(), dest->nick.c_str(), parameters[1].c_str());
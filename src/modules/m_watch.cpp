@@ -30,14 +30,14 @@
  * For efficiency, many data structures are kept.
  *
  * The first is a global list `watchentries':
- *	hash_map<irc::string, std::deque<User*> >
+ *	hash_map<irc::string, WatchedNick>
  *
- * That is, if nick 'w00t' is being watched by user pointer 'Brain' and 'Om', <w00t, (Brain, Om)>
- * will be in the watchentries list.
+ * That is, if nick 'w00t' is being watched by user pointer 'Brain' and 'Om', w00t will be in the
+ * watchentries list with an intrusive list of two WatchLinks, one for Brain and one for Om.
  *
  * The second is that each user has a per-user data structure attached to their user record via Extensible:
- *	std::map<irc::string, std::string> watchlist;
- * So, in the above example with w00t watched by Brain and Om, we'd have:
+ *	std::map<irc::string, WatchLink*> watchlist::links;
+ * holding the same WatchLinks. So, in the above example with w00t watched by Brain and Om, we'd have:
  * 	Brain-
  * 	      `- w00t
  * 	Om-
@@ -57,6 +57,9 @@
  * KEY: Brain   --->  Watched by:  Boo, w00t, Om
  * KEY: Boo     --->  Watched by:  Brain, w00t
  *
+ * Each entry in the list is a WatchLink which is also referenced from the watcher's
+ * own list, so a watch can be added or removed without searching for the watcher.
+ *
  * This is used when we want to tell all the users that are watching someone that
  * they are now available or no longer available. For example, if the hash was
  * populated as shown above, then when Brain signs on, messages are sent to Boo, w00t
@@ -66,9 +69,9 @@
  * Each user also has a seperate (smaller) map attached to their User whilst they
  * have any watch entries, which is managed by class Extensible. When they add or remove
  * a watch entry from their list, it is inserted here, as well as the main list being
- * maintained. This map also contains the user's online status. For users that are
- * offline, the key points at an empty string, and for users that are online, the key
- * points at a string containing "users-ident users-host users-signon-time". This is
+ * maintained. The link each key points at also contains the user's online status. For
+ * users that are offline this is an empty string, and for users that are online it is
+ * a string containing "users-ident users-host users-signon-time". This is
  * stored in this manner so that we don't have to FindUser() to fetch this info, the
  * users signon can populate the field for us.
  *
@@ -90,8 +93,67 @@
  * of users using WATCH.
  */
 
-typedef TR1NS::unordered_map<irc::string, std::deque<User*>, irc::hash> watchentries;
-typedef std::map<irc::string, std::string> watchlist;
+struct WatchedNick;
+
+/** A nickname on a user's watch list. Each link is on an intrusive list kept by the
+ * watched nickname, so it can be added to and removed from that list in constant time.
+ */
+struct WatchLink
+{
+	/** The user who is watching the nickname */
+	User* const watcher;
+
+	/** The entry of the watched nickname in whos_watching_me */
+	WatchedNick* target;
+
+	/** The previous and next links watching the same nickname */
+	WatchLink* prev;
+	WatchLink* next;
+
+	/** "ident host signon" of the user with the nickname if they are online, empty otherwise */
+	std::string status;
+
+	WatchLink(User* Watcher) : watcher(Watcher), target(NULL), prev(NULL), next(NULL) { }
+};
+
+/** The users watching a nickname, in the order they started watching it */
+struct WatchedNick
+{
+	WatchLink* first;
+	WatchLink* last;
+	size_t count;
+
+	WatchedNick() : first(NULL), last(NULL), count(0) { }
+
+	void Append(WatchLink* link)
+	{
+		link->target = this;
+		link->prev = last;
+		link->next = NULL;
+		if (last)
+			last->next = link;
+		else
+			first = link;
+		last = link;
+		count++;
+	}
+
+	void Remove(WatchLink* link)
+	{
+		if (link->prev)
+			link->prev->next = link->next;
+		else
+			first = link->next;
+		if (link->next)
+			link->next->prev = link->prev;
+		else
+			last = link->prev;
+		link->target = NULL;
+		count--;
+	}
+};
+
+typedef TR1NS::unordered_map<irc::string, WatchedNick, irc::hash> watchentries;
 
 /* Who's watching each nickname.
  * NOTE: We do NOT iterate this to display a user's WATCH list!
@@ -99,6 +161,48 @@ typedef std::map<irc::string, std::string> watchlist;
  */
 watchentries* whos_watching_me;
 
+/** The nicknames a user is watching, sorted by nickname for WATCH L.
+ * Destroying the list stops the user watching all of them.
+ */
+struct watchlist
+{
+	typedef std::map<irc::string, WatchLink*> linkmap;
+	linkmap links;
+
+	/** Start watching a nickname. The nickname must not already be on the list. */
+	WatchLink* Add(User* watcher, const irc::string& nick)
+	{
+		WatchLink* link = new WatchLink(watcher);
+		links[nick] = link;
+		(*whos_watching_me)[nick].Append(link);
+		return link;
+	}
+
+	/** Stop watching the nickname at the given position in the list. */
+	void Remove(linkmap::iterator it)
+	{
+		Unlink(it->first, it->second);
+		links.erase(it);
+	}
+
+	~watchlist()
+	{
+		for (linkmap::iterator i = links.begin(); i != links.end(); ++i)
+			Unlink(i->first, i->second);
+	}
+
+ private:
+	static void Unlink(const irc::string& nick, WatchLink* link)
+	{
+		WatchedNick* target = link->target;
+		target->Remove(link);
+		if (!target->count)
+			/* nobody else is watching this nick */
+			whos_watching_me->erase(nick);
+		delete link;
+	}
+};
+
 class CommandSVSWatch : public Command
 {
  public:
@@ -110,7 +214,7 @@ class CommandSVSWatch : public Command
 
 	CmdResult Handle (const std::vector<std::string> &parameters, User *user)
 	{
-		if (!ServerInstance->ULine(user->server))
+		if (!ServerInstance->ULine(user->server->GetName()))
 			return CMD_FAILURE;
 
 		User *u = ServerInstance->FindNick(parameters[0]);
@@ -129,7 +233,7 @@ class CommandSVSWatch : public Command
 	{
 		User* target = ServerInstance->FindNick(parameters[0]);
 		if (target)
-			return ROUTE_OPT_UCAST(target->server);
+			return ROUTE_OPT_UCAST(target->server->GetName());
 		return ROUTE_LOCALONLY;
 	}
 };
@@ -154,39 +258,22 @@ class CommandWatch : public Command
 		if (wl)
 		{
 			/* Yup, is on my list */
-			watchlist::iterator n = wl->find(nick);
-
-			if (!wl)
-				return CMD_FAILURE;
-
-			if (n != wl->end())
+			watchlist::linkmap::iterator n = wl->links.find(nick);
+			if (n != wl->links.end())
 			{
-				if (!n->second.empty())
-					user->WriteNumeric(602, "%s %s :stopped watching", n->first.c_str(), n->second.c_str());
+				if (!n->second->status.empty())
+					user->WriteNumeric(602, "%s %s :stopped watching", n->first.c_str(), n->second->status.c_str());
 				else
 					user->WriteNumeric(602, "%s * * 0 :stopped watching", nick);
 
-				wl->erase(n);
+				/* I'm no longer watching you... */
+				wl->Remove(n);
 			}
 
-			if (wl->empty())
+			if (wl->links.empty())
 			{
 				ext.unset(user);
 			}
-
-			watchentries::iterator x = whos_watching_me->find(nick);
-			if (x != whos_watching_me->end())
-			{
-				/* People are watching this user, am i one of them? */
-				std::deque<User*>::iterator n2 = std::find(x->second.begin(), x->second.end(), user);
-				if (n2 != x->second.end())
-					/* I'm no longer watching you... */
-					x->second.erase(n2);
-
-				if (x->second.empty())
-					/* nobody else is, either. */
-					whos_watching_me->erase(nick);
-			}
 		}
 
 		return CMD_SUCCESS;
@@ -207,34 +294,23 @@ class CommandWatch : public Command
 			ext.set(user, wl);
 		}
 
-		if (wl->size() == MAX_WATCH)
+		if (wl->links.size() == MAX_WATCH)
 		{
 			user->WriteNumeric(512, "%s :Too many WATCH entries", nick);
 			return CMD_FAILURE;
 		}
 
-		watchlist::iterator n = wl->find(nick);
-		if (n == wl->end())
+		watchlist::linkmap::iterator n = wl->links.find(nick);
+		if (n == wl->links.end())
 		{
 			/* Don't already have the user on my watch list, proceed */
-			watchentries::iterator x = whos_watching_me->find(nick);
-			if (x != whos_watching_me->end())
-			{
-				/* People are watching this user, add myself */
-				x->second.push_back(user);
-			}
-			else
-			{
-				std::deque<User*> newlist;
-				newlist.push_back(user);
-				(*(whos_watching_me))[nick] = newlist;
-			}
+			WatchLink* link = wl->Add(user, nick);
 
 			User* target = ServerInstance->FindNick(nick);
 			if (target)
 			{
-				(*wl)[nick] = std::string(target->ident).append(" ").append(target->dhost).append(" ").append(ConvToStr(target->age));
-				user->WriteNumeric(604, "%s %s :is online", nick, (*wl)[nick].c_str());
+				link->status = std::string(target->ident).append(" ").append(target->dhost).append(" ").append(ConvToStr(target->age));
+				user->WriteNumeric(604, "%s %s :is online", nick, link->status.c_str());
 				if (target->IsAway())
 				{
 					user->WriteNumeric(609, "%s %s %s %lu :is away", target->nick.c_str(), target->ident.c_str(), target->dhost.c_str(), (unsigned long) target->awaytime);
@@ -242,7 +318,6 @@ class CommandWatch : public Command
 			}
 			else
 			{
-				(*wl)[nick].clear();
 				user->WriteNumeric(605, "%s * * 0 :is offline", nick);
 			}
 		}
@@ -262,10 +337,10 @@ class CommandWatch : public Command
 			watchlist* wl = ext.get(user);
 			if (wl)
 			{
-				for (watchlist::iterator q = wl->begin(); q != wl->end(); q++)
+				for (watchlist::linkmap::iterator q = wl->links.begin(); q != wl->links.end(); q++)
 				{
-					if (!q->second.empty())
-						user->WriteNumeric(604, "%s %s :is online", q->first.c_str(), q->second.c_str());
+					if (!q->second->status.empty())
+						user->WriteNumeric(604, "%s %s :is online", q->first.c_str(), q->second->status.c_str());
 				}
 			}
 			user->WriteNumeric(607, ":End of WATCH list");
@@ -277,40 +352,19 @@ class CommandWatch : public Command
 				const char *nick = parameters[x].c_str();
 				if (!strcasecmp(nick,"C"))
 				{
-					// watch clear
-					watchlist* wl = ext.get(user);
-					if (wl)
-					{
-						for (watchlist::iterator i = wl->begin(); i != wl->end(); i++)
-						{
-							watchentries::iterator i2 = whos_watching_me->find(i->first);
-							if (i2 != whos_watching_me->end())
-							{
-								/* People are watching this user, am i one of them? */
-								std::deque<User*>::iterator n = std::find(i2->second.begin(), i2->second.end(), user);
-								if (n != i2->second.end())
-									/* I'm no longer watching you... */
-									i2->second.erase(n);
-
-								if (i2->second.empty())
-									/* nobody else is, either. */
-									whos_watching_me->erase(i2);
-							}
-						}
-
-						ext.unset(user);
-					}
+					// watch clear, destroying the list stops watching everyone on it
+					ext.unset(user);
 				}
 				else if (!strcasecmp(nick,"L"))
 				{
 					watchlist* wl = ext.get(user);
 					if (wl)
 					{
-						for (watchlist::iterator q = wl->begin(); q != wl->end(); q++)
+						for (watchlist::linkmap::iterator q = wl->links.begin(); q != wl->links.end(); q++)
 						{
-							if (!q->second.empty())
+							if (!q->second->status.empty())
 							{
-								user->WriteNumeric(604, "%s %s :is online", q->first.c_str(), q->second.c_str());
+								user->WriteNumeric(604, "%s %s :is online", q->first.c_str(), q->second->status.c_str());
 								User *targ = ServerInstance->FindNick(q->first.c_str());
 								if (targ->IsAway())
 								{
@@ -332,14 +386,14 @@ class CommandWatch : public Command
 
 					if (wl)
 					{
-						for (watchlist::iterator q = wl->begin(); q != wl->end(); q++)
+						for (watchlist::linkmap::iterator q = wl->links.begin(); q != wl->links.end(); q++)
 							list.append(q->first.c_str()).append(" ");
-						you_have = wl->size();
+						you_have = wl->links.size();
 					}
 
 					watchentries::iterator i2 = whos_watching_me->find(user->nick.c_str());
 					if (i2 != whos_watching_me->end())
-						youre_on = i2->second.size();
+						youre_on = i2->second.count;
 
 					user->WriteNumeric(603, ":You have %d and are on %d WATCH entries", you_have, youre_on);
 					user->WriteNumeric(606, ":%s", list.c_str());
@@ -400,9 +454,9 @@ class Modulewatch : public Module
 		watchentries::iterator x = whos_watching_me->find(user->nick.c_str());
 		if (x != whos_watching_me->end())
 		{
-			for (std::deque<User*>::iterator n = x->second.begin(); n != x->second.end(); n++)
+			for (WatchLink* link = x->second.first; link; link = link->next)
 			{
-				(*n)->WriteNumeric(inum, numeric);
+				link->watcher->WriteNumeric(inum, numeric);
 			}
 		}
 
@@ -414,39 +468,17 @@ class Modulewatch : public Module
 		watchentries::iterator x = whos_watching_me->find(user->nick.c_str());
 		if (x != whos_watching_me->end())
 		{
-			for (std::deque<User*>::iterator n = x->second.begin(); n != x->second.end(); n++)
+			for (WatchLink* link = x->second.first; link; link = link->next)
 			{
-				(*n)->WriteNumeric(601, "%s %s %s %lu :went offline", user->nick.c_str(), user->ident.c_str(), user->dhost.c_str(), (unsigned long) ServerInstance->Time());
+				link->watcher->WriteNumeric(601, "%s %s %s %lu :went offline", user->nick.c_str(), user->ident.c_str(), user->dhost.c_str(), (unsigned long) ServerInstance->Time());
 
-				watchlist* wl = cmdw.ext.get(*n);
-				if (wl)
-					/* We were on somebody's notify list, set ourselves offline */
-					(*wl)[user->nick.c_str()].clear();
+				/* We were on somebody's notify list, set ourselves offline */
+				link->status.clear();
 			}
 		}
 
 		/* Now im quitting, if i have a notify list, im no longer watching anyone */
-		watchlist* wl = cmdw.ext.get(user);
-		if (wl)
-		{
-			/* Iterate every user on my watch list, and take me out of the whos_watching_me map for each one we're watching */
-			for (watchlist::iterator i = wl->begin(); i != wl->end(); i++)
-			{
-				watchentries::iterator i2 = whos_watching_me->find(i->first);
-				if (i2 != whos_watching_me->end())
-				{
-						/* People are watching this user, am i one of them? */
-						std::deque<User*>::iterator n = std::find(i2->second.begin(), i2->second.end(), user);
-						if (n != i2->second.end())
-							/* I'm no longer watching you... */
-							i2->second.erase(n);
-
-						if (i2->second.empty())
-							/* and nobody else is, either. */
-							whos_watching_me->erase(i2);
-				}
-			}
-		}
+		cmdw.ext.unset(user);
 	}
 
 	void OnGarbageCollect()
@@ -455,7 +487,13 @@ class Modulewatch : public Module
 		whos_watching_me = new watchentries();
 
 		for (watchentries::const_iterator n = old_watch->begin(); n != old_watch->end(); n++)
-			whos_watching_me->insert(*n);
+		{
+			/* The entries move, so point their links at the new copies */
+			WatchedNick& entry = (*whos_watching_me)[n->first];
+			entry = n->second;
+			for (WatchLink* link = entry.first; link; link = link->next)
+				link->target = &entry;
+		}
 
 		delete old_watch;
 	}
@@ -465,14 +503,12 @@ class Modulewatch : public Module
 		watchentries::iterator x = whos_watching_me->find(user->nick.c_str());
 		if (x != whos_watching_me->end())
 		{
-			for (std::deque<User*>::iterator n = x->second.begin(); n != x->second.end(); n++)
+			for (WatchLink* link = x->second.first; link; link = link->next)
 			{
-				(*n)->WriteNumeric(600, "%s %s %s %lu :arrived online", user->nick.c_str(), user->ident.c_str(), user->dhost.c_str(), (unsigned long) user->age);
+				link->watcher->WriteNumeric(600, "%s %s %s %lu :arrived online", user->nick.c_str(), user->ident.c_str(), user->dhost.c_str(), (unsigned long) user->age);
 
-				watchlist* wl = cmdw.ext.get(*n);
-				if (wl)
-					/* We were on somebody's notify list, set ourselves online */
-					(*wl)[user->nick.c_str()] = std::string(user->ident).append(" ").append(user->dhost).append(" ").append(ConvToStr(user->age));
+				/* We were on somebody's notify list, set ourselves online */
+				link->status = std::string(user->ident).append(" ").append(user->dhost).append(" ").append(ConvToStr(user->age));
 			}
 		}
 	}
@@ -484,27 +520,19 @@ class Modulewatch : public Module
 
 		if (new_offline != whos_watching_me->end())
 		{
-			for (std::deque<User*>::iterator n = new_offline->second.begin(); n != new_offline->second.end(); n++)
+			for (WatchLink* link = new_offline->second.first; link; link = link->next)
 			{
-				watchlist* wl = cmdw.ext.get(*n);
-				if (wl)
-				{
-					(*n)->WriteNumeric(601, "%s %s %s %lu :went offline", oldnick.c_str(), user->ident.c_str(), user->dhost.c_str(), (unsigned long) user->age);
-					(*wl)[oldnick.c_str()].clear();
-				}
+				link->watcher->WriteNumeric(601, "%s %s %s %lu :went offline", oldnick.c_str(), user->ident.c_str(), user->dhost.c_str(), (unsigned long) user->age);
+				link->status.clear();
 			}
 		}
 
 		if (new_online != whos_watching_me->end())
 		{
-			for (std::deque<User*>::iterator n = new_online->second.begin(); n != new_online->second.end(); n++)
+			for (WatchLink* link = new_online->second.first; link; link = link->next)
 			{
-				watchlist* wl = cmdw.ext.get(*n);
-				if (wl)
-				{
-					(*wl)[user->nick.c_str()] = std::string(user->ident).append(" ").append(user->dhost).append(" ").append(ConvToStr(user->age));
-					(*n)->WriteNumeric(600, "%s %s :arrived online", user->nick.c_str(), (*wl)[user->nick.c_str()].c_str());
-				}
+				link->status = std::string(user->ident).append(" ").append(user->dhost).append(" ").append(ConvToStr(user->age));
+				link->watcher->WriteNumeric(600, "%s %s :arrived online", user->nick.c_str(), link->status.c_str());
 			}
 		}
 	}
@@ -233,3 +233,46 @@ void ISupportManager::SendTo(LocalUser* user)
 	for (std::vector<std::string>::const_iterator i = this->Lines.begin(); i != this->Lines.end(); ++i)
 		user->WriteNumeric(RPL_ISUPPORT, *i);
 }
+
+void Server::AddUser(User* user)
+{
+	user->prevonserver = NULL;
+	user->nextonserver = firstuser;
+	if (firstuser)
+		firstuser->prevonserver = user;
+	firstuser = user;
+}
+
+void Server::RemoveUser(User* user)
+{
+	if (user->prevonserver)
+		user->prevonserver->nextonserver = user->nextonserver;
+	else if (firstuser == user)
+		firstuser = user->nextonserver;
+	else
+		return; // Not on this server
+
+	if (user->nextonserver)
+		user->nextonserver->prevonserver = user->prevonserver;
+	user->prevonserver = user->nextonserver = NULL;
+}
+
+void Server::MoveUsers(Server* newserver)
+{
+	User* user = firstuser;
+	if (!user)
+		return;
+
+	User* last = NULL;
+	for (; user; user = user->nextonserver)
+	{
+		user->server = newserver;
+		last = user;
+	}
+
+	last->nextonserver = newserver->firstuser;
+	if (newserver->firstuser)
+		newserver->firstuser->prevonserver = last;
+	newserver->firstuser = firstuser;
+	firstuser = NULL;
+}
@@ -37,6 +37,7 @@ void EventHandler::SetFd(int FD)
 SocketEngine::SocketEngine()
 {
 	TotalEvents = WriteEvents = ReadEvents = ErrorEvents = 0;
+	CtlCalls = CtlCallsAvoided = 0;
 	lastempty = ServerInstance->Time();
 	indata = outdata = 0;
 }
@@ -61,9 +62,10 @@ void SocketEngine::ChangeEventMask(EventHandler* eh, int change)
 	if (change & FD_WANT_WRITE_MASK)
 		new_m &= ~FD_WANT_WRITE_MASK;
 
-	// if adding a trial read/write, insert it into the set
+	// if adding a trial read/write, insert it into the list
+	// a handler with a pending trial is already in the list so this can't add duplicates
 	if (change & FD_TRIAL_NOTE_MASK && !(old_m & FD_TRIAL_NOTE_MASK))
-		trials.insert(eh->GetFd());
+		trials.push_back(eh->GetFd());
 
 	new_m |= change;
 	if (new_m == old_m)
@@ -75,13 +77,11 @@ void SocketEngine::ChangeEventMask(EventHandler* eh, int change)
 
 void SocketEngine::DispatchTrialWrites()
 {
-	std::vector<int> working_list;
-	working_list.reserve(trials.size());
-	working_list.assign(trials.begin(), trials.end());
-	trials.clear();
-	for(unsigned int i=0; i < working_list.size(); i++)
+	// Trials added by the handlers we call are run on the next iteration
+	trials_working.swap(trials);
+	for(unsigned int i=0; i < trials_working.size(); i++)
 	{
-		int fd = working_list[i];
+		int fd = trials_working[i];
 		EventHandler* eh = GetRef(fd);
 		if (!eh)
 			continue;
@@ -92,6 +92,7 @@ void SocketEngine::DispatchTrialWrites()
 		if ((mask & (FD_ADD_TRIAL_WRITE | FD_WRITE_WILL_BLOCK)) == FD_ADD_TRIAL_WRITE)
 			eh->HandleEvent(EVENT_WRITE, 0);
 	}
+	trials_working.clear();
 }
 
 bool SocketEngine::HasFd(int fd)
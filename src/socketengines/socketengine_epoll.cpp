@@ -34,10 +34,25 @@
 class EPollEngine : public SocketEngine
 {
 private:
-	/** These are used by epoll() to hold socket events
+	/** These are used by epoll() to hold socket events, sized to <performance:eventbatch>
 	 */
-	struct epoll_event* events;
+	std::vector<struct epoll_event> events;
 	int EngineHandle;
+
+	/** Per file descriptor registration state
+	 */
+	struct FdState
+	{
+		/** Events currently registered with the kernel
+		 */
+		unsigned registered;
+		/** Edge-triggered readiness (EPOLLIN/EPOLLOUT) which arrived while the handler did not want it
+		 */
+		unsigned pending;
+	};
+	FdState* fdstate;
+
+	void SetEvents(int fd, unsigned events);
 public:
 	/** Create a new EPollEngine
 	 */
@@ -79,19 +94,22 @@ EPollEngine::EPollEngine()
 	}
 
 	ref = new EventHandler* [GetMaxFds()];
-	events = new struct epoll_event[GetMaxFds()];
+	fdstate = new FdState[GetMaxFds()];
 
 	memset(ref, 0, GetMaxFds() * sizeof(EventHandler*));
+	memset(fdstate, 0, GetMaxFds() * sizeof(FdState));
 }
 
 EPollEngine::~EPollEngine()
 {
 	this->Close(EngineHandle);
 	delete[] ref;
-	delete[] events;
+	delete[] fdstate;
 }
 
-static unsigned mask_to_epoll(int event_mask)
+/** Returns the events the handler wants to be told about
+ */
+static unsigned mask_to_wanted(int event_mask)
 {
 	unsigned rv = 0;
 	if (event_mask & (FD_WANT_POLL_READ | FD_WANT_POLL_WRITE | FD_WANT_SINGLE_WRITE))
@@ -114,6 +132,18 @@ static unsigned mask_to_epoll(int event_mask)
 	return rv;
 }
 
+/** Returns the events to register with the kernel. Edge-triggered sockets are
+ * registered for both directions whatever they want, so moving between the
+ * edge-triggered states never needs an epoll_ctl() call.
+ */
+static unsigned mask_to_epoll(int event_mask)
+{
+	unsigned rv = mask_to_wanted(event_mask);
+	if (rv & EPOLLET)
+		rv = EPOLLET | EPOLLIN | EPOLLOUT;
+	return rv;
+}
+
 bool EPollEngine::AddFd(EventHandler* eh, int event_mask)
 {
 	int fd = eh->GetFd();
@@ -134,6 +164,7 @@ bool EPollEngine::AddFd(EventHandler* eh, int event_mask)
 	ev.events = mask_to_epoll(event_mask);
 	ev.data.fd = fd;
 	int i = epoll_ctl(EngineHandle, EPOLL_CTL_ADD, fd, &ev);
+	CtlCalls++;
 	if (i < 0)
 	{
 		ServerInstance->Logs->Log("SOCKET", LOG_DEBUG, "Error adding fd: %d to socketengine: %s", fd, strerror(errno));
@@ -143,23 +174,61 @@ bool EPollEngine::AddFd(EventHandler* eh, int event_mask)
 	ServerInstance->Logs->Log("SOCKET", LOG_DEBUG, "New file descriptor: %d", fd);
 
 	ref[fd] = eh;
+	fdstate[fd].registered = ev.events;
+	fdstate[fd].pending = 0;
 	SocketEngine::SetEventMask(eh, event_mask);
 	CurrentSetSize++;
 	return true;
 }
 
+void EPollEngine::SetEvents(int fd, unsigned new_events)
+{
+	struct epoll_event ev;
+	memset(&ev,0,sizeof(ev));
+	ev.events = new_events;
+	ev.data.fd = fd;
+	epoll_ctl(EngineHandle, EPOLL_CTL_MOD, fd, &ev);
+	CtlCalls++;
+
+	// The kernel checks readiness itself when the registration changes
+	fdstate[fd].registered = new_events;
+	fdstate[fd].pending = 0;
+}
+
 void EPollEngine::OnSetEvent(EventHandler* eh, int old_mask, int new_mask)
 {
-	unsigned old_events = mask_to_epoll(old_mask);
+	int fd = eh->GetFd();
+	if ((fd < 0) || (fd > GetMaxFds() - 1))
+		return;
+
+	FdState& state = fdstate[fd];
 	unsigned new_events = mask_to_epoll(new_mask);
-	if (old_events != new_events)
+	if (new_events != state.registered)
 	{
 		// ok, we actually have something to tell the kernel about
-		struct epoll_event ev;
-		memset(&ev,0,sizeof(ev));
-		ev.events = new_events;
-		ev.data.fd = eh->GetFd();
-		epoll_ctl(EngineHandle, EPOLL_CTL_MOD, eh->GetFd(), &ev);
+		SetEvents(fd, new_events);
+		return;
+	}
+
+	unsigned old_wanted = mask_to_wanted(old_mask);
+	unsigned new_wanted = mask_to_wanted(new_mask);
+	if (old_wanted != new_wanted)
+		CtlCallsAvoided++;
+
+	// If the socket became ready while the handler was not interested the edge
+	// has already gone by, so hand it out as a trial read/write instead
+	unsigned missed = state.pending & new_wanted;
+	if (missed)
+	{
+		state.pending &= ~missed;
+		int trial = 0;
+		if (missed & EPOLLIN)
+			trial |= FD_ADD_TRIAL_READ;
+		if (missed & EPOLLOUT)
+			trial |= FD_ADD_TRIAL_WRITE;
+		if (!(new_mask & FD_TRIAL_NOTE_MASK))
+			trials.push_back(fd);
+		SetEventMask(eh, new_mask | trial);
 	}
 }
 
@@ -182,7 +251,10 @@ void EPollEngine::DelFd(EventHandler* eh)
 		ServerInstance->Logs->Log("SOCKET", LOG_DEBUG, "epoll_ctl can't remove socket: %s", strerror(errno));
 	}
 
+	CtlCalls++;
 	ref[fd] = NULL;
+	fdstate[fd].registered = 0;
+	fdstate[fd].pending = 0;
 
 	ServerInstance->Logs->Log("SOCKET", LOG_DEBUG, "Remove file descriptor: %d", fd);
 	CurrentSetSize--;
@@ -192,7 +264,11 @@ int EPollEngine::DispatchEvents()
 {
 	socklen_t codesize = sizeof(int);
 	int errcode;
-	int i = epoll_wait(EngineHandle, events, GetMaxFds() - 1, 1000);
+	// Only take a bounded batch; the kernel keeps the rest ready for the next call
+	if (events.size() != ServerInstance->Config->EventBatch)
+		events.resize(ServerInstance->Config->EventBatch);
+
+	int i = epoll_wait(EngineHandle, &events[0], events.size(), ServerInstance->Timers->GetTimeout());
 	ServerInstance->UpdateTime();
 
 	TotalEvents += i;
@@ -204,6 +280,7 @@ int EPollEngine::DispatchEvents()
 		{
 			ServerInstance->Logs->Log("SOCKET", LOG_DEBUG, "Got event on unknown fd: %d", events[j].data.fd);
 			epoll_ctl(EngineHandle, EPOLL_CTL_DEL, events[j].data.fd, &events[j]);
+			CtlCalls++;
 			continue;
 		}
 		if (events[j].events & EPOLLHUP)
@@ -221,10 +298,14 @@ int EPollEngine::DispatchEvents()
 			eh->HandleEvent(EVENT_ERROR, errcode);
 			continue;
 		}
+		// Level-triggered registrations only report what the handler asked for
+		FdState& state = fdstate[events[j].data.fd];
+		bool edge = (state.registered & EPOLLET);
+		unsigned ready = events[j].events;
 		int mask = eh->GetEventMask();
-		if (events[j].events & EPOLLIN)
+		if (ready & EPOLLIN)
 			mask &= ~FD_READ_WILL_BLOCK;
-		if (events[j].events & EPOLLOUT)
+		if (ready & EPOLLOUT)
 		{
 			mask &= ~FD_WRITE_WILL_BLOCK;
 			if (mask & FD_WANT_SINGLE_WRITE)
@@ -235,7 +316,17 @@ int EPollEngine::DispatchEvents()
 			}
 		}
 		SetEventMask(eh, mask);
-		if (events[j].events & EPOLLIN)
+
+		if (edge)
+		{
+			// Remember readiness the handler does not want right now, it is given
+			// out as a trial read/write once the handler asks for it again
+			unsigned unwanted = ready & (EPOLLIN | EPOLLOUT) & ~mask_to_wanted(mask);
+			state.pending |= unwanted;
+			ready &= ~unwanted;
+		}
+
+		if (ready & EPOLLIN)
 		{
 			ReadEvents++;
 			eh->HandleEvent(EVENT_READ);
@@ -243,7 +334,7 @@ int EPollEngine::DispatchEvents()
 				// whoa! we got deleted, better not give out the write event
 				continue;
 		}
-		if (events[j].events & EPOLLOUT)
+		if (ready & EPOLLOUT)
 		{
 			WriteEvents++;
 			eh->HandleEvent(EVENT_WRITE);
@@ -212,8 +212,9 @@ void KQueueEngine::OnSetEvent(EventHandler* eh, int old_mask, int new_mask)
 
 int KQueueEngine::DispatchEvents()
 {
-	ts.tv_nsec = 0;
-	ts.tv_sec = 1;
+	int timeout = ServerInstance->Timers->GetTimeout();
+	ts.tv_nsec = (timeout % 1000) * 1000000;
+	ts.tv_sec = timeout / 1000;
 
 	int i = kevent(EngineHandle, NULL, 0, &ke_list[0], GetMaxFds(), &ts);
 	ServerInstance->UpdateTime();
@@ -154,8 +154,9 @@ int PortsEngine::DispatchEvents()
 {
 	struct timespec poll_time;
 
-	poll_time.tv_sec = 1;
-	poll_time.tv_nsec = 0;
+	int timeout = ServerInstance->Timers->GetTimeout();
+	poll_time.tv_sec = timeout / 1000;
+	poll_time.tv_nsec = (timeout % 1000) * 1000000;
 
 	unsigned int nget = 1; // used to denote a retrieve request.
 	int ret = port_getn(EngineHandle, this->events, GetMaxFds() - 1, &nget, &poll_time);
@@ -0,0 +1,521 @@
+/*
+ * InspIRCd -- Internet Relay Chat Daemon
+ *
+ *
+ * This file is part of InspIRCd.  InspIRCd is free software: you can
+ * redistribute it and/or modify it under the terms of the GNU General Public
+ * License as published by the Free Software Foundation, version 2.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "inspircd.h"
+#include "exitcodes.h"
+#include "socketengine.h"
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <poll.h>
+#include <ulimit.h>
+#include <iostream>
+
+/** Number of entries in the submission ring. Interest changes are queued here
+ * and handed to the kernel in one go when we wait for events, if it fills up
+ * before that it is flushed early.
+ */
+#define URING_SQ_ENTRIES 4096
+
+/** Number of entries in the completion ring
+ */
+#define URING_CQ_ENTRIES (URING_SQ_ENTRIES * 4)
+
+/** user_data of requests whose completion is of no interest to us (poll removals)
+ */
+#define URING_IGNORE (~(__u64)0)
+
+/** A specialisation of the SocketEngine class, designed to use the linux io_uring interface.
+ * Readiness is requested with one-shot poll requests. Unlike epoll_ctl(), queueing a
+ * request does not cost a system call: every change made during one iteration of the
+ * main loop is submitted together with the wait for the next batch of events.
+ */
+class URingEngine : public SocketEngine
+{
+private:
+	/** Per file descriptor request state
+	 */
+	struct FdState
+	{
+		/** Poll events of the request currently queued or in the kernel, 0 if there is none
+		 */
+		unsigned int armed;
+		/** Incremented every time a request is made or cancelled, used to recognise stale completions
+		 */
+		unsigned int generation;
+	};
+	FdState* fdstate;
+
+	int EngineHandle;
+
+	/** The mmap()ed rings shared with the kernel
+	 */
+	void* ring;
+	size_t ring_size;
+	io_uring_sqe* sqes;
+	size_t sqes_size;
+
+	unsigned int* sq_head;
+	unsigned int* sq_tail;
+	unsigned int* sq_mask;
+	unsigned int* sq_array;
+	unsigned int* cq_head;
+	unsigned int* cq_tail;
+	unsigned int* cq_mask;
+	io_uring_cqe* cqes;
+
+	/** Number of queued requests the kernel has not seen yet
+	 */
+	unsigned int pending;
+
+	/** Completions taken off the completion ring which have not been handled yet
+	 */
+	std::vector<io_uring_cqe> completions;
+
+	/** File descriptors whose poll request could not be queued because the submission ring was full
+	 */
+	std::vector<int> rearm;
+
+	/** Poll requests whose removal could not be queued because the submission ring was full
+	 */
+	std::vector<__u64> removals;
+
+	void CreateRing();
+	void DestroyRing();
+	bool Queue(__u8 opcode, int fd, unsigned int events, __u64 addr, __u64 user_data);
+	int Submit(bool wait);
+	void Reap();
+	void Arm(int fd, unsigned int events);
+	void Disarm(int fd);
+	void Retry();
+
+public:
+	/** Create a new URingEngine
+	 */
+	URingEngine();
+	/** Delete a URingEngine
+	 */
+	virtual ~URingEngine();
+	virtual bool AddFd(EventHandler* eh, int event_mask);
+	virtual void OnSetEvent(EventHandler* eh, int old_mask, int new_mask);
+	virtual void DelFd(EventHandler* eh);
+	virtual int DispatchEvents();
+	virtual std::string GetName();
+	virtual void RecoverFromFork();
+};
+
+URingEngine::URingEngine()
+{
+	int max = ulimit(4, 0);
+	if (max > 0)
+	{
+		MAX_DESCRIPTORS = max;
+	}
+	else
+	{
+		ServerInstance->Logs->Log("SOCKET", LOG_DEFAULT, "ERROR: Can't determine maximum number of open sockets!");
+		std::cout << "ERROR: Can't determine maximum number of open sockets!" << std::endl;
+		ServerInstance->QuickExit(EXIT_STATUS_SOCKETENGINE);
+	}
+
+	CreateRing();
+
+	ref = new EventHandler* [GetMaxFds()];
+	fdstate = new FdState[GetMaxFds()];
+
+	memset(ref, 0, GetMaxFds() * sizeof(EventHandler*));
+	memset(fdstate, 0, GetMaxFds() * sizeof(FdState));
+}
+
+URingEngine::~URingEngine()
+{
+	DestroyRing();
+	delete[] ref;
+	delete[] fdstate;
+}
+
+void URingEngine::CreateRing()
+{
+	io_uring_params params;
+	memset(&params, 0, sizeof(params));
+	params.flags = IORING_SETUP_CQSIZE;
+	params.cq_entries = URING_CQ_ENTRIES;
+
+	EngineHandle = syscall(__NR_io_uring_setup, URING_SQ_ENTRIES, &params);
+	if (EngineHandle == -1)
+	{
+		ServerInstance->Logs->Log("SOCKET", LOG_DEFAULT, "ERROR: Could not initialize socket engine: %s", strerror(errno));
+		ServerInstance->Logs->Log("SOCKET", LOG_DEFAULT, "ERROR: Your kernel probably does not have the proper features. This is a fatal error, exiting now.");
+		std::cout << "ERROR: Could not initialize io_uring socket engine: " << strerror(errno) << std::endl;
+		std::cout << "ERROR: Your kernel probably does not have the proper features. This is a fatal error, exiting now." << std::endl;
+		ServerInstance->QuickExit(EXIT_STATUS_SOCKETENGINE);
+	}
+
+	// A timeout on the wait (EXT_ARG) implies a kernel which has the rest of what we need as well
+	const __u32 features = IORING_FEAT_SINGLE_MMAP | IORING_FEAT_NODROP | IORING_FEAT_EXT_ARG;
+	if ((params.features & features) != features)
+	{
+		ServerInstance->Logs->Log("SOCKET", LOG_DEFAULT, "ERROR: Could not initialize socket engine: io_uring lacks required features (0x%x)", params.features);
+		ServerInstance->Logs->Log("SOCKET", LOG_DEFAULT, "ERROR: Your kernel probably does not have the proper features. This is a fatal error, exiting now.");
+		std::cout << "ERROR: Could not initialize io_uring socket engine: io_uring lacks required features" << std::endl;
+		std::cout << "ERROR: Your kernel probably does not have the proper features. This is a fatal error, exiting now." << std::endl;
+		ServerInstance->QuickExit(EXIT_STATUS_SOCKETENGINE);
+	}
+
+	// With IORING_FEAT_SINGLE_MMAP both rings live in the same mapping
+	ring_size = std::max<size_t>(params.sq_off.array + params.sq_entries * sizeof(unsigned int),
+		params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe));
+	sqes_size = params.sq_entries * sizeof(io_uring_sqe);
+
+	ring = mmap(NULL, ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, EngineHandle, IORING_OFF_SQ_RING);
+	sqes = static_cast<io_uring_sqe*>(mmap(NULL, sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, EngineHandle, IORING_OFF_SQES));
+	if (ring == MAP_FAILED || sqes == MAP_FAILED)
+	{
+		ServerInstance->Logs->Log("SOCKET", LOG_DEFAULT, "ERROR: Could not map io_uring rings: %s", strerror(errno));
+		std::cout << "ERROR: Could not map io_uring rings: " << strerror(errno) << std::endl;
+		ServerInstance->QuickExit(EXIT_STATUS_SOCKETENGINE);
+	}
+
+	char* base = static_cast<char*>(ring);
+	sq_head = reinterpret_cast<unsigned int*>(base + params.sq_off.head);
+	sq_tail = reinterpret_cast<unsigned int*>(base + params.sq_off.tail);
+	sq_mask = reinterpret_cast<unsigned int*>(base + params.sq_off.ring_mask);
+	sq_array = reinterpret_cast<unsigned int*>(base + params.sq_off.array);
+	cq_head = reinterpret_cast<unsigned int*>(base + params.cq_off.head);
+	cq_tail = reinterpret_cast<unsigned int*>(base + params.cq_off.tail);
+	cq_mask = reinterpret_cast<unsigned int*>(base + params.cq_off.ring_mask);
+	cqes = reinterpret_cast<io_uring_cqe*>(base + params.cq_off.cqes);
+	pending = 0;
+	completions.clear();
+	rearm.clear();
+	removals.clear();
+}
+
+void URingEngine::DestroyRing()
+{
+	munmap(sqes, sqes_size);
+	munmap(ring, ring_size);
+	this->Close(EngineHandle);
+}
+
+void URingEngine::RecoverFromFork()
+{
+	/*
+	 * Nothing is registered yet when we fork. Make a fresh ring so that it
+	 * belongs to the daemon rather than the parent which is about to exit.
+	 */
+	DestroyRing();
+	CreateRing();
+}
+
+static unsigned int mask_to_poll(int event_mask)
+{
+	unsigned int rv = 0;
+	if (event_mask & (FD_WANT_POLL_READ | FD_WANT_FAST_READ))
+		rv |= POLLIN;
+	if (event_mask & (FD_WANT_POLL_WRITE | FD_WANT_FAST_WRITE | FD_WANT_SINGLE_WRITE))
+		rv |= POLLOUT;
+	return rv;
+}
+
+bool URingEngine::Queue(__u8 opcode, int fd, unsigned int events, __u64 addr, __u64 user_data)
+{
+	unsigned int tail = *sq_tail;
+	for (int tries = 0; tail - __atomic_load_n(sq_head, __ATOMIC_ACQUIRE) >= URING_SQ_ENTRIES; tries++)
+	{
+		// The slots still belong to requests the kernel has not taken, never overwrite them
+		if (tries == 3)
+		{
+			ServerInstance->Logs->Log("SOCKET", LOG_DEBUG, "io_uring submission ring is full, deferring request for fd %d", fd);
+			return false;
+		}
+
+		// Ring is full of requests we have not handed over yet, do it now. The kernel refuses new
+		// requests while it holds completions which did not fit in the completion ring, make room first.
+		Reap();
+		if (Submit(false) < 0)
+			ServerInstance->Logs->Log("SOCKET", LOG_DEBUG, "io_uring_enter can't submit requests: %s", strerror(errno));
+	}
+
+	unsigned int index = tail & *sq_mask;
+	io_uring_sqe* sqe = &sqes[index];
+	memset(sqe, 0, sizeof(*sqe));
+	sqe->opcode = opcode;
+	sqe->fd = fd;
+	sqe->addr = addr;
+	sqe->poll32_events = events;
+	sqe->user_data = user_data;
+	sq_array[index] = index;
+
+	// Make the entry visible to the kernel before the new tail
+	__atomic_store_n(sq_tail, tail + 1, __ATOMIC_RELEASE);
+	pending++;
+	return true;
+}
+
+int URingEngine::Submit(bool wait)
+{
+	int timeout = ServerInstance->Timers->GetTimeout();
+	__kernel_timespec ts;
+	ts.tv_sec = timeout / 1000;
+	ts.tv_nsec = (timeout % 1000) * 1000000;
+
+	io_uring_getevents_arg arg;
+	memset(&arg, 0, sizeof(arg));
+	arg.ts = reinterpret_cast<__u64>(&ts);
+
+	unsigned int flags = IORING_ENTER_EXT_ARG;
+	if (wait)
+		flags |= IORING_ENTER_GETEVENTS;
+
+	int i = syscall(__NR_io_uring_enter, EngineHandle, pending, wait ? 1 : 0, flags, &arg, sizeof(arg));
+	if (i > 0)
+		pending -= std::min<unsigned int>(i, pending);
+	return i;
+}
+
+void URingEngine::Reap()
+{
+	unsigned int head = *cq_head;
+	unsigned int tail = __atomic_load_n(cq_tail, __ATOMIC_ACQUIRE);
+	for (; head != tail; head++)
+		completions.push_back(cqes[head & *cq_mask]);
+	__atomic_store_n(cq_head, head, __ATOMIC_RELEASE);
+}
+
+void URingEngine::Arm(int fd, unsigned int events)
+{
+	FdState& state = fdstate[fd];
+	state.generation++;
+	if (Queue(IORING_OP_POLL_ADD, fd, events, 0, (static_cast<__u64>(state.generation) << 32) | fd))
+		state.armed = events;
+	else
+		rearm.push_back(fd);
+}
+
+void URingEngine::Disarm(int fd)
+{
+	FdState& state = fdstate[fd];
+	if (!state.armed)
+		return;
+
+	// The removal itself is not interesting; the cancelled request completes with a generation we no longer accept
+	const __u64 target = (static_cast<__u64>(state.generation) << 32) | fd;
+	if (!Queue(IORING_OP_POLL_REMOVE, -1, 0, target, URING_IGNORE))
+		removals.push_back(target);
+	state.armed = 0;
+	state.generation++;
+}
+
+void URingEngine::Retry()
+{
+	std::vector<__u64> removing;
+	removing.swap(removals);
+	for (std::vector<__u64>::const_iterator i = removing.begin(); i != removing.end(); ++i)
+	{
+		if (!Queue(IORING_OP_POLL_REMOVE, -1, 0, *i, URING_IGNORE))
+			removals.push_back(*i);
+	}
+
+	std::vector<int> arming;
+	arming.swap(rearm);
+	for (std::vector<int>::const_iterator i = arming.begin(); i != arming.end(); ++i)
+	{
+		// The handler may have gone away or changed its mind in the meantime
+		int fd = *i;
+		EventHandler* eh = ref[fd];
+		if (!eh || fdstate[fd].armed)
+			continue;
+
+		unsigned int events = mask_to_poll(eh->GetEventMask());
+		if (events)
+			Arm(fd, events);
+	}
+}
+
+bool URingEngine::AddFd(EventHandler* eh, int event_mask)
+{
+	int fd = eh->GetFd();
+	if ((fd < 0) || (fd > GetMaxFds() - 1))
+	{
+		ServerInstance->Logs->Log("SOCKET", LOG_DEBUG, "AddFd out of range: (fd: %d, max: %d)", fd, GetMaxFds());
+		return false;
+	}
+
+	if (ref[fd])
+	{
+		ServerInstance->Logs->Log("SOCKET", LOG_DEBUG, "Attempt to add duplicate fd: %d", fd);
+		return false;
+	}
+
+	ServerInstance->Logs->Log("SOCKET", LOG_DEBUG, "New file descriptor: %d", fd);
+
+	ref[fd] = eh;
+	SocketEngine::SetEventMask(eh, event_mask);
+
+	unsigned int events = mask_to_poll(event_mask);
+	if (events)
+		Arm(fd, events);
+
+	CurrentSetSize++;
+	return true;
+}
+
+void URingEngine::OnSetEvent(EventHandler* eh, int old_mask, int new_mask)
+{
+	int fd = eh->GetFd();
+	if ((fd < 0) || (fd > GetMaxFds() - 1))
+		return;
+
+	unsigned int events = mask_to_poll(new_mask);
+	if (events == fdstate[fd].armed)
+		return;
+
+	Disarm(fd);
+	if (events)
+		Arm(fd, events);
+}
+
+void URingEngine::DelFd(EventHandler* eh)
+{
+	int fd = eh->GetFd();
+	if ((fd < 0) || (fd > GetMaxFds() - 1))
+	{
+		ServerInstance->Logs->Log("SOCKET", LOG_DEBUG, "DelFd out of range: (fd: %d, max: %d)", fd, GetMaxFds());
+		return;
+	}
+
+	if (fdstate[fd].armed)
+	{
+		Disarm(fd);
+		// Hand the removal over right away, the request holds a reference to the file until then
+		if (Submit(false) < 0)
+			ServerInstance->Logs->Log("SOCKET", LOG_DEBUG, "io_uring_enter can't remove socket: %s", strerror(errno));
+	}
+
+	ref[fd] = NULL;
+
+	ServerInstance->Logs->Log("SOCKET", LOG_DEBUG, "Remove file descriptor: %d", fd);
+	CurrentSetSize--;
+}
+
+int URingEngine::DispatchEvents()
+{
+	socklen_t codesize = sizeof(int);
+	int errcode;
+
+	if (!rearm.empty() || !removals.empty())
+		Retry();
+
+	// Don't wait if completions were already taken off the ring while queueing requests
+	if (Submit(completions.empty()) < 0 && errno != ETIME && errno != EINTR)
+		ServerInstance->Logs->Log("SOCKET", LOG_DEBUG, "io_uring_enter failed: %s", strerror(errno));
+	ServerInstance->UpdateTime();
+
+	// Take everything off the ring before running any handlers, they may queue requests
+	// which take more completions off it when the submission ring is full
+	Reap();
+
+	int count = 0;
+	for (size_t n = 0; n < completions.size(); n++)
+	{
+		__u64 user_data = completions[n].user_data;
+		int res = completions[n].res;
+
+		if (user_data == URING_IGNORE)
+			continue;
+
+		int fd = static_cast<int>(user_data & 0xFFFFFFFF);
+		unsigned int generation = static_cast<unsigned int>(user_data >> 32);
+		if ((fd < 0) || (fd > GetMaxFds() - 1))
+			continue;
+
+		// Completions of requests which were cancelled or replaced, or of a removed fd
+		EventHandler* eh = ref[fd];
+		FdState& state = fdstate[fd];
+		if (!eh || state.generation != generation)
+			continue;
+
+		// Poll requests are one-shot, this one is gone now
+		state.armed = 0;
+		count++;
+
+		if (res < 0)
+		{
+			if (res != -ECANCELED)
+			{
+				ErrorEvents++;
+				eh->HandleEvent(EVENT_ERROR, -res);
+			}
+		}
+		else if (res & POLLHUP)
+		{
+			ErrorEvents++;
+			eh->HandleEvent(EVENT_ERROR, 0);
+		}
+		else if (res & POLLERR)
+		{
+			ErrorEvents++;
+			/* Get error number */
+			if (getsockopt(fd, SOL_SOCKET, SO_ERROR, &errcode, &codesize) < 0)
+				errcode = errno;
+			eh->HandleEvent(EVENT_ERROR, errcode);
+		}
+		else
+		{
+			if (res & POLLIN)
+			{
+				SetEventMask(eh, eh->GetEventMask() & ~FD_READ_WILL_BLOCK);
+				ReadEvents++;
+				eh->HandleEvent(EVENT_READ);
+				if (eh != ref[fd])
+					// whoa! we got deleted, better not give out the write event
+					continue;
+			}
+			if (res & POLLOUT)
+			{
+				SetEventMask(eh, eh->GetEventMask() & ~(FD_WRITE_WILL_BLOCK | FD_WANT_SINGLE_WRITE));
+				WriteEvents++;
+				eh->HandleEvent(EVENT_WRITE);
+			}
+		}
+
+		// Keep polling unless the handler went away or a new request was already made for it
+		if (ref[fd] == eh && !state.armed)
+		{
+			unsigned int events = mask_to_poll(eh->GetEventMask());
+			if (events)
+				Arm(fd, events);
+		}
+	}
+
+	completions.clear();
+
+	TotalEvents += count;
+	return count;
+}
+
+std::string URingEngine::GetName()
+{
+	return "uring";
+}
+
+SocketEngine* CreateSocketEngine()
+{
+	return new URingEngine;
+}
@@ -22,6 +22,7 @@
 #include "inspircd.h"
 #include "testsuite.h"
 #include "threadengine.h"
+#include "modules/regex.h"
 #include <iostream>
 
 class TestSuiteThread : public Thread
@@ -62,6 +63,7 @@ TestSuite::TestSuite()
 		std::cout << "(6) Comma sepstream tests\n";
 		std::cout << "(7) Space sepstream tests\n";
 		std::cout << "(8) UID generation tests\n";
+		std::cout << "(9) Regex literal extraction tests\n";
 
 		std::cout << std::endl << "(X) Exit test suite\n";
 
@@ -105,6 +107,9 @@ TestSuite::TestSuite()
 			case '8':
 				std::cout << (DoGenerateUIDTests() ? "\nSUCCESS!\n" : "\nFAILURE\n");
 				break;
+			case '9':
+				std::cout << (DoRegexLiteralTests() ? "\nSUCCESS!\n" : "\nFAILURE\n");
+				break;
 			case 'X':
 				return;
 				break;
@@ -389,6 +394,49 @@ bool TestSuite::DoGenerateUIDTests()
 	return true;
 }
 
+/** Exposes Regex::ExtractLiteral() to the tests below
+ */
+class LiteralTestRegex : public Regex
+{
+ public:
+	LiteralTestRegex() : Regex("") { }
+	bool Matches(const std::string& text) { return false; }
+	static bool Extract(const std::string& rx, std::string& literal) { return ExtractLiteral(rx, literal); }
+};
+
+#define LITERALTEST(x, y) { std::string lit; std::cout << "literal(\"" << x << "\") == \"" << y << "\" " << ((passed = (LiteralTestRegex::Extract(x, lit) && lit == y)) ? " SUCCESS!\n" : " FAILURE\n"); if (!passed) return false; }
+#define LITERALTESTNONE(x) { std::string lit; std::cout << "!literal(\"" << x << "\") " << ((passed = (!LiteralTestRegex::Extract(x, lit))) ? " SUCCESS!\n" : " FAILURE\n"); if (!passed) return false; }
+
+bool TestSuite::DoRegexLiteralTests()
+{
+	std::cout << "\n\nRegex literal extraction tests\n\n";
+	bool passed = false;
+
+	LITERALTEST("foobar", "foobar");
+	LITERALTEST("^foo.*barbaz$", "barbaz");
+	LITERALTEST("abc[xyz]defg", "defg");
+	LITERALTEST("abcd[]x]ef", "abcd");
+	LITERALTEST("abcd[^]x]ef", "abcd");
+	LITERALTEST("[[:alpha:]]xyz", "xyz");
+	LITERALTEST("[[:alpha:][:digit:]]xyz", "xyz");
+	LITERALTEST("[[=a=]]xyz", "xyz");
+	LITERALTEST("[[.-.]]xyz", "xyz");
+	LITERALTEST("[a[]xyz", "xyz");
+	LITERALTEST("ab\\?c", "a");
+	LITERALTEST("abc\\?defg", "defg");
+	LITERALTEST("abcde\\?fg", "abcd");
+
+	LITERALTESTNONE("foo|bar");
+	LITERALTESTNONE("[\\]a]bc");
+	LITERALTESTNONE("[a\\]]bc");
+	LITERALTESTNONE("[[:alpha:]x");
+	LITERALTESTNONE("[[:alpha]]x");
+	LITERALTESTNONE("abc[def");
+	LITERALTESTNONE("a\\?");
+
+	return true;
+}
+
 TestSuite::~TestSuite()
 {
 	std::cout << "\n\n*** END OF TEST SUITE ***\n";
@@ -23,54 +23,281 @@
 #include "inspircd.h"
 #include "timer.h"
 
+/** Timers further away than this are parked at this distance and filed again when they come up */
+static const time_t MAX_DELAY_SECS = 2000000;
+
+/** If the clock moves forward by more than this many seconds at once, or back at all, the wheel is rebuilt instead of turned */
+static const time_t MAX_CATCHUP_SECS = 16;
+
 void Timer::SetInterval(time_t newinterval)
 {
 	ServerInstance->Timers->DelTimer(this);
 	secs = newinterval;
+	interval_ms = newinterval * 1000UL;
 	SetTrigger(ServerInstance->Time() + newinterval);
 	ServerInstance->Timers->AddTimer(this);
 }
 
+void Timer::SetIntervalMS(unsigned long newinterval)
+{
+	ServerInstance->Timers->DelTimer(this);
+	secs = newinterval / 1000;
+	interval_ms = newinterval;
+	unsigned long ms = ServerInstance->Time_ns() / 1000000 + newinterval;
+	trigger = ServerInstance->Time() + ms / 1000;
+	trigger_ms = ms % 1000;
+	ServerInstance->Timers->AddTimer(this);
+}
+
 Timer::~Timer()
 {
 	ServerInstance->Timers->DelTimer(this);
 }
 
-void TimerManager::TickTimers(time_t TIME)
+TimerManager::TimerManager()
+	: running(NULL), rootcount(0), current(0)
+	, current_secs(ServerInstance->Time()), current_ms(ServerInstance->Time_ns() / 1000000)
+{
+	memset(root, 0, sizeof(root));
+	memset(levels, 0, sizeof(levels));
+}
+
+void TimerManager::Link(Timer* t, Timer** list)
+{
+	t->prev = NULL;
+	t->next = *list;
+	if (*list)
+		(*list)->prev = t;
+	*list = t;
+	t->list = list;
+	if (list >= root && list < root + ROOT_SIZE)
+		rootcount++;
+}
+
+void TimerManager::Unlink(Timer* t)
+{
+	if (!t->list)
+		return;
+
+	if (t->prev)
+		t->prev->next = t->next;
+	else
+		*t->list = t->next;
+	if (t->next)
+		t->next->prev = t->prev;
+	if (t->list >= root && t->list < root + ROOT_SIZE)
+		rootcount--;
+
+	t->prev = t->next = NULL;
+	t->list = NULL;
+}
+
+long TimerManager::GetDelay(Timer* t) const
+{
+	time_t secs = t->trigger - current_secs;
+	if (secs < 0)
+		return 0;
+	if (secs > MAX_DELAY_SECS)
+		return MAX_DELAY_SECS * 1000;
+	long delay = secs * 1000 + static_cast<long>(t->trigger_ms) - static_cast<long>(current_ms);
+	return delay < 0 ? 0 : delay;
+}
+
+void TimerManager::Schedule(Timer* t)
+{
+	// Timers which are already due run on the next tick
+	unsigned long delay = std::max(GetDelay(t), 1L);
+	t->expires = current + delay;
+
+	if (delay < ROOT_SIZE)
+	{
+		Link(t, &root[t->expires & (ROOT_SIZE - 1)]);
+		return;
+	}
+
+	unsigned int shift = ROOT_BITS;
+	for (unsigned int i = 0; i < LEVELS; i++, shift += LEVEL_BITS)
+	{
+		if (i == LEVELS - 1 || delay < (1UL << (shift + LEVEL_BITS)))
+		{
+			Link(t, &levels[i][(t->expires >> shift) & (LEVEL_SIZE - 1)]);
+			return;
+		}
+	}
+}
+
+void TimerManager::Cascade(Timer** slot)
+{
+	while (*slot)
+	{
+		Timer* t = *slot;
+		Unlink(t);
+		if (GetDelay(t))
+			Schedule(t);
+		else
+			// Due right now, the root slot for this tick is run next
+			Link(t, &root[current & (ROOT_SIZE - 1)]);
+	}
+}
+
+void TimerManager::RunSlot(Timer** slot, time_t TIME)
+{
+	while (*slot)
+	{
+		Timer* t = *slot;
+		Unlink(t);
+		if (GetDelay(t))
+			// Parked timer which is still a long way off
+			Schedule(t);
+		else
+			Fire(t, TIME);
+	}
+}
+
+void TimerManager::Fire(Timer* t, time_t TIME)
 {
-	for (TimerMap::iterator i = Timers.begin(); i != Timers.end(); )
+	if (!t->Tick(TIME))
 	{
-		Timer* t = i->second;
-		if (t->GetTrigger() > TIME)
-			break;
+		delete t;
+		return;
+	}
 
-		Timers.erase(i++);
+	// Tick() may have scheduled the timer again by itself
+	if (t->list || !t->GetRepeat())
+		return;
 
-		if (!t->Tick(TIME))
-			delete t;
-		else if (t->GetRepeat())
+	if (t->interval_ms % 1000)
+	{
+		unsigned long ms = current_ms + t->interval_ms;
+		t->trigger = current_secs + ms / 1000;
+		t->trigger_ms = ms % 1000;
+	}
+	else
+	{
+		// Whole second timers keep ticking on the second
+		t->SetTrigger(TIME + t->GetInterval());
+	}
+	Schedule(t);
+}
+
+void TimerManager::TickTimers()
+{
+	time_t secs = ServerInstance->Time();
+	unsigned int ms = ServerInstance->Time_ns() / 1000000;
+	time_t elapsed = secs - current_secs;
+
+	// Nothing to do if the clock did not move forward within the same second
+	if (elapsed == 0 && ms <= current_ms)
+		return;
+
+	// If the clock was set back or jumped far ahead file every timer again relative to the new time,
+	// otherwise the wheel would stand still until the clock caught up with it again
+	if (elapsed < 0 || elapsed > MAX_CATCHUP_SECS)
+	{
+		current_secs = secs;
+		current_ms = ms;
+		Rebuild(secs);
+		return;
+	}
+
+	unsigned long ticks = elapsed * 1000 + ms - current_ms;
+	while (ticks--)
+	{
+		current++;
+		if (++current_ms == 1000)
+		{
+			current_ms = 0;
+			current_secs++;
+		}
+
+		if (!(current & (ROOT_SIZE - 1)))
 		{
-			t->SetTrigger(TIME + t->GetInterval());
-			AddTimer(t);
+			// The root has gone round, refill it from the levels above
+			unsigned int shift = ROOT_BITS;
+			for (unsigned int i = 0; i < LEVELS; i++, shift += LEVEL_BITS)
+			{
+				unsigned int index = (current >> shift) & (LEVEL_SIZE - 1);
+				Cascade(&levels[i][index]);
+				if (index)
+					break;
+			}
 		}
+
+		RunSlot(&root[current & (ROOT_SIZE - 1)], current_secs);
 	}
 }
 
-void TimerManager::DelTimer(Timer* t)
+void TimerManager::Rebuild(time_t TIME)
 {
-	std::pair<TimerMap::iterator, TimerMap::iterator> itpair = Timers.equal_range(t->GetTrigger());
+	for (unsigned int i = 0; i < ROOT_SIZE; i++)
+	{
+		while (root[i])
+		{
+			Timer* t = root[i];
+			Unlink(t);
+			Link(t, &running);
+		}
+	}
 
-	for (TimerMap::iterator i = itpair.first; i != itpair.second; ++i)
+	for (unsigned int i = 0; i < LEVELS; i++)
 	{
-		if (i->second == t)
+		for (unsigned int j = 0; j < LEVEL_SIZE; j++)
 		{
-			Timers.erase(i);
-			break;
+			while (levels[i][j])
+			{
+				Timer* t = levels[i][j];
+				Unlink(t);
+				Link(t, &running);
+			}
 		}
 	}
+
+	while (running)
+	{
+		Timer* t = running;
+		Unlink(t);
+		if (GetDelay(t))
+			Schedule(t);
+		else
+			Fire(t, TIME);
+	}
+}
+
+void TimerManager::DelTimer(Timer* t)
+{
+	Unlink(t);
 }
 
 void TimerManager::AddTimer(Timer* t)
 {
-	Timers.insert(std::make_pair(t->GetTrigger(), t));
+	Unlink(t);
+	Schedule(t);
+}
+
+int TimerManager::GetTimeout() const
+{
+	if (rootcount)
+	{
+		for (unsigned int i = 1; i <= ROOT_SIZE && i < 1000; i++)
+		{
+			if (root[(current + i) & (ROOT_SIZE - 1)])
+				return i;
+		}
+	}
+
+	// Otherwise nothing can become due before a slot is moved down into the root
+	for (unsigned long wait = ROOT_SIZE - (current & (ROOT_SIZE - 1)); wait < 1000; wait += ROOT_SIZE)
+	{
+		unsigned long tick = current + wait;
+		unsigned int shift = ROOT_BITS;
+		for (unsigned int i = 0; i < LEVELS; i++, shift += LEVEL_BITS)
+		{
+			unsigned int index = (tick >> shift) & (LEVEL_SIZE - 1);
+			if (levels[i][index])
+				return wait;
+			if (index)
+				break;
+		}
+	}
+	return 1000;
 }
@@ -123,7 +123,7 @@ void UserManager::AddUser(int socket, ListenSocket* via, irc::sockets::sockaddrs
 	 */
 	New->exempt = (ServerInstance->XLines->MatchesLine("E",New) != NULL);
 
-	if (BanCacheHit *b = ServerInstance->BanCache->GetHit(New->GetIPString()))
+	if (BanCacheHit *b = ServerInstance->BanCache->GetHit(New->client_sa))
 	{
 		if (!b->Type.empty() && !New->exempt)
 		{
@@ -184,6 +184,7 @@ void UserManager::QuitUser(User *user, const std::string &quitreason, const char
 	}
 
 	user->quitting = true;
+	user->server->RemoveUser(user);
 
 	ServerInstance->Logs->Log("USERS", LOG_DEBUG, "QuitUser: %s=%s '%s'", user->uuid.c_str(), user->nick.c_str(), quitreason.c_str());
 	user->Write("ERROR :Closing link: (%s@%s) [%s]", user->ident.c_str(), user->host.c_str(), *operreason ? operreason : quitreason.c_str());
@@ -231,10 +232,10 @@ void UserManager::QuitUser(User *user, const std::string &quitreason, const char
 		}
 		else
 		{
-			if ((!ServerInstance->SilentULine(user->server)) && (!user->quietquit))
+			if ((!ServerInstance->SilentULine(user->server->GetName())) && (!user->quietquit))
 			{
 				ServerInstance->SNO->WriteToSnoMask('Q',"Client exiting on server %s: %s (%s) [%s]",
-					user->server.c_str(), user->GetFullRealHost().c_str(), user->GetIPString().c_str(), oper_reason.c_str());
+					user->server->GetName().c_str(), user->GetFullRealHost().c_str(), user->GetIPString().c_str(), oper_reason.c_str());
 			}
 		}
 	}
@@ -247,6 +248,36 @@ void UserManager::QuitUser(User *user, const std::string &quitreason, const char
 		ServerInstance->Logs->Log("USERS", LOG_DEFAULT, "ERROR: Nick not found in clientlist, cannot remove: " + user->nick);
 
 	ServerInstance->Users->uuidlist->erase(user->uuid);
+	RemoveFromHostIndex(user);
+}
+
+void UserManager::UpdateHostIndex(User* user)
+{
+	std::string key = GetHostIndexKey(user->dhost);
+	if (user->hostindexiter != hostindex.end())
+	{
+		if (user->hostindexiter->first == key)
+			return;
+		hostindex.erase(user->hostindexiter);
+	}
+	user->hostindexiter = hostindex.insert(std::make_pair(key, user));
+}
+
+void UserManager::RemoveFromHostIndex(User* user)
+{
+	if (user->hostindexiter != hostindex.end())
+	{
+		hostindex.erase(user->hostindexiter);
+		user->hostindexiter = hostindex.end();
+	}
+}
+
+std::string UserManager::GetHostIndexKey(const std::string& host)
+{
+	std::string key(host.rbegin(), host.rend());
+	for (std::string::iterator i = key.begin(); i != key.end(); ++i)
+		*i = ascii_case_insensitive_map[static_cast<unsigned char>(*i)];
+	return key;
 }
 
 void UserManager::AddLocalClone(User *user)
@@ -69,8 +69,8 @@ const char* User::FormatModes(bool showparameters)
 	return data.c_str();
 }
 
-User::User(const std::string &uid, const std::string& sid, int type)
-	: uuid(uid), server(sid), usertype(type)
+User::User(const std::string &uid, Server* srv, int type)
+	: uuid(uid), server(srv), prevonserver(NULL), nextonserver(NULL), hostindexiter(ServerInstance->Users->hostindex.end()), usertype(type)
 {
 	age = ServerInstance->Time();
 	signon = 0;
@@ -82,10 +82,13 @@ User::User(const std::string &uid, const std::string& sid, int type)
 
 	if (!ServerInstance->Users->uuidlist->insert(std::make_pair(uuid, this)).second)
 		throw CoreException("Duplicate UUID "+std::string(uuid)+" in User constructor");
+
+	if (type != USERTYPE_SERVER)
+		server->AddUser(this);
 }
 
 LocalUser::LocalUser(int myfd, irc::sockets::sockaddrs* client, irc::sockets::sockaddrs* servaddr)
-	: User(ServerInstance->UIDGen.GetUID(), ServerInstance->Config->ServerName, USERTYPE_LOCAL), eh(this),
+	: User(ServerInstance->UIDGen.GetUID(), ServerInstance->FakeClient->server, USERTYPE_LOCAL), eh(this),
 	localuseriter(ServerInstance->Users->local_users.end()),
 	bytes_in(0), bytes_out(0), cmds_in(0), cmds_out(0), nping(0), CommandFloodPenalty(0),
 	already_sent(0)
@@ -260,42 +263,44 @@ void UserIOHandler::OnDataReady()
 	if (!user->HasPrivPermission("users/flood/no-fakelag"))
 		penaltymax = user->MyClass->GetPenaltyThreshold() * 1000;
 
+	// Lines are pulled out of the recvq by moving qpos forward, the consumed
+	// part is erased once we are done instead of after every line
+	const std::string::size_type linemax = ServerInstance->Config->Limits.MaxLine - 2;
+	std::string line;
+	line.reserve(ServerInstance->Config->Limits.MaxLine);
+	std::string::size_type qpos = 0;
 	while (user->CommandFloodPenalty < penaltymax && getSendQSize() < sendqmax)
 	{
-		std::string line;
-		line.reserve(ServerInstance->Config->Limits.MaxLine);
-		std::string::size_type qpos = 0;
-		while (qpos < recvq.length())
+		const char* start = recvq.data() + qpos;
+		const char* eol = static_cast<const char*>(memchr(start, '\n', recvq.length() - qpos));
+		if (!eol)
+			// the recvq ran out before we found a newline
+			break;
+
+		line.clear();
+		for (const char* c = start; c != eol && line.length() < linemax; ++c)
 		{
-			char c = recvq[qpos++];
-			switch (c)
-			{
-			case '\0':
-				c = ' ';
-				break;
-			case '\r':
+			if (*c == '\r')
 				continue;
-			case '\n':
-				goto eol_found;
-			}
-			if (line.length() < ServerInstance->Config->Limits.MaxLine - 2)
-				line.push_back(c);
+			line.push_back(*c ? *c : ' ');
 		}
-		// if we got here, the recvq ran out before we found a newline
-		return;
-eol_found:
-		// just found a newline. Terminate the string, and pull it out of recvq
-		recvq = recvq.substr(qpos);
+
+		std::string::size_type linelen = eol - start + 1;
+		qpos += linelen;
 
 		// TODO should this be moved to when it was inserted in recvq?
-		ServerInstance->stats->statsRecv += qpos;
-		user->bytes_in += qpos;
+		ServerInstance->stats->statsRecv += linelen;
+		user->bytes_in += linelen;
 		user->cmds_in++;
 
 		ServerInstance->Parser->ProcessBuffer(line, user);
 		if (user->quitting)
-			return;
+			break;
 	}
+	recvq.erase(0, qpos);
+	if (user->quitting)
+		return;
+
 	if (user->CommandFloodPenalty >= penaltymax && !user->MyClass->fakelag)
 		ServerInstance->Users->QuitUser(user, "Excess Flood");
 }
@@ -608,13 +613,14 @@ void LocalUser::FullConnect()
 	FOREACH_MOD(OnUserConnect, (this));
 
 	this->registered = REG_ALL;
+	ServerInstance->Users->UpdateHostIndex(this);
 
 	FOREACH_MOD(OnPostConnect, (this));
 
 	ServerInstance->SNO->WriteToSnoMask('c',"Client connecting on port %d (class %s): %s (%s) [%s]",
 		this->GetServerPort(), this->MyClass->name.c_str(), GetFullRealHost().c_str(), this->GetIPString().c_str(), this->fullname.c_str());
 	ServerInstance->Logs->Log("BANCACHE", LOG_DEBUG, "BanCache: Adding NEGATIVE hit for " + this->GetIPString());
-	ServerInstance->BanCache->AddHit(this->GetIPString(), "", "");
+	ServerInstance->BanCache->AddHit(this->client_sa, "", "");
 	// reset the flood penalty (which could have been raised due to things like auto +x)
 	CommandFloodPenalty = 0;
 }
@@ -843,7 +849,9 @@ void LocalUser::Write(const std::string& text)
 		return;
 	}
 
-	ServerInstance->Logs->Log("USEROUTPUT", LOG_RAWIO, "C[%s] O %s", uuid.c_str(), text.c_str());
+	// Skip formatting the log line for every recipient of a channel message unless it can be logged
+	if (ServerInstance->Config->RawLog)
+		ServerInstance->Logs->Log("USEROUTPUT", LOG_RAWIO, "C[%s] O %s", uuid.c_str(), text.c_str());
 
 	eh.AddWriteBuf(text);
 	eh.AddWriteBuf(wide_newline);
@@ -853,6 +861,30 @@ void LocalUser::Write(const std::string& text)
 	this->cmds_out++;
 }
 
+void LocalUser::WriteBlock(const std::string& lines, unsigned int count)
+{
+	if (!ServerInstance->SE->BoundsCheckFd(&eh))
+		return;
+
+	if (ServerInstance->Config->RawLog)
+	{
+		irc::sepstream linestream(lines, '\n');
+		std::string line;
+		while (linestream.GetToken(line))
+		{
+			if (line[line.length() - 1] == '\r')
+				line.erase(line.length() - 1);
+			ServerInstance->Logs->Log("USEROUTPUT", LOG_RAWIO, "C[%s] O %s", uuid.c_str(), line.c_str());
+		}
+	}
+
+	eh.AddWriteBuf(lines);
+
+	ServerInstance->stats->statsSent += lines.length();
+	this->bytes_out += lines.length();
+	this->cmds_out += count;
+}
+
 /** Write()
  */
 void LocalUser::Write(const char *text, ...)
@@ -1139,6 +1171,9 @@ bool User::ChangeDisplayedHost(const std::string& shost)
 	this->dhost.assign(shost, 0, 64);
 	this->InvalidateCache();
 
+	if (hostindexiter != ServerInstance->Users->hostindex.end())
+		ServerInstance->Users->UpdateHostIndex(this);
+
 	if (IS_LOCAL(this))
 		this->WriteNumeric(RPL_YOURDISPLAYEDHOST, "%s :is now your displayed host", this->dhost.c_str());
 
@@ -1199,9 +1234,16 @@ void LocalUser::SetClass(const std::string &explicit_name)
 	}
 	else
 	{
-		for (ClassVector::iterator i = ServerInstance->Config->Classes.begin(); i != ServerInstance->Config->Classes.end(); i++)
+		/* Only the classes whose mask matches need checking. Named classes match
+		 * nobody by mask, but a module hooked in may still force one of them.
+		 */
+		std::vector<size_t> candidates;
+		const bool hooked = !ServerInstance->Modules->EventHandlers[I_OnSetConnectClass].empty();
+		ServerInstance->Config->FindConnectClasses(this, candidates, hooked);
+
+		for (std::vector<size_t>::const_iterator n = candidates.begin(); n != candidates.end(); ++n)
 		{
-			ConnectClass* c = *i;
+			ConnectClass* c = ServerInstance->Config->Classes[*n];
 			ServerInstance->Logs->Log("CONNECTCLASS", LOG_DEBUG, "Checking %s", c->GetName().c_str());
 
 			ModResult MOD_RESULT;
@@ -1222,14 +1264,6 @@ void LocalUser::SetClass(const std::string &explicit_name)
 			if (c->config->getBool("registered", regdone) != regdone)
 				continue;
 
-			/* check if host matches.. */
-			if (!InspIRCd::MatchCIDR(this->GetIPString(), c->GetHost(), NULL) &&
-			    !InspIRCd::MatchCIDR(this->host, c->GetHost(), NULL))
-			{
-				ServerInstance->Logs->Log("CONNECTCLASS", LOG_DEBUG, "No host match (for %s)", c->GetHost().c_str());
-				continue;
-			}
-
 			/*
 			 * deny change if change will take class over the limit check it HERE, not after we found a matching class,
 			 * because we should attempt to find another class if this one doesn't match us. -- w00t
@@ -1291,14 +1325,14 @@ const std::string& FakeUser::GetFullHost()
 {
 	if (!ServerInstance->Config->HideWhoisServer.empty())
 		return ServerInstance->Config->HideWhoisServer;
-	return server;
+	return server->GetName();
 }
 
 const std::string& FakeUser::GetFullRealHost()
 {
 	if (!ServerInstance->Config->HideWhoisServer.empty())
 		return ServerInstance->Config->HideWhoisServer;
-	return server;
+	return server->GetName();
 }
 
 ConnectClass::ConnectClass(ConfigTag* tag, char t, const std::string& mask)
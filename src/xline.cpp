@@ -141,8 +141,180 @@ bool XLine::Matches(User *u)
 	return false;
 }
 
+/** Get the mask a line of one of the indexed core types is filed under
+ */
+static const std::string& GetIndexMask(XLine* line)
+{
+	switch (line->type[0])
+	{
+		case 'G':
+			return static_cast<GLine*>(line)->hostmask;
+		case 'K':
+			return static_cast<KLine*>(line)->hostmask;
+		case 'E':
+			return static_cast<ELine*>(line)->hostmask;
+		case 'Z':
+			return static_cast<ZLine*>(line)->ipaddr;
+		default:
+			return static_cast<QLine*>(line)->nick;
+	}
+}
+
+std::string XLineIndex::Fold(const std::string& str) const
+{
+	unsigned const char* map = casemap ? casemap : national_case_insensitive_map;
+	std::string ret(str);
+	for (std::string::iterator i = ret.begin(); i != ret.end(); ++i)
+		*i = map[(unsigned char)*i];
+	return ret;
+}
+
+/** Add a line to, or remove it from, a list of lines */
+static void UpdateList(XLineIndex::LineList& list, XLine* line, bool add)
+{
+	if (add)
+	{
+		list.push_back(line);
+		return;
+	}
+
+	XLineIndex::LineList::iterator pos = std::find(list.begin(), list.end(), line);
+	if (pos != list.end())
+		list.erase(pos);
+}
+
+void XLineIndex::UpdateMap(MaskMap& map, const std::string& key, XLine* line, bool add)
+{
+	LineList& list = map[key];
+	UpdateList(list, line, add);
+	if (list.empty())
+		map.erase(key);
+}
+
+void XLineIndex::Update(XLine* line, const std::string& mask, bool add)
+{
+	const std::string::size_type wild = mask.find_first_of("*?");
+
+	if (type != INDEX_NICK && mask.find('/') != std::string::npos)
+	{
+		/* InspIRCd::MatchCIDR treats any mask containing a slash as a CIDR mask, and some
+		 * malformed ones match every host which isn't an IP, so only valid ones are indexed.
+		 */
+		irc::sockets::sockaddrs sa;
+		if (wild != std::string::npos || mask.find('@') != std::string::npos ||
+			!irc::sockets::aptosa(mask.substr(0, mask.rfind('/')), 0, sa))
+		{
+			UpdateList(residual, line, add);
+			return;
+		}
+
+		irc::sockets::cidr_mask cidr(mask);
+		if (cidr.length <= (cidr.type == AF_INET ? 32 : 128))
+		{
+			LineList& list = cidrs[cidr];
+			UpdateList(list, line, add);
+			if (list.empty())
+				cidrs.erase(cidr);
+		}
+
+		UpdateMap(exact, Fold(mask), line, add);
+		return;
+	}
+
+	if (wild == std::string::npos)
+		UpdateMap(exact, Fold(mask), line, add);
+	else if (type != INDEX_NICK && mask.length() > 2 && wild == 0 && mask[1] == '.' && mask.find_first_of("*?", 1) == std::string::npos)
+		UpdateMap(suffixes, Fold(mask.substr(1)), line, add);
+	else if (type != INDEX_NICK && mask.length() > 2 && wild == mask.length() - 1 && mask[wild - 1] == '.')
+		UpdateMap(prefixes, Fold(mask.substr(0, wild)), line, add);
+	else
+		UpdateList(residual, line, add);
+}
+
+void XLineIndex::Find(const std::string& subject, LineList& out)
+{
+	const std::string folded = Fold(subject);
+
+	MaskMap::const_iterator i = exact.find(folded);
+	if (i != exact.end())
+		out.insert(out.end(), i->second.begin(), i->second.end());
+
+	if (!suffixes.empty() || !prefixes.empty())
+	{
+		/* "*.example.com" can only match a subject ending in ".example.com", and
+		 * "192.168.*" one starting with "192.168.", so try each dot in the subject.
+		 */
+		for (std::string::size_type pos = folded.find('.'); pos != std::string::npos; pos = folded.find('.', pos + 1))
+		{
+			if (!suffixes.empty() && (i = suffixes.find(folded.substr(pos))) != suffixes.end())
+				out.insert(out.end(), i->second.begin(), i->second.end());
+			if (!prefixes.empty() && (i = prefixes.find(folded.substr(0, pos + 1))) != prefixes.end())
+				out.insert(out.end(), i->second.begin(), i->second.end());
+		}
+	}
+
+	irc::sockets::sockaddrs sa;
+	if (!cidrs.empty() && irc::sockets::aptosa(subject, 0, sa))
+	{
+		std::vector<LineList*> lists;
+		cidrs.lookup(sa, lists);
+		for (std::vector<LineList*>::const_iterator l = lists.begin(); l != lists.end(); ++l)
+			out.insert(out.end(), (*l)->begin(), (*l)->end());
+	}
+}
+
+/** Orders lines the way the XLineLookup of their type does, so the line found first
+ * does not depend on which lines the index happened to return
+ */
+struct LookupOrder
+{
+	bool operator()(XLine* a, XLine* b) const
+	{
+		const std::string& x = a->Displayable();
+		const std::string& y = b->Displayable();
+		int res = irc::irc_char_traits::compare(x.c_str(), y.c_str(), std::min(x.length(), y.length()));
+		return res ? res < 0 : x.length() < y.length();
+	}
+};
+
+void XLineIndex::FindCandidates(User* user, LineList& out)
+{
+	switch (type)
+	{
+		case INDEX_HOST:
+			Find(user->host, out);
+			if (user->host != user->GetIPString())
+				Find(user->GetIPString(), out);
+			break;
+		case INDEX_IP:
+			Find(user->GetIPString(), out);
+			break;
+		case INDEX_NICK:
+			Find(user->nick, out);
+			break;
+	}
+
+	out.insert(out.end(), residual.begin(), residual.end());
+	std::sort(out.begin(), out.end(), LookupOrder());
+	out.erase(std::unique(out.begin(), out.end()), out.end());
+}
+
+void XLineIndex::FindCandidates(const std::string& str, LineList& out)
+{
+	Find(str, out);
+	out.insert(out.end(), residual.begin(), residual.end());
+	std::sort(out.begin(), out.end(), LookupOrder());
+	out.erase(std::unique(out.begin(), out.end()), out.end());
+}
+
+XLineIndex* XLineManager::GetIndex(const std::string& type)
+{
+	std::map<std::string, XLineIndex*>::iterator i = line_indexes.find(type);
+	return (i == line_indexes.end()) ? NULL : i->second;
+}
+
 /*
- * Checks what users match a given vector of ELines and sets their ban exempt flag accordingly.
+ * Checks what users match the ELines and sets their ban exempt flag accordingly.
  */
 void XLineManager::CheckELines()
 {
@@ -156,22 +328,25 @@ void XLineManager::CheckELines()
 	if (ELines.empty())
 		return;
 
+	XLineIndex* index = GetIndex("E");
+	XLineIndex::LineList candidates;
+
 	for (LocalUserList::const_iterator u2 = ServerInstance->Users->local_users.begin(); u2 != ServerInstance->Users->local_users.end(); u2++)
 	{
 		LocalUser* u = *u2;
 
-		/* This uses safe iteration to ensure that if a line expires here, it doenst trash the iterator */
-		LookupIter safei;
+		/* ELine::Matches() never matches a user who is already exempt */
+		u->exempt = false;
 
-		for (LookupIter i = ELines.begin(); i != ELines.end(); )
+		candidates.clear();
+		index->FindCandidates(u, candidates);
+		for (XLineIndex::LineList::const_iterator i = candidates.begin(); i != candidates.end(); ++i)
 		{
-			safei = i;
-			safei++;
-
-			XLine *e = i->second;
-			u->exempt = e->Matches(u);
-
-			i = safei;
+			if ((*i)->Matches(u))
+			{
+				u->exempt = true;
+				break;
+			}
 		}
 	}
 }
@@ -282,6 +457,11 @@ bool XLineManager::AddLine(XLine* line, User* user)
 		pending_lines.push_back(line);
 
 	lookup_lines[line->type][line->Displayable().c_str()] = line;
+
+	XLineIndex* index = GetIndex(line->type);
+	if (index)
+		index->Add(line, GetIndexMask(line));
+
 	line->OnAdd();
 
 	FOREACH_MOD(OnAddLine, (user, line));
@@ -316,6 +496,10 @@ bool XLineManager::DelLine(const char* hostmask, const std::string &type, User*
 	if (pptr != pending_lines.end())
 		pending_lines.erase(pptr);
 
+	XLineIndex* index = GetIndex(type);
+	if (index)
+		index->Remove(y->second, GetIndexMask(y->second));
+
 	delete y->second;
 	x->second.erase(y);
 
@@ -346,6 +530,29 @@ XLine* XLineManager::MatchesLine(const std::string &type, User* user)
 
 	const time_t current = ServerInstance->Time();
 
+	XLineIndex* index = GetIndex(type);
+	if (index)
+	{
+		XLineIndex::LineList candidates;
+		index->FindCandidates(user, candidates);
+
+		for (XLineIndex::LineList::const_iterator i = candidates.begin(); i != candidates.end(); ++i)
+		{
+			XLine* line = *i;
+			if (line->duration && current > line->expiry)
+			{
+				LookupIter item = x->second.find(line->Displayable().c_str());
+				if (item != x->second.end())
+					ExpireLine(x, item);
+				continue;
+			}
+
+			if (line->Matches(user))
+				return line;
+		}
+		return NULL;
+	}
+
 	LookupIter safei;
 
 	for (LookupIter i = x->second.begin(); i != x->second.end(); )
@@ -380,7 +587,33 @@ XLine* XLineManager::MatchesLine(const std::string &type, const std::string &pat
 
 	const time_t current = ServerInstance->Time();
 
-	 LookupIter safei;
+	/* G, K and E lines match strings against their full ident@host mask, which isn't indexed */
+	XLineIndex* index = GetIndex(type);
+	if (index && index->GetType() != XLineIndex::INDEX_HOST)
+	{
+		XLineIndex::LineList candidates;
+		index->FindCandidates(pattern, candidates);
+
+		for (XLineIndex::LineList::const_iterator i = candidates.begin(); i != candidates.end(); ++i)
+		{
+			XLine* line = *i;
+			if (!line->Matches(pattern))
+				continue;
+
+			if (line->duration && current > line->expiry)
+			{
+				LookupIter item = x->second.find(line->Displayable().c_str());
+				if (item != x->second.end())
+					ExpireLine(x, item);
+				continue;
+			}
+
+			return line;
+		}
+		return NULL;
+	}
+
+	LookupIter safei;
 
 	for (LookupIter i = x->second.begin(); i != x->second.end(); )
 	{
@@ -422,6 +655,10 @@ void XLineManager::ExpireLine(ContainerIter container, LookupIter item)
 	if (pptr != pending_lines.end())
 		pending_lines.erase(pptr);
 
+	XLineIndex* index = GetIndex(container->first);
+	if (index)
+		index->Remove(item->second, GetIndexMask(item->second));
+
 	delete item->second;
 	container->second.erase(item);
 }
@@ -430,6 +667,30 @@ void XLineManager::ExpireLine(ContainerIter container, LookupIter item)
 // applies lines, removing clients and changing nicks etc as applicable
 void XLineManager::ApplyLines()
 {
+	/* When only a few lines are pending it is cheapest to try each of them against every user.
+	 * When a lot of lines of an indexed type are pending (e.g. during a netburst) ask the index
+	 * which lines could match each user instead, and apply the pending ones among those.
+	 */
+	std::map<std::string, std::vector<XLine*> > bytype;
+	for (std::vector<XLine *>::iterator i = pending_lines.begin(); i != pending_lines.end(); i++)
+		bytype[(*i)->type].push_back(*i);
+
+	std::vector<XLine*> scan;
+	std::vector<XLineIndex*> indexes;
+	std::set<XLine*> indexed;
+	for (std::map<std::string, std::vector<XLine*> >::iterator i = bytype.begin(); i != bytype.end(); ++i)
+	{
+		XLineIndex* index = GetIndex(i->first);
+		if (index && i->second.size() > index->ResidualCount() + 16)
+		{
+			indexes.push_back(index);
+			indexed.insert(i->second.begin(), i->second.end());
+		}
+		else
+			scan.insert(scan.end(), i->second.begin(), i->second.end());
+	}
+
+	XLineIndex::LineList candidates;
 	LocalUserList::reverse_iterator u2 = ServerInstance->Users->local_users.rbegin();
 	while (u2 != ServerInstance->Users->local_users.rend())
 	{
@@ -439,12 +700,24 @@ void XLineManager::ApplyLines()
 		if (u->exempt)
 			continue;
 
-		for (std::vector<XLine *>::iterator i = pending_lines.begin(); i != pending_lines.end(); i++)
+		for (std::vector<XLine *>::iterator i = scan.begin(); i != scan.end(); i++)
 		{
 			XLine *x = *i;
 			if (x->Matches(u))
 				x->Apply(u);
 		}
+
+		for (std::vector<XLineIndex*>::iterator i = indexes.begin(); i != indexes.end(); ++i)
+		{
+			candidates.clear();
+			(*i)->FindCandidates(u, candidates);
+			for (XLineIndex::LineList::iterator j = candidates.begin(); j != candidates.end(); ++j)
+			{
+				XLine *x = *j;
+				if (indexed.count(x) && x->Matches(u))
+					x->Apply(u);
+			}
+		}
 	}
 
 	pending_lines.clear();
@@ -499,6 +772,12 @@ XLineManager::XLineManager()
 	RegisterFactory(KFact);
 	RegisterFactory(QFact);
 	RegisterFactory(ZFact);
+
+	line_indexes["G"] = new XLineIndex(XLineIndex::INDEX_HOST, ascii_case_insensitive_map);
+	line_indexes["E"] = new XLineIndex(XLineIndex::INDEX_HOST, ascii_case_insensitive_map);
+	line_indexes["K"] = new XLineIndex(XLineIndex::INDEX_HOST, ascii_case_insensitive_map);
+	line_indexes["Q"] = new XLineIndex(XLineIndex::INDEX_NICK, NULL);
+	line_indexes["Z"] = new XLineIndex(XLineIndex::INDEX_IP, NULL);
 }
 
 XLineManager::~XLineManager()
@@ -518,6 +797,9 @@ XLineManager::~XLineManager()
 			delete j->second;
 		}
 	}
+
+	for (std::map<std::string, XLineIndex*>::iterator i = line_indexes.begin(); i != line_indexes.end(); ++i)
+		delete i->second;
 }
 
 void XLine::Apply(User* u)
@@ -545,7 +827,7 @@ void XLine::DefaultApply(User* u, const std::string &line, bool bancache)
 	if (bancache)
 	{
 		ServerInstance->Logs->Log("BANCACHE", LOG_DEBUG, "BanCache: Adding positive hit (" + line + ") for " + u->GetIPString());
-		ServerInstance->BanCache->AddHit(u->GetIPString(), this->type, line + "-Lined: " + this->reason, this->duration);
+		ServerInstance->BanCache->AddHit(u->client_sa, this->type, line + "-Lined: " + this->reason, this->duration);
 	}
 }
 